@@ -1,300 +1,1934 @@
 #include "algorithm"
 #include "limits.h"
+#include <new>
 
 #include "unzen.h"
 #include "unzen_hal.h"
+#include "unzen_convert.h"
+#include "unzen_graph.h"
+#include "unzen_resampler.h"
 
 namespace unzen 
 {
-    Framework::Framework()
+    Framework::Framework( unsigned int port )
+    {
+        _initialize();
+        _setup_irq( port );
+        _fixed_buffers = false;
+        
+            // Initialy block(buffer) size is 1.
+        set_block_size( 1 );
+    }
+    
+    Framework::Framework( transport_type transport )
+    {
+        _initialize();
+        _fixed_buffers = false;
+        _transport = transport;
+        
+            // Initialy block(buffer) size is 1.
+        set_block_size( 1 );
+    }
+    
+    Framework::Framework( unsigned int block_size, unsigned int channels, unsigned int depth, unsigned int port )
+    {
+        _initialize();
+        _setup_irq( port );
+        _fixed_buffers = true;
+        
+            // The buffers are given by _attach_buffers() of the derived class.
+        _block_size = block_size;
+        _channels = channels;
+        _buffer_depth = depth;
+    }
+    
+    Framework::~Framework(void)
+    {
+        if ( _port < (unsigned int)max_ports && Framework::_instances[_port] == this )
+            Framework::_instances[_port] = NULL;
+            
+        if ( _fixed_buffers )
+            return;
+            
+        _release_buffers();
+        delete [] _pending_heap_memory;
+        delete [] _retired_memory;
+        delete _input_resampler;
+        delete _output_resampler;
+        delete [] _internal_buffer_memory;
+    }
+    
+    void Framework::_initialize(void)
     {
-            // setup handle for the interrupt handler
-        Framework::_fw = this;
-
             // Clear all buffers        
-        _tx_int_buffer[0] = NULL;
-        _tx_int_buffer[1] = NULL;
-        _rx_int_buffer[0] = NULL;
-        _rx_int_buffer[1] = NULL;
-        
-        _tx_left_buffer = NULL;
-        _tx_right_buffer = NULL;
-        _rx_left_buffer = NULL;
-        _rx_right_buffer = NULL;
+        for ( int i=0; i<max_buffer_depth; i++ )
+        {
+            _tx_int_buffer[i] = NULL;
+            _rx_int_buffer[i] = NULL;
+        }
+        for ( int ch=0; ch<max_channels; ch++ )
+        {
+            _tx_float_buffer[ch] = NULL;
+            _rx_float_buffer[ch] = NULL;
+        }
+        _heap_memory = NULL;
+        _buffer_memory = NULL;
+        _buffer_memory_size = 0;
+        _int_buffer_stride = 0;
+        _float_buffer_stride = 0;
+        _float_buffers = true;
+        
+            // Not running. The block size is changed immediately. 
+        _started = false;
+        _resize_state = resize_idle;
+        _pending_memory = NULL;
+        _pending_heap_memory = NULL;
+        _pending_block_size = 0;
+        _pending_int_buffer_stride = 0;
+        _pending_float_buffer_stride = 0;
+        _retired_memory = NULL;
+        _fade_index = 0;
+        _fade_sent = false;
+        _fade_in = false;
+        _fade_position = 0;
+        _fade_length = 0;
+        
+            // No port. _setup_irq() gives one.
+        _port = max_ports;
+        
+            // I2S is stereo, with double buffer.
+        _channels = 2;
+        _buffer_depth = 2;
  
             // Initialize all buffer
         _buffer_index = 0;
         _sample_index = 0;
+        _dma_restarting = false;
         
             // Clear all callbacks
-        _pre_interrupt_callback = NULL;
-        _post_interrupt_callback = NULL;
-        _pre_process_callback = NULL;
-        _post_process_callback = NULL;
+        _init_callback = NULL;
+        _init_context_callback = NULL;
+        _init_context = NULL;
+        hook_type no_hook = { NULL, NULL, NULL };
+        _pre_interrupt_hook = no_hook;
+        _post_interrupt_hook = no_hook;
+        _pre_process_hook = no_hook;
+        _post_process_hook = no_hook;
         
         _process_callback = NULL;
+        _q31_process_callback = NULL;
+        _multichannel_process_callback = NULL;
+        _interleaved_process_callback = NULL;
+        _graph = NULL;
+        _block_processor = NULL;
+        _processor_context = NULL;
+        _context_processor.callback = NULL;
+        _context_processor.context = NULL;
+        
+            // No resampling. The call back runs at the codec rate. 
+        _resampling_up = 1;
+        _resampling_down = 1;
+        _input_resampler = NULL;
+        _output_resampler = NULL;
+        _internal_block_size = 0;
+        for ( int ch=0; ch<max_channels; ch++ )
+        {
+            _rx_internal_buffer[ch] = NULL;
+            _tx_internal_buffer[ch] = NULL;
+        }
+        _internal_buffer_memory = NULL;
+        
+            // No parameter call back. Messages are discarded.
+        _parameter_callback = NULL;
+        _parameter_drain_limit = 4;
+        
+            // No tap.
+        for ( int i=0; i<max_taps; i++ )
+        {
+            _taps[i].point = tap_rx;
+            _taps[i].channel = 0;
+            _taps[i].decimation = 1;
+            _taps[i].phase = 0;
+            _taps[i].overflow_count = 0;
+        }
+        _tap_count = 0;
 
+            // By default, CPU moves data in the I2S interrupt.
+        _transport = fifo_transport;
         
-            // Initialy block(buffer) size is 1.
-        set_block_size( 1 );
+            // By default, the process runs in the process IRQ. 
+        _execution = irq_execution;
         
-            // Initialize I2S peripheral
-        hal_i2s_setup();
+            // The fast path is decided in start(). 
+        _single_frame_enabled = true;
+        _single_frame = false;
+        
+            // 32bit slot. Compatible with older version. 
+        _data_size = data_size_32;
+        
+            // No overrun yet. By default, overrun is only counted. 
+        _xrun_policy = xrun_ignore;
+        _dispatched_blocks = 0;
+        _processed_blocks = 0;
+        for ( int i=0; i<max_buffer_depth; i++ )
+        {
+            _block_queue[i] = 0;
+            _block_dispatch_cycle[i] = 0;
+            _block_dispatch_profiled[i] = false;
+        }
+        _xrun_count = 0;
+        _dropped_block_count = 0;
+        _repeat_index = 0;
+        _repeat_requests = 0;
+        _repeat_done = 0;
+        
+            // Profiler is off. 
+        _profiling = false;
+        _profiling_block = false;
+        _profile_block_start = 0;
+        _profile_last_mark = 0;
+        _profile_last_boundary = 0;
+        _profile_has_boundary = false;
+        for ( int i=0; i<number_of_profile_stages; i++ )
+        {
+            profile_counter_type & c = _profile_counters[i];
+            
+            c.sequence = 0;
+            c.reset_requests = 0;
+            c.reset_done = 0;
+            c.count = 0;
+            c.min = 0;
+            c.max = 0;
+            c.sum = 0;
+            for ( int b=0; b<profile_histogram_bins; b++ )
+                c.histogram[b] = 0;
+        }
+    }
+    
+    void Framework::_setup_irq( unsigned int port )
+    {
+        static_assert( max_ports == 2, "Update the handler tables" );
+        static void (* const i2s_irq_handlers[max_ports] )() = { _i2s_irq_handler< 0 >, _i2s_irq_handler< 1 > };
+        static void (* const dma_irq_handlers[max_ports] )() = { _dma_irq_handler< 0 >, _dma_irq_handler< 1 > };
+        
+            // start() returns port_error. 
+        if ( port >= (unsigned int)max_ports )
+            return;
+            
+            // setup handle for the interrupt handler. The last object of the port takes it. 
+        _port = port;
+        Framework::_instances[port] = this;
 
-            // Setup the interrupt for the I2S
-        NVIC_SetVector(hal_get_i2s_irq_id(), (uint32_t)_i2s_irq_handler);
+            // Setup the interrupt for the I2S and DMA.
+            // The I2S peripheral itself is initialized in start(), because it depends on the transport. 
         set_i2s_irq_priority(hal_get_i2s_irq_priority_level());
-        NVIC_EnableIRQ(hal_get_i2s_irq_id());
+        hal_irq_setup(hal_get_i2s_irq_id( port ), i2s_irq_handlers[port]);
+        hal_irq_setup(hal_get_dma_irq_id( port ), dma_irq_handlers[port]);
 
-            // Setup the interrupt for the process
-        NVIC_SetVector(hal_get_process_irq_id(), (uint32_t)_process_irq_handler);
+            // Priority of the process IRQ. The handler is installed in start(), by the execution mode. 
         set_process_irq_priority(hal_get_process_irq_priority_level());
-        NVIC_EnableIRQ(hal_get_process_irq_id());
-        
+    }
+    
+    error_type Framework::_check_port(void) const
+    {
+            // The offline framework has no port. 
+        if ( _transport == offline_transport )
+            return no_error;
+            
+        if ( _port >= (unsigned int)max_ports || Framework::_instances[_port] != this )
+            return port_error;
+            
+        return no_error;
+    }
+    
+    void Framework::set_shared_process_irq( bool shared )
+    {
+        _shared_process_irq = shared;
     }
 
     error_type Framework::set_block_size(  unsigned int new_block_size )
     {
+        if ( _fixed_buffers )
+            return block_size_error;
         
-        delete [] _tx_int_buffer[0];
-        delete [] _tx_int_buffer[1];
-        delete [] _rx_int_buffer[0];
-        delete [] _rx_int_buffer[1];
+            // The I2S is using the buffers. Swap them at a block boundary. 
+        if ( _started && _transport != offline_transport )
+            return _request_block_size( new_block_size );
         
-        delete [] _tx_left_buffer;
-        delete [] _tx_right_buffer;
-        delete [] _rx_left_buffer;
-        delete [] _rx_right_buffer;
+        _release_buffers();
         
         _block_size = new_block_size;
+        _int_buffer_stride = _int_buffer_words( _block_size, _channels, _data_size );
+        _float_buffer_stride = ( _block_size + cache_line_words - 1 ) / cache_line_words * cache_line_words;
 
-        _tx_int_buffer[0] = new int[ 2 * _block_size ];
-        _tx_int_buffer[1] = new int[ 2 * _block_size ];
-        _rx_int_buffer[0] = new int[ 2 * _block_size ];
-        _rx_int_buffer[1] = new int[ 2 * _block_size ];
+        unsigned int footprint = get_buffer_footprint();
+        int32_t * aligned;
         
-        _tx_left_buffer = new float[ _block_size ];
-        _tx_right_buffer = new float[ _block_size ];
-        _rx_left_buffer = new float[ _block_size ];
-        _rx_right_buffer = new float[ _block_size ];
- 
-            // error check
-        if ( _rx_int_buffer[0] == NULL |
-             _rx_int_buffer[1] == NULL |
-             _tx_int_buffer[0] == NULL |
-             _tx_int_buffer[1] == NULL |
-             _rx_right_buffer == NULL |
-             _tx_right_buffer == NULL |
-             _rx_left_buffer == NULL |
-             _tx_left_buffer == NULL )
-        {   // if error, release all 
-            delete [] _tx_int_buffer[0];
-            delete [] _tx_int_buffer[1];
-            delete [] _rx_int_buffer[0];
-            delete [] _rx_int_buffer[1];
-            
-            delete [] _tx_left_buffer;
-            delete [] _tx_right_buffer;
-            delete [] _rx_left_buffer;
-            delete [] _rx_right_buffer;
-            
-            _tx_int_buffer[0] = NULL;
-            _tx_int_buffer[1] = NULL;
-            _rx_int_buffer[0] = NULL;
-            _rx_int_buffer[1] = NULL;
-            
-            _tx_left_buffer = NULL;
-            _tx_right_buffer = NULL;
-            _rx_left_buffer = NULL;
-            _rx_right_buffer = NULL;
+        if ( _buffer_memory )
+        {
+                // The memory given by the application. Already aligned.
+            if ( footprint > _buffer_memory_size )
+                return memory_size_error;
+            aligned = (int32_t *)_buffer_memory;
+        }
+        else
+        {
+                // Allocate all buffers at once, with the margin to align them to the cache line.
+            _heap_memory = new ( std::nothrow ) int32_t[ footprint / sizeof(int32_t) + cache_line_words ];
+            if ( _heap_memory == NULL )
+                return memory_allocation_error;
+            aligned = (int32_t *)( ( (uintptr_t)_heap_memory + cache_line_words * sizeof(int32_t) - 1 ) 
+                                   & ~(uintptr_t)( cache_line_words * sizeof(int32_t) - 1 ) );
+        }
+
+        for ( unsigned int i=0; i<footprint / sizeof(int32_t); i++ )
+            aligned[i] = 0;
+        _assign_int_buffers( aligned );
+        _assign_float_buffers( _float_buffers ? (float *)( aligned + 2 * _buffer_depth * _int_buffer_stride ) : NULL );
+        
+            // Offline, the change is done between the blocks. Initialize the processing for the new size. 
+        if ( _started )
+        {
+            if ( _graph && _graph->plan( _block_size, _channels, _rx_float_buffer, _tx_float_buffer ) != no_error )
+                return memory_allocation_error;
             
-            return memory_allocation_error;
+            error_type error = _setup_resampling();
+            if ( error != no_error )
+                return error;
+            _call_init( _internal_block_size );
+        }
+         
+        return no_error;
+    }
+    
+    unsigned int Framework::get_block_size(void) const
+    {
+        return _block_size;
+    }
+    
+    error_type Framework::_request_block_size( unsigned int new_block_size )
+    {
+            // The last change is not completed yet. 
+        if ( _resize_state != resize_idle )
+            return block_size_error;
+            
+            // The graph plans its buffers in start(). It can't be done while running. 
+            // So are the filters of the resampling. 
+        if ( _graph || _input_resampler )
+            return block_size_error;
+            
+            // The old buffers of the last change are not used anymore. 
+        delete [] _retired_memory;
+        _retired_memory = NULL;
+        
+        int int_buffer_stride = _int_buffer_words( new_block_size, _channels, _data_size );
+        int float_buffer_stride = ( new_block_size + cache_line_words - 1 ) / cache_line_words * cache_line_words;
+        unsigned int footprint = get_buffer_footprint( new_block_size, _channels, _buffer_depth, _data_size, _float_buffers );
+        int32_t * aligned;
+        
+        if ( _buffer_memory )
+        {
+                // The new buffers go to the part of the memory which the current buffers don't use. 
+            int32_t * memory = (int32_t *)_buffer_memory;
+            int32_t * memory_end = memory + _buffer_memory_size / sizeof(int32_t);
+            int32_t * current = _tx_int_buffer[0];
+            int32_t * current_end = current + get_buffer_footprint() / sizeof(int32_t);
+            
+            if ( (unsigned int)( current - memory ) * sizeof(int32_t) >= footprint )
+                aligned = memory;
+            else if ( (unsigned int)( memory_end - current_end ) * sizeof(int32_t) >= footprint )
+                aligned = current_end;
+            else
+                return memory_size_error;
+            _pending_heap_memory = NULL;
+        }
+        else
+        {
+            _pending_heap_memory = new ( std::nothrow ) int32_t[ footprint / sizeof(int32_t) + cache_line_words ];
+            if ( _pending_heap_memory == NULL )
+                return memory_allocation_error;
+            aligned = (int32_t *)( ( (uintptr_t)_pending_heap_memory + cache_line_words * sizeof(int32_t) - 1 ) 
+                                   & ~(uintptr_t)( cache_line_words * sizeof(int32_t) - 1 ) );
+        }
+        
+            // Clear here. The I2S irq only swaps the pointers. 
+        for ( unsigned int i=0; i<footprint / sizeof(int32_t); i++ )
+            aligned[i] = 0;
+        
+        _pending_memory = aligned;
+        _pending_block_size = new_block_size;
+        _pending_int_buffer_stride = int_buffer_stride;
+        _pending_float_buffer_stride = float_buffer_stride;
+        
+            // Publish. The process irq fades out the next block. 
+        _resize_state = resize_requested;
+        
+        return no_error;
+    }
+    
+    bool Framework::_resize_at_boundary( int completed_index )
+    {
+        if ( _resize_state != resize_faded )
+            return false;
+            
+            // The process has faded out the block in this buffer. This completion has sent it. 
+        if ( completed_index == _fade_index )
+            _fade_sent = true;
+        if ( ! _fade_sent )
+            return false;
+            
+            // The rest of the old blocks are not needed. Swap when the process irq is done with the old buffers. 
+        if ( _processed_blocks.load( std::memory_order_acquire ) == _dispatched_blocks.load( std::memory_order_relaxed ) )
+            _swap_buffers();
+        return true;
+    }
+    
+    void Framework::_swap_buffers(void)
+    {
+        _block_size = _pending_block_size;
+        _int_buffer_stride = _pending_int_buffer_stride;
+        _float_buffer_stride = _pending_float_buffer_stride;
+        _assign_int_buffers( _pending_memory );
+        _assign_float_buffers( _float_buffers ? (float *)( _pending_memory + 2 * _buffer_depth * _int_buffer_stride ) : NULL );
+        
+            // main() releases the old heap memory at the next change. 
+        _retired_memory = _heap_memory;
+        _heap_memory = _pending_heap_memory;
+        _pending_heap_memory = NULL;
+        
+            // Start from the first buffer of the new ring. 
+        _buffer_index = 0;
+        _sample_index = 0;
+        _fade_sent = false;
+        if ( _transport == dma_transport )
+        {
+            _dma_buffer_index[0] = 0;
+            _dma_buffer_index[1] = 1;
+            
+                // The I2S stops at the end of the current frame. Don't wait for it in this irq. 
+                // The process irq restarts the DMA at the lower priority. The release store publishes the buffers. 
+            hal_i2s_dma_stop( _port );
+            _dma_restarting.store( true, std::memory_order_release );
+            _signal_process();
         }
+        
+        _resize_state = resize_swapped;
+    }
+    
+    void Framework::_restart_dma(void)
+    {
+            // Not stopped yet. Come back in the next process irq. The I2S irqs of all ports can preempt between. 
+        if ( ! hal_i2s_dma_restart( _port, _rx_int_buffer, _tx_int_buffer, _block_size * _channels ) )
+        {
+            _signal_process();
+            return;
+        }
+        
+        _dma_restarting.store( false, std::memory_order_release );
+    }
+    
+    void Framework::_signal_process(void)
+    {
+        if ( _execution == thread_execution )
+            hal_process_thread_signal( _process_irq_port() );
+        else
+            hal_trigger_irq( hal_get_process_irq_id( _process_irq_port() ) );
+    }
+    
+    bool Framework::_fade_block( int32_t tx[], bool fade_in )
+    {
+            // The fade takes whole blocks, and at least min_fade_frames. 
+        if ( _fade_position == 0 )
+            _fade_length = ( min_fade_frames + _block_size - 1 ) / _block_size * _block_size;
+            
+        for ( int i=0; i<_block_size; i++ )
+        {
+            int position = _fade_position + i;
+            
+                // Q31 gain. Up to full scale at the last frame, or down to 0 at the last frame. 
+            int64_t gain = (int64_t)( fade_in ? position + 1 : _fade_length - 1 - position ) * INT32_MAX / _fade_length;
+            
+            if ( _data_size == data_size_16 )
+            {
+                int16_t * frame = (int16_t *)tx + i * _channels;
+                
+                for ( int ch=0; ch<_channels; ch++ )
+                    frame[ch] = (int16_t)( ( frame[ch] * gain ) >> 31 );
+            }
+            else
+            {
+                for ( int ch=0; ch<_channels; ch++ )
+                    tx[ i * _channels + ch ] = (int32_t)( ( tx[ i * _channels + ch ] * gain ) >> 31 );
+            }
+        }
+        
+        _fade_position += _block_size;
+        if ( _fade_position < _fade_length )
+            return false;
+            
+        _fade_position = 0;
+        return true;
+    }
+    
+    error_type Framework::set_buffer_memory( void * memory, unsigned int size )
+    {
+            // The derived class gives the buffers by itself. The running I2S uses the current memory. 
+        if ( _fixed_buffers || ( _started && _transport != offline_transport ) )
+            return memory_size_error;
+            
+            // The DMA buffers must not share a cache line with other data. 
+        if ( (uintptr_t)memory & ( cache_line_words * sizeof(int32_t) - 1 ) )
+            return memory_size_error;
+            
+        _release_buffers();
+        _buffer_memory = memory;
+        _buffer_memory_size = memory ? size : 0;
+        
+            // Carve the buffers out from the new memory. 
+        return set_block_size( _block_size );
+    }
+    
+    unsigned int Framework::get_buffer_footprint(void) const
+    {
+        unsigned int float_words = _float_buffers ? 2 * _channels * _float_buffer_stride : 0;
+        
+        return ( 2 * _buffer_depth * _int_buffer_stride + float_words ) * sizeof(int32_t);
+    }
+    
+    unsigned int Framework::get_buffer_footprint( unsigned int block_size, unsigned int channels, unsigned int depth, 
+                                                  data_size_type data_size, bool float_buffers )
+    {
+        unsigned int int_buffer_stride = _int_buffer_words( block_size, channels, data_size );
+        unsigned int float_buffer_stride = ( block_size + cache_line_words - 1 ) / cache_line_words * cache_line_words;
+        unsigned int float_words = float_buffers ? 2 * channels * float_buffer_stride : 0;
+        
+        return ( 2 * depth * int_buffer_stride + float_words ) * sizeof(int32_t);
+    }
+    
+    int Framework::_int_buffer_words( unsigned int block_size, unsigned int channels, data_size_type data_size )
+    {
+            // Two Q15 samples per word. 
+        unsigned int words = ( data_size == data_size_16 ) ? ( channels * block_size + 1 ) / 2 : channels * block_size;
+        
+        return ( words + cache_line_words - 1 ) / cache_line_words * cache_line_words;
+    }
+    
+    void Framework::_release_buffers(void)
+    {
+        delete [] _heap_memory;
+        _heap_memory = NULL;
+        
+        for ( int i=0; i<max_buffer_depth; i++ )
+        {
+            _tx_int_buffer[i] = NULL;
+            _rx_int_buffer[i] = NULL;
+        }
+        for ( int ch=0; ch<max_channels; ch++ )
+        {
+            _tx_float_buffer[ch] = NULL;
+            _rx_float_buffer[ch] = NULL;
+        }
+    }
 
-            // clear blocks
-        for ( int i=0; i<_block_size*2; i++ )
+    void Framework::_assign_int_buffers( int32_t aligned_memory[] )
+    {
+            // tx[0], tx[1], ... then rx[0], rx[1], ...
+        for ( int i=0; i<_buffer_depth; i++ )
+        {
+            _tx_int_buffer[i] = aligned_memory + _int_buffer_stride * i;
+            _rx_int_buffer[i] = aligned_memory + _int_buffer_stride * ( _buffer_depth + i );
+        }
+        for ( int i=_buffer_depth; i<max_buffer_depth; i++ )
         {
+            _tx_int_buffer[i] = NULL;
+            _rx_int_buffer[i] = NULL;
+        }
+    }
+
+    error_type Framework::set_channel_count( unsigned int channels )
+    {
+        if ( channels < 2 || channels > max_channels )
+            return channel_error;
+            
+            // The derived class gives the buffers for its own channel count. 
+        if ( _fixed_buffers )
+            return ( channels == (unsigned int)_channels ) ? no_error : channel_error;
+            
+            // The I2S frame can't be changed while running. 
+        if ( _started && _transport != offline_transport )
+            return ( channels == (unsigned int)_channels ) ? no_error : channel_error;
+            
+        _channels = channels;
+        
+            // The length of the int buffers depends on the channel count. 
+        return set_block_size( _block_size );
+    }
+
+    error_type Framework::set_buffer_depth( unsigned int depth )
+    {
+        if ( depth < 2 || depth > max_buffer_depth )
+            return buffer_depth_error;
+            
+            // The derived class gives the buffers for its own depth. 
+        if ( _fixed_buffers )
+            return ( depth == (unsigned int)_buffer_depth ) ? no_error : buffer_depth_error;
+            
+            // The ring can't be changed while running. 
+        if ( _started && _transport != offline_transport )
+            return ( depth == (unsigned int)_buffer_depth ) ? no_error : buffer_depth_error;
+            
+        _buffer_depth = depth;
+        
+            // The number of the int buffers depends on the depth. 
+        return set_block_size( _block_size );
+    }
 
-            _tx_int_buffer[0][i] = 0;
-            _tx_int_buffer[1][i] = 0;
-            _rx_int_buffer[0][i] = 0;
-            _rx_int_buffer[1][i] = 0;
+    unsigned int Framework::get_latency(void) const
+    {
+            // The output is sent at the next frame. 
+        if ( _single_frame && _block_size == 1 )
+            return 0;
+            
+        unsigned int latency = _buffer_depth * _block_size;
+        
+            // The filter delay of the input side, and the output side in the codec rate. 
+        if ( _input_resampler )
+            latency += (unsigned int)( _input_resampler->get_delay() + 
+                                       _output_resampler->get_delay() * _resampling_down / _resampling_up + 0.5f );
+        
+        return latency;
+    }
+    
+    error_type Framework::set_resampling( unsigned int up, unsigned int down )
+    {
+            // The derived class processes its own buffers. 
+        if ( _fixed_buffers )
+            return block_size_error;
+        if ( up == 0 || down == 0 )
+            return block_size_error;
+            
+        _resampling_up = up;
+        _resampling_down = down;
+        
+        return no_error;
+    }
+    
+    error_type Framework::_setup_resampling(void)
+    {
+        _internal_block_size = _block_size;
+        
+        if ( _resampling_up == _resampling_down )
+        {
+            delete _input_resampler;
+            delete _output_resampler;
+            delete [] _internal_buffer_memory;
+            _input_resampler = NULL;
+            _output_resampler = NULL;
+            _internal_buffer_memory = NULL;
+            return no_error;
+        }
             
+            // Each block must give the same number of the internal samples. 
+        if ( ( _block_size * _resampling_up ) % _resampling_down != 0 )
+            return block_size_error;
+        _internal_block_size = _block_size * _resampling_up / _resampling_down;
+        
+        if ( _input_resampler == NULL )
+            _input_resampler = new ( std::nothrow ) Resampler();
+        if ( _output_resampler == NULL )
+            _output_resampler = new ( std::nothrow ) Resampler();
+        if ( _input_resampler == NULL || _output_resampler == NULL )
+            return memory_allocation_error;
+            
+        error_type error = _input_resampler->setup( _resampling_up, _resampling_down, _channels );
+        if ( error != no_error )
+            return error;
+        error = _output_resampler->setup( _resampling_down, _resampling_up, _channels );
+        if ( error != no_error )
+            return error;
+            
+            // tx ch0, ch1, ... then rx ch0, ch1, ... Same layout with the float buffers. 
+        int stride = ( _internal_block_size + cache_line_words - 1 ) / cache_line_words * cache_line_words;
+        
+        delete [] _internal_buffer_memory;
+        _internal_buffer_memory = new ( std::nothrow ) float[ stride * _channels * 2 ];
+        if ( _internal_buffer_memory == NULL )
+            return memory_allocation_error;
+            
+        for ( int i=0; i<stride * _channels * 2; i++ )
+            _internal_buffer_memory[i] = 0;
+        for ( int ch=0; ch<_channels; ch++ )
+        {
+            _tx_internal_buffer[ch] = _internal_buffer_memory + stride * ch;
+            _rx_internal_buffer[ch] = _internal_buffer_memory + stride * ( _channels + ch );
         }
+        
+        return no_error;
+    }
+    
+    void Framework::_resample_rx(void)
+    {
+        for ( int ch=0; ch<_channels; ch++ )
+            _input_resampler->process( ch, _rx_float_buffer[ch], _block_size, _rx_internal_buffer[ch] );
+    }
+    
+    void Framework::_resample_tx(void)
+    {
+        for ( int ch=0; ch<_channels; ch++ )
+            _output_resampler->process( ch, _tx_internal_buffer[ch], _internal_block_size, _tx_float_buffer[ch] );
+    }
+
+    void Framework::_attach_buffers( int32_t int_buffer_memory[], int int_buffer_stride, float float_buffer_memory[] )
+    {
+        _int_buffer_stride = int_buffer_stride;
+        _float_buffer_stride = _block_size;
+        _assign_int_buffers( int_buffer_memory );
+        _assign_float_buffers( float_buffer_memory );
+        
             // clear blocks
-        for ( int i=0; i<_block_size ; i++ )
+        for ( int i=0; i<_int_buffer_stride*_buffer_depth*2; i++ )
+            int_buffer_memory[i] = 0;
+        for ( int i=0; i<_float_buffer_stride*_channels*2; i++ )
+            float_buffer_memory[i] = 0;
+    }
+    
+    void Framework::_assign_float_buffers( float aligned_memory[] )
+    {
+            // No float buffers for the Q31 call back. 
+        int channels = aligned_memory ? _channels : 0;
+        
+            // tx ch0, ch1, ... then rx ch0, ch1, ...
+        for ( int ch=0; ch<channels; ch++ )
+        {
+            _tx_float_buffer[ch] = aligned_memory + _float_buffer_stride * ch;
+            _rx_float_buffer[ch] = aligned_memory + _float_buffer_stride * ( _channels + ch );
+        }
+        for ( int ch=channels; ch<max_channels; ch++ )
         {
+            _tx_float_buffer[ch] = NULL;
+            _rx_float_buffer[ch] = NULL;
+        }
+    }
+
+    void Framework::set_transport( transport_type transport )
+    {
+        _transport = transport;
+    }
+
+    void Framework::set_execution( execution_type execution )
+    {
+        _execution = execution;
+    }
+
+    void Framework::set_single_frame_path( bool enable )
+    {
+        _single_frame_enabled = enable;
+    }
+
+    error_type Framework::set_data_size( data_size_type data_size )
+    {
+            // The derived class gives the buffers for Q31. No wire in the offline mode. 
+        if ( _fixed_buffers || _transport == offline_transport )
+            return ( data_size == data_size_32 ) ? no_error : data_size_error;
+            
+            // The I2S frame can't be changed while running. 
+        if ( _started )
+            return ( data_size == _data_size ) ? no_error : data_size_error;
+            
+        _data_size = data_size;
+        
+            // The length of the int buffers depends on the data size. 
+        return set_block_size( _block_size );
+    }
 
-            _tx_left_buffer[i] = 0;
-            _tx_right_buffer[i] = 0;
-            _rx_left_buffer[i] = 0;
-            _rx_right_buffer[i] = 0;
+    void Framework::set_xrun_policy( xrun_policy_type policy )
+    {
+        _xrun_policy = policy;
+    }
+    
+    unsigned int Framework::get_xrun_count(void) const
+    {
+        return _xrun_count;
+    }
+    
+    unsigned int Framework::get_dropped_block_count(void) const
+    {
+        return _dropped_block_count;
+    }
+    
+    void Framework::set_parameter_callback( void (* cb ) ( unsigned int id, float value, void * data ) )
+    {
+        _parameter_callback = cb;
+    }
+    
+    void Framework::set_parameter_drain_limit( unsigned int limit )
+    {
+        if ( limit < 1 )
+            limit = 1;
+        if ( limit > parameter_queue_size )
+            limit = parameter_queue_size;
+        _parameter_drain_limit = limit;
+    }
+    
+    bool Framework::post_parameter( unsigned int id, float value, void * data )
+    {
+        parameter_message message;
+        
+        message.id = id;
+        message.value = value;
+        message.data = data;
+        return _parameter_queue.push( message );
+    }
+    
+    error_type Framework::set_tap( unsigned int tap, tap_point_type point, unsigned int channel, unsigned int length, unsigned int decimation )
+    {
+        if ( tap >= (unsigned int)max_taps || decimation == 0 || ( length & ( length - 1 ) ) )
+            return tap_error;
+        if ( channel >= (unsigned int)_channels )
+            return channel_error;
+            
+            // The process irq may be writing to the ring. It can't be reallocated. 
+        if ( _started )
+            return tap_error;
+        
+        tap_type & t = _taps[tap];
+        
+        if ( ! t.ring.allocate( length ) )
+            return memory_allocation_error;
+        t.point = point;
+        t.channel = channel;
+        t.decimation = decimation;
+        t.phase = 0;
+        t.overflow_count = 0;
+        
+            // The process irq scans the taps up to the last one in use. 
+        _tap_count = 0;
+        for ( int i=0; i<max_taps; i++ )
+            if ( _taps[i].ring.size() )
+                _tap_count = i + 1;
+        
+        return no_error;
+    }
+    
+    unsigned int Framework::read_tap( unsigned int tap, float buffer[], unsigned int length )
+    {
+        if ( tap >= (unsigned int)max_taps || _taps[tap].ring.size() == 0 )
+            return 0;
+        
+        return _taps[tap].ring.read( buffer, length );
+    }
+    
+    unsigned int Framework::get_tap_overflow_count( unsigned int tap ) const
+    {
+        if ( tap >= (unsigned int)max_taps )
+            return 0;
+        
+        return _taps[tap].overflow_count;
+    }
+
+    error_type Framework::start(
+                    void (* init_cb ) (unsigned int),
+                    void (* process_cb ) (float[], float[], float[], float[], unsigned int)
+                    )
+    {
+            // The port is out of range, or other framework took it. 
+        if ( _check_port() != no_error )
+            return port_error;
+            
+            // stereo call back
+        if ( _channels != 2 )
+            return channel_error;
+            
+            // The last configuration failed to get the buffers.
+        if ( _tx_int_buffer[0] == NULL )
+            return memory_allocation_error;
+            
+            // The call back runs at the internal rate. 
+        error_type error = _setup_resampling();
+        if ( error != no_error )
+            return error;
+            
+            // if needed, call the initializer. Called again when the block size is changed.
+        _init_callback = init_cb;
+        if ( init_cb )
+            init_cb( _internal_block_size );
+            
+            // register the signal processing callback
+        _process_callback = process_cb;
+        
+            // The I2S irq can call it directly, if there is nothing between. 
+        _single_frame = process_cb && _single_frame_enabled && _transport == fifo_transport && 
+                        _execution == irq_execution && ! _input_resampler;
+        
+        _start_transfer();
+        
+        return no_error;
+    }
 
+    error_type Framework::start(
+                    void (* init_cb ) (unsigned int),
+                    void (* process_cb ) (int32_t[], int32_t[], int32_t[], int32_t[], unsigned int)
+                    )
+    {
+            // The port is out of range, or other framework took it. 
+        if ( _check_port() != no_error )
+            return port_error;
+            
+            // stereo call back
+        if ( _channels != 2 )
+            return channel_error;
+            
+            // The last configuration failed to get the buffers.
+        if ( _tx_int_buffer[0] == NULL )
+            return memory_allocation_error;
+            
+            // The resampling works on the float buffers. 
+        if ( _resampling_up != _resampling_down )
+            return block_size_error;
+            
+            // The call back takes the int buffers as Q31. 
+        if ( _data_size != data_size_32 )
+            return data_size_error;
+            
+            // The call back works in the int buffers. Leave the float buffers out of the memory. 
+        if ( _float_buffers && ! _fixed_buffers )
+        {
+            _float_buffers = false;
+            error_type error = set_block_size( _block_size );
+            if ( error != no_error )
+                return error;
         }
-         
+        
+            // if needed, call the initializer. Called again when the block size is changed.
+        _init_callback = init_cb;
+        if ( init_cb )
+            init_cb( _block_size );
+            
+            // register the signal processing callback
+        _q31_process_callback = process_cb;
+        
+        _start_transfer();
+        
         return no_error;
     }
 
-    void Framework::start(
-                    void (* init_cb ) (unsigned int),
-                    void (* process_cb ) (float[], float[], float[], float[], unsigned int)
-                    )
+    error_type Framework::start(
+                    void (* init_cb ) (unsigned int),
+                    void (* process_cb ) (float *[], float *[], unsigned int, unsigned int)
+                    )
+    {
+            // The port is out of range, or other framework took it. 
+        if ( _check_port() != no_error )
+            return port_error;
+            
+            // The last configuration failed to get the buffers.
+        if ( _tx_int_buffer[0] == NULL )
+            return memory_allocation_error;
+            
+            // The call back runs at the internal rate. 
+        error_type error = _setup_resampling();
+        if ( error != no_error )
+            return error;
+            
+            // if needed, call the initializer. Called again when the block size is changed.
+        _init_callback = init_cb;
+        if ( init_cb )
+            init_cb( _internal_block_size );
+            
+            // register the signal processing callback
+        _multichannel_process_callback = process_cb;
+        
+        _start_transfer();
+        
+        return no_error;
+    }
+
+    error_type Framework::start(
+                    void (* init_cb ) (unsigned int),
+                    void (* process_cb ) (float[], float[], unsigned int, unsigned int)
+                    )
+    {
+            // The port is out of range, or other framework took it. 
+        if ( _check_port() != no_error )
+            return port_error;
+            
+            // The last configuration failed to get the buffers.
+        if ( _tx_int_buffer[0] == NULL )
+            return memory_allocation_error;
+            
+            // The resampling works on the channel buffers. 
+        if ( _resampling_up != _resampling_down )
+            return block_size_error;
+            
+            // if needed, call the initializer. Called again when the block size is changed.
+        _init_callback = init_cb;
+        if ( init_cb )
+            init_cb( _block_size );
+            
+            // register the signal processing callback
+        _interleaved_process_callback = process_cb;
+        
+        _start_transfer();
+        
+        return no_error;
+    }
+
+    error_type Framework::start(
+                    void (* init_cb ) (unsigned int),
+                    ProcessGraph * graph
+                    )
+    {
+            // The port is out of range, or other framework took it. 
+        if ( _check_port() != no_error )
+            return port_error;
+            
+            // The last configuration failed to get the buffers.
+        if ( _tx_int_buffer[0] == NULL )
+            return memory_allocation_error;
+            
+            // The nodes run at the codec rate. 
+        if ( _resampling_up != _resampling_down )
+            return block_size_error;
+            
+            // Decide the execution order and the intermediate buffers.
+        error_type error = graph->plan( _block_size, _channels, _rx_float_buffer, _tx_float_buffer );
+        if ( error != no_error )
+            return error;
+            
+            // if needed, call the initializer. Called again when the block size is changed.
+        _init_callback = init_cb;
+        if ( init_cb )
+            init_cb( _block_size );
+            
+            // register the signal processing graph
+        _graph = graph;
+        
+        _start_transfer();
+        
+        return no_error;
+    }
+
+    error_type Framework::start(
+                    void (* init_cb ) (unsigned int, void *),
+                    void (* process_cb ) (float[], float[], float[], float[], unsigned int, void *),
+                    void * context
+                    )
+    {
+            // The port is out of range, or other framework took it. 
+        if ( _check_port() != no_error )
+            return port_error;
+            
+            // The context is given to the init call back, too. 
+        _init_context_callback = init_cb;
+        _init_context = context;
+        
+            // Run as a callable object. 
+        _context_processor.callback = process_cb;
+        _context_processor.context = context;
+        return start( NULL, _context_processor );
+    }
+
+    error_type Framework::_start_processor( 
+                    void (* init_cb ) (unsigned int), 
+                    void (* block_processor )( Framework *, int32_t[], int32_t[] ), 
+                    void * context 
+                    )
+    {
+            // The port is out of range, or other framework took it. 
+        if ( _check_port() != no_error )
+            return port_error;
+            
+            // stereo call back
+        if ( _channels != 2 )
+            return channel_error;
+            
+            // The last configuration failed to get the buffers.
+        if ( _tx_int_buffer[0] == NULL )
+            return memory_allocation_error;
+            
+            // The call back runs at the internal rate. 
+        error_type error = _setup_resampling();
+        if ( error != no_error )
+            return error;
+            
+            // if needed, call the initializer. Called again when the block size is changed.
+        _init_callback = init_cb;
+        _call_init( _internal_block_size );
+            
+            // register the processing of a block, and the object
+        _processor_context = context;
+        _block_processor = block_processor;
+        
+        _start_transfer();
+        
+        return no_error;
+    }
+
+    void Framework::_start_transfer(void)
+    {
+        _started = true;
+        
+            // The derived class moves the data by itself.
+        if ( _transport == offline_transport )
+            return;
+            
+            // The process must be ready before the first block. 
+        _setup_process();
+        
+            // Initialize I2S peripheral
+        hal_i2s_setup( _port, _transport == dma_transport, _channels, _data_size == data_size_16 ? 16 : 32 );
+        
+            // In DMA mode, DMA starts from the buffer 0 and 1. The rest of ring is given in the DMA irq. 
+        if ( _transport == dma_transport )
+        {
+            _dma_buffer_index[0] = 0;
+            _dma_buffer_index[1] = 1;
+            hal_i2s_dma_setup( _port, _rx_int_buffer, _tx_int_buffer, _block_size * _channels );
+        }
+        
+            // synchronize with Word select signal, to process RX/TX as atomic timing.
+        hal_i2s_pin_config_and_wait_ws( _port );
+        hal_i2s_start( _port );
+    }
+
+    void Framework::_setup_process(void)
     {
-            // if needed, call the initializer
-        if ( init_cb )
-            init_cb( _block_size );
-            
-            // register the signal processing callback
-        _process_callback = process_cb;
+        static_assert( max_ports == 2, "Update the handler table" );
+        static void (* const process_irq_handlers[max_ports] )() = { _process_irq_handler< 0 >, _process_irq_handler< 1 > };
         
-            // synchronize with Word select signal, to process RX/TX as atomic timing.
-        hal_i2s_pin_config_and_wait_ws();
-        hal_i2s_start();
+        unsigned int port = _process_irq_port();
+        void (* handler )() = _shared_process_irq ? _shared_process_irq_handler : process_irq_handlers[_port];
+        
+            // In the thread mode, the killed peripheral is left alone. 
+        if ( _execution == thread_execution )
+            hal_process_thread_start( port, handler );
+        else
+            hal_irq_setup(hal_get_process_irq_id( port ), handler);
     }
 
     void Framework::set_i2s_irq_priority( unsigned int pri )
     {
-        NVIC_SetPriority(hal_get_process_irq_id(), pri);  // must be higher than PendSV of mbed-RTOS
+        if ( _port >= (unsigned int)max_ports )
+            return;
+            
+        hal_set_irq_priority(hal_get_i2s_irq_id( _port ), pri);      // must be higher than process IRQ
+        hal_set_irq_priority(hal_get_dma_irq_id( _port ), pri);      // DMA irq plays the role of I2S irq in DMA mode
     }
     
     void Framework::set_process_irq_priority( unsigned int pri )
     {
-        NVIC_SetPriority(hal_get_i2s_irq_id(), pri);      // must be higher than process IRQ
+        if ( _port >= (unsigned int)max_ports )
+            return;
+            
+        hal_set_irq_priority(hal_get_process_irq_id( _process_irq_port() ), pri);  // must be higher than PendSV of mbed-RTOS
     }
 
     void Framework::set_pre_interrupt_callback( void (* cb ) (void))
     { 
-        _pre_interrupt_callback = cb;
+        hook_type hook = { cb, NULL, NULL };
+        _pre_interrupt_hook = hook;
     }
     
     void Framework::set_post_interrupt_callback( void (* cb ) (void))
     { 
-        _post_interrupt_callback = cb;
+        hook_type hook = { cb, NULL, NULL };
+        _post_interrupt_hook = hook;
     }
     
     void Framework::set_pre_process_callback( void (* cb ) (void))
     { 
-        _pre_process_callback = cb;
+        hook_type hook = { cb, NULL, NULL };
+        _pre_process_hook = hook;
     }
     
     void Framework::set_post_process_callback( void (* cb ) (void))
     { 
-        _post_process_callback = cb;
+        hook_type hook = { cb, NULL, NULL };
+        _post_process_hook = hook;
+    }
+    
+    void Framework::set_pre_interrupt_callback( void (* cb ) (void *), void * context )
+    { 
+        hook_type hook = { NULL, cb, context };
+        _pre_interrupt_hook = hook;
+    }
+    
+    void Framework::set_post_interrupt_callback( void (* cb ) (void *), void * context )
+    { 
+        hook_type hook = { NULL, cb, context };
+        _post_interrupt_hook = hook;
+    }
+    
+    void Framework::set_pre_process_callback( void (* cb ) (void *), void * context )
+    { 
+        hook_type hook = { NULL, cb, context };
+        _pre_process_hook = hook;
+    }
+    
+    void Framework::set_post_process_callback( void (* cb ) (void *), void * context )
+    { 
+        hook_type hook = { NULL, cb, context };
+        _post_process_hook = hook;
+    }
+    
+    void Framework::_call_init( unsigned int block_size )
+    {
+        if ( _init_callback )
+            _init_callback( block_size );
+        else if ( _init_context_callback )
+            _init_context_callback( block_size, _init_context );
     }
 
     void Framework::_do_i2s_irq(void)
     {
+        bool profiling = _profiling;
+        unsigned int start_cycle = profiling ? hal_get_cycle_count() : 0;
+        
             // if needed, call pre-interrupt call back
-        if ( _pre_interrupt_callback )
-            _pre_interrupt_callback();
+        _call_hook( _pre_interrupt_hook );
             
+            // Block size 1. No buffer, no process irq. 
+        if ( _single_frame_ready() )
+        {
+            _process_single_frame();
+        }
             // irq is handled only when the buffer is correctly allocated    
-        if (_tx_left_buffer)
+        else if (_tx_int_buffer[0])
         {
             int sample;
             
-                // check how many data have to be transmimted per interrupt. 
-            for ( int i=0; i<hal_data_per_sample(); i++ )
+                // The FIFO gives a sample per entry in both data size. Only the buffer differs. 
+            if ( _data_size == data_size_16 )
             {
-                    // copy received data to buffer
-                hal_get_i2s_rx_data( sample );
-                _rx_int_buffer[_buffer_index][_sample_index] = sample;
+                int16_t * rx = (int16_t *)_rx_int_buffer[_buffer_index];
+                int16_t * tx = (int16_t *)_tx_int_buffer[_buffer_index];
                 
-                    // copy buffer data to transmit register
-                sample = _tx_int_buffer[_buffer_index][_sample_index];
-                hal_put_i2s_tx_data( sample );
-                
-                    // increment index
-                _sample_index ++;
+                for ( unsigned int i=0; i<hal_data_per_sample( _port ); i++ )
+                {
+                    hal_get_i2s_rx_data( _port, sample );
+                    rx[_sample_index] = (int16_t)sample;
+                    hal_put_i2s_tx_data( _port, tx[_sample_index] );
+                    _sample_index ++;
+                }
+            }
+            else
+            {
+                    // check how many data have to be transmimted per interrupt. 
+                for ( unsigned int i=0; i<hal_data_per_sample( _port ); i++ )
+                {
+                        // copy received data to buffer
+                    hal_get_i2s_rx_data( _port, sample );
+                    _rx_int_buffer[_buffer_index][_sample_index] = sample;
+                    
+                        // copy buffer data to transmit register
+                    sample = _tx_int_buffer[_buffer_index][_sample_index];
+                    hal_put_i2s_tx_data( _port, sample );
+                    
+                        // increment index
+                    _sample_index ++;
+                }
             }
             
-                // Implementation of the double buffer algorithm.
-                // if buffer transfer is complete, swap the buffer
-            if (_sample_index >= _block_size * 2)
+                // Implementation of the buffer ring algorithm.
+                // if buffer transfer is complete, go to the next buffer
+            if (_sample_index >= _block_size * _channels)
             {
                     // index for the signal processing
-                _process_index = _buffer_index;
+                int completed_index = _buffer_index;
 
-                    // swap buffer
-                if ( _buffer_index == 0 )
-                    _buffer_index = 1;
-                else
+                    // next buffer
+                _buffer_index ++;
+                if ( _buffer_index >= _buffer_depth )
                     _buffer_index = 0;
 
                     // rewind sample index
                 _sample_index = 0;
+                
+                _profile_boundary();
 
-                    // Trigger interrupt for signal processing
-                NVIC->STIR = hal_get_process_irq_id();       
+                    // Trigger interrupt for signal processing. 
+                    // While the block size is changing, the old blocks after the faded one are not processed. 
+                if ( ! _resize_at_boundary( completed_index ) )
+                    _dispatch_block( completed_index );
             }
         }
 
+        if ( profiling )
+            _profile_counters[profile_interrupt].add( hal_get_cycle_count() - start_cycle );
+            
+            // if needed, call post-interrupt call back
+        _call_hook( _post_interrupt_hook );
+            
+    }
+
+    void Framework::_process_single_frame(void)
+    {
+        int left, right;
+        
+        hal_get_i2s_rx_data( _port, left );
+        hal_get_i2s_rx_data( _port, right );
+        
+            // Same order with _process_block(). 
+        _call_hook( _pre_process_hook );
+        _apply_parameters();
+        
+        bool short_data = ( _data_size == data_size_16 );
+        float rx_left = short_data ? q15_to_float( (int16_t)left ) : q31_to_float( left );
+        float rx_right = short_data ? q15_to_float( (int16_t)right ) : q31_to_float( right );
+        float tx_left, tx_right;
+        
+        _process_callback( &rx_left, &rx_right, &tx_left, &tx_right, 1 );
+        
+            // The frame is a block of the ring. So, _fade_block() works on it. 
+        int32_t tx[2];
+        int16_t * tx16 = (int16_t *)tx;
+        if ( short_data )
+        {
+            tx16[0] = float_to_q15( tx_left );
+            tx16[1] = float_to_q15( tx_right );
+        }
+        else
+        {
+            tx[0] = float_to_q31( tx_left );
+            tx[1] = float_to_q31( tx_right );
+        }
+        
+            // Block size change. The ring buffers are not filled in this path. Fade out each frame here, 
+            // and swap the buffers at the last one. The new ring starts from the cleared buffers. 
+        bool faded = ( _resize_state == resize_requested ) && _fade_block( tx, false );
+        
+        hal_put_i2s_tx_data( _port, short_data ? tx16[0] : tx[0] );
+        hal_put_i2s_tx_data( _port, short_data ? tx16[1] : tx[1] );
+        
+        _call_hook( _post_process_hook );
+        
+        if ( faded )
+        {
+            _resize_state = resize_faded;
+            _swap_buffers();
+        }
+        
+            // Each frame is a block. 
+        _profile_boundary();
+    }
+
+    void Framework::_do_dma_irq(void)
+    {
+            // The last transfer before the I2S stops for the restart. Clear the flag, and drop the buffer. 
+        if ( _dma_restarting.load( std::memory_order_acquire ) )
+        {
+            hal_acknowledge_dma_irq( _port );
+            return;
+        }
+        
+        bool profiling = _profiling;
+        unsigned int start_cycle = profiling ? hal_get_cycle_count() : 0;
+        
+            // if needed, call pre-interrupt call back
+        _call_hook( _pre_interrupt_hook );
+            
+            // DMA has completed one buffer. Both RX and TX DMA are now working on the other buffer.
+            // So, the completed buffer is free for the signal processing. 
+        int dma_index = hal_acknowledge_dma_irq( _port );
+        int completed_index = _dma_buffer_index[dma_index];
+        
+            // The DMA comes to this address register after the current buffer. Load the next of the ring. 
+            // With the double buffer, it is same as the completed one.
+        int next_index = ( completed_index + 2 ) % _buffer_depth;
+        hal_i2s_dma_set_buffer( _port, dma_index, _rx_int_buffer[next_index], _tx_int_buffer[next_index] );
+        _dma_buffer_index[dma_index] = next_index;
+        _profile_boundary();
+        
+            // Trigger interrupt for signal processing. 
+            // While the block size is changing, the old blocks after the faded one are not processed. 
+        if ( ! _resize_at_boundary( completed_index ) )
+            _dispatch_block( completed_index );
+
+        if ( profiling )
+            _profile_counters[profile_interrupt].add( hal_get_cycle_count() - start_cycle );
+            
             // if needed, call post-interrupt call back
-        if ( _post_interrupt_callback )
-            _post_interrupt_callback();
+        _call_hook( _post_interrupt_hook );
+    }
+
+    void Framework::_dispatch_block( int index )
+    {
+            // Overrun check. 
+            // The I2S is now sending the tx buffer of the block given depth - 1 times ago.
+            // If that block is not processed yet, the process is late. 
+            // Acquire pairs with the release in the process irq. Its tx buffer writes are visible after this. 
+        unsigned int dispatched = _dispatched_blocks.load( std::memory_order_relaxed );
+        if ( dispatched - _processed_blocks.load( std::memory_order_acquire ) >= (unsigned int)( _buffer_depth - 1 ) )
+        {
+            _xrun_count ++;
             
+            if ( _xrun_policy != xrun_ignore )
+            {
+                    // Drop this block. Then, the late process doesn't get the next work, and can catch up.
+                _dropped_block_count ++;
+                
+                    // The tx buffer of the dropped block will be sent when the I2S comes back. 
+                if ( _xrun_policy == xrun_silence )
+                {
+                    for ( int i=0; i<_int_block_words(); i++ )
+                        _tx_int_buffer[index][i] = 0;
+                    if ( _transport == dma_transport )
+                        hal_i2s_dma_flush_tx( _tx_int_buffer[index], _int_block_words() );
+                }
+                else if ( _xrun_policy == xrun_repeat )
+                {
+                        // The late block is still being processed. Ask the process irq to copy it when done. 
+                    _repeat_index.store( index, std::memory_order_relaxed );
+                    _repeat_requests.store( _repeat_requests.load( std::memory_order_relaxed ) + 1, std::memory_order_release );
+                }
+                return;
+            }
+        }
+        
+            // Push to the queue. The entry must be written before the count. The release store publishes it. 
+        unsigned int slot = dispatched % max_buffer_depth;
+        _block_queue[ slot ].store( index, std::memory_order_relaxed );
+        _block_dispatch_profiled[ slot ] = _profiling;
+        if ( _profiling )
+            _block_dispatch_cycle[ slot ] = hal_get_cycle_count();
+        _dispatched_blocks.store( dispatched + 1, std::memory_order_release );
+        
+        _signal_process();
     }
 
     void Framework::_do_process_irq(void)
     {
+            // The DMA irq has stopped the I2S to change the block size. Restart it here. 
+        if ( _dma_restarting.load( std::memory_order_acquire ) )
+            _restart_dma();
+            
+            // Process all the queued blocks in order. 
+            // The I2S irq may push more blocks while processing.
+        unsigned int processed = _processed_blocks.load( std::memory_order_relaxed );
+        unsigned int dispatched;
+        while ( processed != ( dispatched = _dispatched_blocks.load( std::memory_order_acquire ) ) )
+        {
+                // Only in xrun_ignore, the I2S irq pushes blocks even when the queue is full.
+                // The oldest ones are already overwritten by I2S. Skip them. 
+            if ( dispatched - processed > (unsigned int)( _buffer_depth - 1 ) )
+            {
+                processed = dispatched - ( _buffer_depth - 1 );
+                _processed_blocks.store( processed, std::memory_order_release );
+            }
+                
+            unsigned int slot = processed % max_buffer_depth;
+            
+                // Scheduling latency of the IRQ or the thread, and the wait behind the earlier blocks. 
+            if ( _block_dispatch_profiled[ slot ] && _profiling )
+                _profile_counters[profile_latency].add( hal_get_cycle_count() - _block_dispatch_cycle[ slot ] );
+                
+            _process_block( _block_queue[ slot ].load( std::memory_order_relaxed ) );
+            
+                // Now, the I2S irq can reuse this buffer. The release store publishes the tx buffer writes. 
+            processed ++;
+            _processed_blocks.store( processed, std::memory_order_release );
+        }
+    }
+    
+    void Framework::_process_block( int index )
+    {
+        int resize_state = _resize_state;
+        
+            // The block size is changing, and the last old block is faded out. The output of this block 
+            // is not sent, or cut by the swap. Keep it silent. 
+        if ( resize_state == resize_faded )
+        {
+            for ( int i=0; i<_int_block_words(); i++ )
+                _tx_int_buffer[index][i] = 0;
+            if ( _transport == dma_transport )
+                hal_i2s_dma_flush_tx( _tx_int_buffer[index], _int_block_words() );
+            return;
+        }
+        
+            // The profiler is switched only at the block boundary. 
+        _profiling_block = _profiling;
+        if ( _profiling_block )
+            _profile_block_start = hal_get_cycle_count();
+            
             // If needed, call the pre-process hook
-        if ( _pre_process_callback )
-            _pre_process_callback();
+        _call_hook( _pre_process_hook );
+            
+            // First block of the new size. Initialize the signal processing for it. 
+        if ( resize_state == resize_swapped )
+        {
+            _call_init( _block_size );
+            _fade_in = true;
+            _resize_state = resize_fading_in;
+        }
+            
+            // Apply the parameters posted by main(). Bounded number per block.
+        _apply_parameters();
+        
+            // The conversion is measured from here. 
+        if ( _profiling_block )
+            _profile_last_mark = hal_get_cycle_count();
             
             // Only when the process_call back is registered.
-        if ( _process_callback )
+        if ( _block_processor )
+        {
+            _block_processor( this, _rx_int_buffer[index], _tx_int_buffer[index] );
+        }
+        else if ( _process_callback )
+        {
+            _process_float_block( _rx_int_buffer[index], _tx_int_buffer[index] );
+        }
+        else if ( _multichannel_process_callback )
+        {
+            _process_multichannel_block( _rx_int_buffer[index], _tx_int_buffer[index] );
+        }
+        else if ( _interleaved_process_callback )
+        {
+            _process_interleaved_block( _rx_int_buffer[index], _tx_int_buffer[index] );
+        }
+        else if ( _graph )
+        {
+                // Same with the multi-channel call back. The nodes work on the float buffers. 
+            _convert_rx_block( _rx_int_buffer[index] );
+            _feed_taps( tap_rx );
+            _profile_mark( profile_rx_conversion );
+            _graph->run();
+            _profile_mark( profile_callback );
+            _feed_taps( tap_tx );
+            _convert_tx_block( _tx_int_buffer[index] );
+            _profile_mark( profile_tx_conversion );
+        }
+        else if ( _q31_process_callback )
+        {
+            int32_t * rx = _rx_int_buffer[index];
+            int32_t * tx = _tx_int_buffer[index];
+            
+                // Both buffers of the process index are free until I2S comes back. So, use them as the work area.
+                // -- premuted from LRLRLR... in rx buffer to LLL.., RRR... in tx buffer 
+                // -- callback reads from tx buffer, and writes to rx buffer
+                // -- premuted from LLL.., RRR... in rx buffer to LRLRLR... in tx buffer
+            deinterleave_q31( rx, tx, tx + _block_size, _block_size );
+            _profile_mark( profile_rx_conversion );
+            
+            _q31_process_callback
+                    (
+                        tx,
+                        tx + _block_size,
+                        rx,
+                        rx + _block_size,
+                        _block_size
+                    );
+            _profile_mark( profile_callback );
+                    
+            interleave_q31( rx, rx + _block_size, tx, _block_size );
+            _profile_mark( profile_tx_conversion );
+            
+                // The rx buffer was the work area. Its dirty lines must not be written back over the next DMA data. 
+            if ( _transport == dma_transport )
+                hal_i2s_dma_discard_rx( rx, _int_block_words() );
+        }
+    
+            // Block size change. Fade out the last block of the old size, and fade in the first block of the new size. 
+        if ( resize_state == resize_requested )
+        {
+            if ( _fade_block( _tx_int_buffer[index], false ) )
+            {
+                _fade_index = index;
+                _resize_state = resize_faded;
+            }
+        }
+        else if ( _fade_in )
+        {
+                // Now, main() can request the next change. 
+            if ( _fade_block( _tx_int_buffer[index], true ) )
+            {
+                _fade_in = false;
+                _resize_state = resize_idle;
+            }
+        }
+    
+            // In DMA mode, the data have to be visible to DMA before it comes back to this buffer. 
+        if ( _transport == dma_transport )
+            hal_i2s_dma_flush_tx( _tx_int_buffer[index], _int_block_words() );
+            
+            // This block was late, and the next block was dropped. Repeat this block in the slot of the dropped one.
+        unsigned int repeat_requests = _repeat_requests.load( std::memory_order_acquire );
+        if ( repeat_requests != _repeat_done.load( std::memory_order_relaxed ) )
         {
-            int j = 0;
+            int repeat_index = _repeat_index.load( std::memory_order_relaxed );
+            
+            for ( int i=0; i<_int_block_words(); i++ )
+                _tx_int_buffer[repeat_index][i] = _tx_int_buffer[index][i];
+            if ( _transport == dma_transport )
+                hal_i2s_dma_flush_tx( _tx_int_buffer[repeat_index], _int_block_words() );
                 
-                // Format conversion.
-                // -- premuted from LRLRLR... to LLL.., RRR...
-                // -- convert from fixed point to floating point
-                // -- scale down as range of [-1, 1)
-            for ( int i=0; i<_block_size; i++ )
+            _repeat_done.store( repeat_requests, std::memory_order_release );
+        }
+        
+        if ( _profiling_block )
+            _profile_counters[profile_process].add( hal_get_cycle_count() - _profile_block_start );
+        
+            // if needed, call post-process callback
+        _call_hook( _post_process_hook );
+    }
+    
+    void Framework::_apply_parameters(void)
+    {
+        parameter_message message;
+        
+            // Leave the rest for the next block. The processing must not wait for main().
+        for ( unsigned int i=0; i<_parameter_drain_limit; i++ )
+        {
+            if ( ! _parameter_queue.pop( message ) )
+                break;
+            if ( _parameter_callback )
+                _parameter_callback( message.id, message.value, message.data );
+        }
+    }
+    
+    void Framework::_feed_taps( tap_point_type point )
+    {
+        for ( int i=0; i<_tap_count; i++ )
+        {
+            tap_type & t = _taps[i];
+            
+            if ( t.point != point || t.ring.size() == 0 )
+                continue;
+            
+            const float * source = ( point == tap_rx ? _rx_float_buffer : _tx_float_buffer )[t.channel];
+            unsigned int length = _block_size;
+            unsigned int step = 1;
+            
+                // The interleaved call back has the frames in the buffer of the channel 0. 
+            if ( _interleaved_process_callback )
             {
-                _rx_left_buffer[i]  = _rx_int_buffer[_process_index][j++]/ -(float)INT_MIN;
-                _rx_right_buffer[i] = _rx_int_buffer[_process_index][j++]/ -(float)INT_MIN;
+                source = ( point == tap_rx ? _rx_float_buffer : _tx_float_buffer )[0] + t.channel;
+                step = _channels;
             }
+            
+                // Take every decimation-th sample, continuing the phase of the previous block. 
+            if ( t.decimation > 1 )
+            {
+                unsigned int phase = t.phase;
                 
+                length = ( (unsigned int)_block_size > phase ) ? ( _block_size - phase + t.decimation - 1 ) / t.decimation : 0;
+                t.phase = phase + length * t.decimation - _block_size;
+                source += phase * step;
+            }
+            
+                // The whole block, or nothing. The reader sees no gap inside a block. 
+            if ( length && ! t.ring.write( source, length, t.decimation * step ) )
+                t.overflow_count = t.overflow_count + length;
+        }
+    }
+    
+    void Framework::_process_float_block( int32_t rx[], int32_t tx[] )
+    {
+            // Format conversion.
+            // -- premuted from LRLRLR... to LLL.., RRR...
+            // -- convert from fixed point to floating point
+            // -- scale down as range of [-1, 1)
+        _convert_rx_block( rx );
+        _feed_taps( tap_rx );
+        
+        if ( _input_resampler )
+        {
+                // The call back works at the internal rate. The taps stay at the codec rate. 
+            _resample_rx();
+            _profile_mark( profile_rx_conversion );
             _process_callback
                     (
-                        _rx_left_buffer,
-                        _rx_right_buffer,
-                        _tx_left_buffer,
-                        _tx_right_buffer,
+                        _rx_internal_buffer[0],
+                        _rx_internal_buffer[1],
+                        _tx_internal_buffer[0],
+                        _tx_internal_buffer[1],
+                        _internal_block_size
+                    );
+            _profile_mark( profile_callback );
+            _resample_tx();
+        }
+        else
+        {
+            _profile_mark( profile_rx_conversion );
+            _process_callback
+                    (
+                        _rx_float_buffer[0],
+                        _rx_float_buffer[1],
+                        _tx_float_buffer[0],
+                        _tx_float_buffer[1],
                         _block_size
                     );
-                
-                // Format conversion.
-                // -- premuted from LLL.., RRR... to LRLRLR...
-                // -- convert from floating point to fixed point
-                // -- scale up from range of [-1, 1)
-            j = 0;
-            for ( int i=0; i<_block_size; i++ )
-            {
-                _tx_int_buffer[_process_index][j++] = _tx_left_buffer[i]  * -(float)INT_MIN ;
-                _tx_int_buffer[_process_index][j++] = _tx_right_buffer[i] * -(float)INT_MIN ;
-            }
+            _profile_mark( profile_callback );
+        }
+        _feed_taps( tap_tx );
+            
+            // Format conversion.
+            // -- premuted from LLL.., RRR... to LRLRLR...
+            // -- convert from floating point to fixed point
+            // -- scale up from range of [-1, 1), with saturation
+        _convert_tx_block( tx );
+        _profile_mark( profile_tx_conversion );
+    }
     
+    void Framework::_begin_float_block( int32_t rx[], float ** & rx_buffer, float ** & tx_buffer, unsigned int & length )
+    {
+            // Same with _process_float_block() until the call back. 
+        _convert_rx_block( rx );
+        _feed_taps( tap_rx );
+        
+        if ( _input_resampler )
+        {
+            _resample_rx();
+            rx_buffer = _rx_internal_buffer;
+            tx_buffer = _tx_internal_buffer;
+            length = _internal_block_size;
         }
-
-            // if needed, call post-process callback
-        if ( _post_process_callback )
-            _post_process_callback();
+        else
+        {
+            rx_buffer = _rx_float_buffer;
+            tx_buffer = _tx_float_buffer;
+            length = _block_size;
+        }
+        _profile_mark( profile_rx_conversion );
+    }
+    
+    void Framework::_end_float_block( int32_t tx[] )
+    {
+        _profile_mark( profile_callback );
+        
+            // Same with _process_float_block() after the call back. 
+        if ( _input_resampler )
+            _resample_tx();
+        _feed_taps( tap_tx );
+        
+        _convert_tx_block( tx );
+        _profile_mark( profile_tx_conversion );
+    }
+    
+    void Framework::_process_multichannel_block( int32_t rx[], int32_t tx[] )
+    {
+            // Format conversion. Frame major to channel major. 
+        _convert_rx_block( rx );
+        _feed_taps( tap_rx );
+        
+        if ( _input_resampler )
+        {
+            _resample_rx();
+            _profile_mark( profile_rx_conversion );
+            _multichannel_process_callback( _rx_internal_buffer, _tx_internal_buffer, _channels, _internal_block_size );
+            _profile_mark( profile_callback );
+            _resample_tx();
+        }
+        else
+        {
+            _profile_mark( profile_rx_conversion );
+            _multichannel_process_callback( _rx_float_buffer, _tx_float_buffer, _channels, _block_size );
+            _profile_mark( profile_callback );
+        }
+        _feed_taps( tap_tx );
+        
+            // Format conversion. Channel major to frame major. 
+        _convert_tx_block( tx );
+        _profile_mark( profile_tx_conversion );
     }
     
-    void Framework::_process_irq_handler()
+    void Framework::_convert_rx_block( const int32_t rx[] )
     {
-        Framework::_fw->_do_process_irq();
+            // The stereo goes to the vectorized kernel inside. 
+        if ( _data_size == data_size_16 )
+            deinterleave_to_float( (const int16_t *)rx, _rx_float_buffer, _channels, _block_size );
+        else
+            deinterleave_to_float( rx, _rx_float_buffer, _channels, _block_size );
     }
     
-    void Framework::_i2s_irq_handler()
+    void Framework::_convert_tx_block( int32_t tx[] )
     {
-        Framework::_fw->_do_i2s_irq();
+        if ( _data_size == data_size_16 )
+            interleave_to_int( _tx_float_buffer, (int16_t *)tx, _channels, _block_size );
+        else
+            interleave_to_int( _tx_float_buffer, tx, _channels, _block_size );
+    }
+    
+    void Framework::_process_interleaved_block( int32_t rx[], int32_t tx[] )
+    {
+        float * in = _rx_float_buffer[0];
+        float * out = _tx_float_buffer[0];
+        unsigned int words = _block_size * _channels;
+        
+            // Same order. No shuffle. 
+        if ( _data_size == data_size_16 )
+            convert_to_float( (const int16_t *)rx, in, words );
+        else
+            convert_to_float( rx, in, words );
+        _feed_taps( tap_rx );
+        _profile_mark( profile_rx_conversion );
+        
+        _interleaved_process_callback( in, out, _block_size, _channels );
+        _profile_mark( profile_callback );
+        
+        _feed_taps( tap_tx );
+        if ( _data_size == data_size_16 )
+            convert_to_int( out, (int16_t *)tx, words );
+        else
+            convert_to_int( out, tx, words );
+        _profile_mark( profile_tx_conversion );
+    }
+    
+    void Framework::set_profiling( bool enable )
+    {
+        if ( enable )
+        {
+            hal_cycle_counter_setup();
+            reset_profile();
+        }
+        _profiling = enable;
+    }
+    
+    void Framework::reset_profile(void)
+    {
+        for ( int i=0; i<number_of_profile_stages; i++ )
+            _profile_counters[i].reset_requests ++;
+    }
+    
+    void Framework::get_profile( profile_stage_type stage, profile_statistics & statistics ) const
+    {
+        unsigned long long total;
+        
+        _profile_counters[stage].read( statistics, total );
+    }
+    
+    float Framework::get_cpu_load(void) const
+    {
+        profile_statistics statistics;
+        unsigned long long interrupt, process, period;
+        
+        _profile_counters[profile_interrupt].read( statistics, interrupt );
+        _profile_counters[profile_process].read( statistics, process );
+        _profile_counters[profile_period].read( statistics, period );
+        
+        if ( period == 0 )
+            return 0;
+        return 100.0f * (float)( interrupt + process ) / (float)period;
+    }
+    
+    unsigned int Framework::get_cycle_frequency(void)
+    {
+        return hal_get_cycle_frequency();
+    }
+    
+    void Framework::_record_profile( profile_stage_type stage )
+    {
+        unsigned int now = hal_get_cycle_count();
+        
+        _profile_counters[stage].add( now - _profile_last_mark );
+        _profile_last_mark = now;
+    }
+    
+    void Framework::_profile_boundary(void)
+    {
+            // The interval is valid only when both ends are measured. 
+        if ( ! _profiling )
+        {
+            _profile_has_boundary = false;
+            return;
+        }
+        
+        unsigned int now = hal_get_cycle_count();
+        
+        if ( _profile_has_boundary )
+            _profile_counters[profile_period].add( now - _profile_last_boundary );
+        _profile_last_boundary = now;
+        _profile_has_boundary = true;
+    }
+    
+    void Framework::profile_counter_type::add( unsigned int cycles )
+    {
+        unsigned int s = sequence.load( std::memory_order_relaxed );
+        
+            // Odd sequence tells main() that the data is being written. 
+        sequence.store( s + 1, std::memory_order_relaxed );
+        std::atomic_thread_fence( std::memory_order_release );
+        
+            // Clear requested by main(). 
+        unsigned int requests = reset_requests.load( std::memory_order_relaxed );
+        if ( reset_done != requests )
+        {
+            count = 0;
+            sum = 0;
+            for ( int b=0; b<profile_histogram_bins; b++ )
+                histogram[b] = 0;
+            reset_done = requests;
+        }
+        
+        if ( count == 0 || cycles < min )
+            min = cycles;
+        if ( count == 0 || cycles > max )
+            max = cycles;
+        count ++;
+        sum += cycles;
+        
+            // Bin of log2( cycles ). 
+#if defined(__GNUC__)
+        int bin = 31 - __builtin_clz( cycles | 1 );
+#else
+        int bin = 0;
+        for ( unsigned int c = cycles >> 1; c; c >>= 1 )
+            bin ++;
+#endif
+        histogram[bin] ++;
+        
+        sequence.store( s + 2, std::memory_order_release );
+    }
+    
+    void Framework::profile_counter_type::read( profile_statistics & statistics, unsigned long long & total ) const
+    {
+        unsigned int before, after;
+        
+            // Copy again, if the interrupt wrote while copying. 
+        do
+        {
+            before = sequence.load( std::memory_order_acquire );
+            
+            statistics.count = count;
+            statistics.min = min;
+            statistics.max = max;
+            total = sum;
+            for ( int b=0; b<profile_histogram_bins; b++ )
+                statistics.histogram[b] = histogram[b];
+            
+            std::atomic_thread_fence( std::memory_order_acquire );
+            after = sequence.load( std::memory_order_relaxed );
+        } while ( ( before & 1 ) || before != after );
+        
+            // The clear is requested, but not done yet. 
+        if ( reset_done != reset_requests.load( std::memory_order_acquire ) )
+        {
+            statistics.count = 0;
+            statistics.min = 0;
+            statistics.max = 0;
+            total = 0;
+            for ( int b=0; b<profile_histogram_bins; b++ )
+                statistics.histogram[b] = 0;
+        }
+        
+        statistics.mean = statistics.count ? (unsigned int)( total / statistics.count ) : 0;
+    }
+    
+        // Process the queued blocks of all ports, in one irq. 
+        // The port without the queued block returns immediately. 
+    void Framework::_shared_process_irq_handler()
+    {
+        for ( int port=0; port<max_ports; port++ )
+        {
+            Framework * fw = Framework::_instances[port];
+            
+            if ( fw )
+                fw->_do_process_irq();
+        }
     }
      
      
-    Framework * Framework::_fw; 
+    Framework * Framework::_instances[max_ports]; 
+    bool Framework::_shared_process_irq = false;
  
 }
-    
\ No newline at end of file
+    
\ No newline at end of file
@@ -7,18 +7,171 @@
 #ifndef _unzen_h_
 #define _unzen_h_
 
+#ifdef UNZEN_HOST
+#include <stddef.h>
+#include <stdint.h>
+#else
 #include "mbed.h"
+#endif
+#include <atomic>
+#include "unzen_spsc.h"
 /**
  \brief audio framework name space. 
 */
 namespace unzen 
 {
+    class ProcessGraph;
+    class Resampler;
+    
+    /**
+      \brief maximum number of the channels. 
+      \details
+      The SAI frame is up to 256 bit. Then, 8 slots of 32bit data. 
+    */
+    const int max_channels = 8;
+    
+    /**
+      \brief maximum depth of the buffer ring. 
+      \details
+      See \ref Framework::set_buffer_depth().
+    */
+    const int max_buffer_depth = 8;
+    
+    /**
+      \brief number of the I2S ports. 
+      \details
+      Each port is an independent I2S peripheral, with its own codec. On STM32F746, port 0 is SAI1 and 
+      port 1 is SAI2. See \ref Framework::Framework().
+    */
+    const int max_ports = 2;
+    
     /**
       \brief error status type.
     */
     enum error_type {
         no_error,                   ///< No error.
-        memory_allocation_error     ///< Fatal. Memory is exhausted.
+        memory_allocation_error,    ///< Fatal. Memory is exhausted.
+        memory_size_error,          ///< The buffer memory given by the application is too small, or not aligned. 
+        block_size_error,           ///< The block size of this framework can't be changed. 
+        channel_error,              ///< The channel count is out of range, or doesn't match with the call back. 
+        buffer_depth_error,         ///< The buffer depth is out of range, or can't be changed. 
+        file_error,                 ///< The file can't be opened, read or written. Offline mode only. 
+        file_format_error,          ///< The file is not supported format. Offline mode only. 
+        graph_error,                ///< The processing graph has a loop, or an unconnected input. 
+        tap_error,                  ///< The tap parameter is out of range, or the tap can't be changed while running. 
+        busy_error,                 ///< The last request is not completed yet. 
+        port_error,                 ///< The I2S port is out of range, or taken by other framework. 
+        data_size_error             ///< The data size doesn't match with the call back, or can't be changed. 
+        };
+    
+    /**
+      \brief transport method between I2S peripheral and the framework buffer.
+    */
+    enum transport_type {
+        fifo_transport,             ///< CPU moves each sample in the I2S FIFO interrupt. Default.
+        dma_transport,              ///< DMA moves samples. Interrupt happens once per block.
+        offline_transport           ///< No I2S. The derived class moves samples. See \ref OfflineFramework.
+        };
+    
+    /**
+      \brief context which runs the signal processing of the completed blocks.
+    */
+    enum execution_type {
+        irq_execution,              ///< Process IRQ. A killed peripheral interrupt, triggered by software. Default.
+        thread_execution            ///< Highest priority RTOS thread, signaled by the I2S interrupt. std::thread on host.
+        };
+    
+    /**
+      \brief size of a sample on the I2S wire, and in the interrupt buffers.
+    */
+    enum data_size_type {
+        data_size_32,               ///< 32bit slot. Q31 in the buffers. Default.
+        data_size_16                ///< 16bit slot. Q15 in the buffers, two samples per word. 
+        };
+    
+    /**
+      \brief action of the framework when the signal processing doesn't finish in time. 
+      \details
+      The overrun ( xrun ) happens when the process call back of a block doesn't finish before the I2S 
+      comes back to its buffer. With the double buffer, that is the end of the next block. At that moment, 
+      the I2S is already sending the output of the late block. See \ref Framework::set_buffer_depth().
+      In all policies, the overrun is counted. See \ref Framework::get_xrun_count().
+    */
+    enum xrun_policy_type {
+        xrun_ignore,                ///< Give the new block to the process anyway. Compatible with older version. Default.
+        xrun_drop,                  ///< Drop the new block to resync. Its output slot is not updated. Lightest.
+        xrun_silence,               ///< Drop the new block, and output silence in its output slot.
+        xrun_repeat                 ///< Drop the new block, and repeat the late block in its output slot. 
+        };
+    
+    /**
+      \brief capacity of the parameter queue [message]. 
+      \details
+      See \ref Framework::post_parameter().
+    */
+    const unsigned int parameter_queue_size = 32;
+    
+    /**
+      \brief maximum number of the audio taps. 
+      \details
+      See \ref Framework::set_tap().
+    */
+    const int max_taps = 4;
+    
+    /**
+      \brief point of the signal where a tap copies from. 
+    */
+    enum tap_point_type {
+        tap_rx,                     ///< Received data. Input of the process call back. 
+        tap_tx                      ///< Transmission data. Output of the process call back. 
+        };
+    
+    /**
+      \brief stage of the signal processing measured by the profiler. 
+      \details
+      See \ref Framework::set_profiling().
+    */
+    enum profile_stage_type {
+        profile_interrupt,          ///< I2S or DMA interrupt. Once per frame in \ref fifo_transport, once per block in \ref dma_transport.
+        profile_rx_conversion,      ///< Conversion of the received block to the call back format. Includes the rx taps and the resampling.
+        profile_callback,           ///< Process call back, or the processing graph. 
+        profile_tx_conversion,      ///< Conversion of the transmission block from the call back format. Includes the tx taps and the resampling.
+        profile_process,            ///< Whole block in the process IRQ. Includes the parameter messages, the hooks and the fade.
+        profile_period,             ///< Interval between the completed blocks. That is, the block period. 
+        profile_latency,            ///< Delay from the completion of a block to the start of its process. The scheduling jitter. 
+        number_of_profile_stages
+        };
+    
+    /**
+      \brief number of the bins of the profile histogram. 
+      \details
+      The bin n counts the durations of 2^n cycles or more, and less than 2^(n+1) cycles. The bin 0 includes 0. 
+    */
+    const int profile_histogram_bins = 32;
+    
+    /**
+      \brief statistics of a profiled stage. 
+      \details
+      The durations are in the cycles of the cycle counter. See \ref Framework::get_cycle_frequency().
+    */
+    struct profile_statistics {
+        unsigned int count;         ///< Number of measurements. 
+        unsigned int min;           ///< Shortest duration. 
+        unsigned int max;           ///< Longest duration. 
+        unsigned int mean;          ///< Average duration. 
+        unsigned int histogram[profile_histogram_bins];  ///< Number of measurements in each bin. 
+        };
+    
+    /**
+      \brief message to update a parameter of the signal processing. 
+      \details
+      Posted by main(), and delivered to the parameter call back in the process context. 
+      See \ref Framework::post_parameter().
+    */
+    struct parameter_message {
+        unsigned int id;            ///< Parameter ID. Defined by the application. 
+        float value;                ///< New value of the parameter. 
+        void * data;                ///< Optional pointer. For example, a coefficient set prepared by main(). 
         };
     
     /**
@@ -75,7 +228,7 @@ int main()
 //    shimabara::UMB_ADAU1361A codec(shimabara::Fs_48, &i2c, CODEC_I2C_ADDR );
 //    shimabara::UMB_ADAU1361A codec(shimabara::Fs_96, &i2c, CODEC_I2C_ADDR );
 
-       // create an audio framework by singlton pattern
+       // create an audio framework on the I2S port 0
     unzen::Framework audio;
  
          // Set I3C clock to 100kHz
@@ -116,6 +269,7 @@ int main()
     public:
             /**
                 \constructor
+                \param port I2S port to use. 0 .. \ref max_ports - 1.
                 \details
                 initialize the internal variables and set up all interrrupt / I2S related peripheral. 
                 If needed, power up the peripheral, assign the clock and pins. 
@@ -125,23 +279,432 @@ int main()
                 Note that this constructor set the block size ( interval count which audio processing
                 call back is called )
                 as 1. If it is needed to use other value, call \ref set_brock_size() method. 
+                
+                Each port can have one framework. Then, two codecs run in parallel, with their own block size, 
+                channels, transport and call backs. The frameworks are independent. If the port is out of range, 
+                or a newer framework takes the same port, \ref start() returns \ref port_error.
+                \code
+unzen::Framework audio_a( 0 );     // SAI1
+unzen::Framework audio_b( 1 );     // SAI2
+                \endcode
+            */
+        explicit Framework( unsigned int port = 0 );
+        
+            /**
+                \destructor
+                \details
+                Release the buffers. The I2S and the interrupts are not stopped. So, don't destroy the 
+                running framework. 
             */
-        Framework(void);
+        virtual ~Framework(void);
         
             /**
                 \brief set the interval interrupt count for each time call back is called. 
                 \param block_size An integer parameter > 1. If set to n, for each n interrupts, the audio call back is called. 
                 \returns show the error status
                 \details
-                This method re-allocate the internal buffer. Then, the memory allocation error could occur. To detect the 
-                memory allocation error, use \ref get_error() method.
+                This method re-allocate the internal buffer. Then, the memory allocation error could occur. 
+                If the memory is given by \ref set_buffer_memory(), and it is too small, \ref memory_size_error 
+                is returned.
+                
+                This method can be called while the audio is running. Then, the new buffers are prepared here, 
+                and the framework switches to them at a block boundary, without stopping the call back : 
+                \li The output of the old size is faded out, over one block or 64 samples, whichever is longer. 
+                \li The buffers are swapped after that block is sent. The output is silent for depth blocks of the new size. 
+                \li The init_cb given to \ref start() is called again with the new size, in the process context. 
+                \li The output of the new size is faded in the same way. 
+                
+                The method returns soon. The change is completed when \ref get_block_size() returns the new size. 
+                While the last change is in progress including the fade in, or with the processing graph, 
+                \ref block_size_error is returned. 
+                
+                If the memory is given by \ref set_buffer_memory(), both old and new buffers must fit in it. 
             */
         error_type set_block_size(  unsigned int new_block_size );
         
+            /**
+                \brief block size in use. 
+                \returns block size [sample]. 
+                \details
+                After \ref set_block_size() while running, the old size is returned until the buffers are swapped. 
+            */
+        unsigned int get_block_size(void) const;
+
+            /**
+                \brief select the transport method between I2S and the internal buffer.
+                \param transport \ref fifo_transport or \ref dma_transport
+                \details
+                By default, the framework uses \ref fifo_transport. In this mode, the I2S interrupt happens 
+                for each stereo sample, and CPU moves the data. 
+                
+                In the \ref dma_transport mode, the DMA moves the data between I2S and the internal 
+                double buffer directly. The interrupt happens only when the DMA completes one block. Then, 
+                the interrupt load doesn't depend on the sampling frequency. 
+                
+                The pre/post interrupt callbacks are called at the DMA interrupt in this mode. 
+                
+                This method have to be called before \ref start().
+            */
+        void set_transport( transport_type transport );
+        
+            /**
+                \brief select the context of the signal processing.
+                \param execution \ref irq_execution or \ref thread_execution
+                \details
+                By default, the framework uses \ref irq_execution. The I2S interrupt triggers the process IRQ 
+                by software, and the call back runs in the interrupt context. The process IRQ is a killed 
+                interrupt of other peripheral. 
+                
+                In the \ref thread_execution mode, the I2S interrupt signals a thread at the highest priority 
+                of mbed-RTOS, and the call back runs in that thread. The call back can use the blocking RTOS API 
+                and the mbed API for the thread. The process IRQ is not touched, and its peripheral can be used. 
+                The thread is delayed by all interrupts and the RTOS kernel. Compare the scheduling jitter of 
+                both modes with \ref profile_latency. See \ref set_profiling().
+                
+                With \ref set_shared_process_irq(), all frameworks must use the same mode. 
+                
+                The thread needs mbed-RTOS. Without it ( classic mbed, or the bare metal profile of mbed OS ), 
+                \ref thread_execution works same with \ref irq_execution. 
+                
+                This method have to be called before \ref start().
+            */
+        void set_execution( execution_type execution );
+        
+            /**
+                \brief enable the fast path for the block size 1. 
+                \param enable true to use the fast path. 
+                \details
+                By default, the fast path is enabled. It is taken when the block size is 1, the call back is 
+                the float stereo one without the context, and the framework runs with \ref fifo_transport, 
+                \ref irq_execution and no resampling. 
+                
+                In the fast path, the I2S interrupt converts the frame and calls the call back by itself. The 
+                process IRQ, the buffer ring and the float buffers are not used. The output is sent at the next 
+                frame, so \ref get_latency() is 0. The call back runs at the priority of the I2S interrupt. 
+                
+                The normal path is used while the taps are set, and while the block size is changing. 
+                
+                This method have to be called before \ref start().
+            */
+        void set_single_frame_path( bool enable );
+        
+            /**
+                \brief select the size of a sample on the I2S wire. 
+                \param data_size \ref data_size_32 or \ref data_size_16
+                \returns show the error status
+                \details
+                By default, the framework uses \ref data_size_32. Each slot is 32bit, and the interrupt buffers 
+                hold a Q31 word per sample. 
+                
+                With \ref data_size_16, each slot is 16bit. The codec must send the 16bit slots, that is 32fs 
+                bit clock in I2S. The interrupt buffers hold Q15 samples, two per word. Then, the int buffers 
+                take the half memory, and DMA moves the half data. The SAI FIFO still takes a sample per entry. 
+                In the DMA transport, the DMA packs two samples into a word. The float call backs see the same 
+                [-1, 1) range. 
+                
+                The Q31 call back can't be used with \ref data_size_16. It returns \ref data_size_error. 
+                \ref StaticFramework and \ref OfflineFramework work only with \ref data_size_32. 
+                
+                This method re-allocate the internal buffer like \ref set_block_size(). 
+                
+                This method have to be called before \ref start().
+            */
+        error_type set_data_size( data_size_type data_size );
+        
+            /**
+                \brief set the number of channels in a frame. 
+                \param channels 2 to \ref max_channels. 2 is I2S. More than 2 is TDM.
+                \returns show the error status
+                \details
+                By default, the framework works with 2 channels I2S. By giving more than 2 channels, 
+                the framework configures the SAI as TDM, which has given number of slots in a frame. 
+                In TDM, the FS signal is the one bit clock active high pulse before the first slot. 
+                
+                This method re-allocate the internal buffer like \ref set_block_size(). 
+                
+                To process more than 2 channels, use the multi-channel version of \ref start(). 
+                The stereo and Q31 call backs can be used only with 2 channels.
+                
+                This method have to be called before \ref start().
+            */
+        error_type set_channel_count( unsigned int channels );
+        
+            /**
+                \brief set the number of blocks in the buffer ring. 
+                \param depth 2 to \ref max_buffer_depth. 
+                \returns show the error status
+                \details
+                By default, the depth is 2. That is the classic double buffer : the I2S transfers one block 
+                while the process call back works on the other one. Then, the call back has exactly one 
+                block period to finish. 
+                
+                With the deeper ring, the completed blocks are queued. The call back can take up to 
+                depth - 1 block periods for a block, as long as the average load is less than one 
+                block period. This absorbs the bursty load like FFT frames, at the cost of the latency. 
+                See \ref get_latency().
+                
+                This method re-allocate the internal buffer like \ref set_block_size(). 
+                
+                This method have to be called before \ref start().
+            */
+        error_type set_buffer_depth( unsigned int depth );
+        
+            /**
+                \brief latency of the framework buffering. 
+                \returns latency from the input to the output [sample]. 
+                \details
+                The output of a block is sent when the I2S comes back to the same buffer. Then, the latency 
+                is depth * block size. Each extra level of the ring adds one block size to the double buffer. 
+                The delay inside the codec and the I2S FIFO is not included. 
+                
+                After \ref start() with the fast path, 0. See \ref set_single_frame_path(). 
+            */
+        unsigned int get_latency(void) const;
+        
+            /**
+                \brief give the memory for all buffers of the framework. 
+                \param memory the memory. Aligned to the cache line ( 32 byte ). NULL to use the heap again. 
+                \param size size of the memory [byte]. 
+                \returns show the error status
+                \details
+                By default, the buffers are allocated in the heap. With this method, they are placed in the 
+                given memory instead. For example, the DTCM of Cortex-M7 : 
+                \code
+    // 8 channels, 64 samples, double buffer. Same with get_buffer_footprint( 64, 8, 2 ).
+alignas(32) static uint8_t buffer_memory[ 12288 ] __attribute__(( section( ".dtcm" ) ));
+    ...
+    audio.set_buffer_memory( buffer_memory, sizeof( buffer_memory ) );
+    audio.set_channel_count( 8 );
+    audio.set_block_size( 64 );
+                \endcode
+                
+                The memory must be large enough for all later configurations. Otherwise, \ref set_block_size(), 
+                \ref set_channel_count() and \ref set_buffer_depth() return \ref memory_size_error. 
+                See \ref get_buffer_footprint(). 
+                
+                The memory must live while the framework lives. This method have to be called before \ref start().
+            */
+        error_type set_buffer_memory( void * memory, unsigned int size );
+        
+            /**
+                \brief size of the memory used by the buffers of the current configuration. 
+                \returns size [byte]. 
+                \details
+                All buffers are in one memory. The DMA buffers of each block, then the float buffers of 
+                each channel. Each buffer starts at the cache line. 
+                
+                The Q31 call back doesn't use the float buffers. \ref start() with it leaves them out, 
+                and this method returns the smaller size after that. 
+            */
+        unsigned int get_buffer_footprint(void) const;
+        
+            /**
+                \brief size of the memory needed by the buffers of a configuration. 
+                \param block_size block size [sample]. 
+                \param channels number of channels. 
+                \param depth depth of the buffer ring. 
+                \param data_size size of a sample on the I2S wire. See \ref set_data_size(). 
+                \param float_buffers false for the Q31 call back. It doesn't use the float buffers. 
+                \returns size [byte]. Give this size to \ref set_buffer_memory(). 
+            */
+        static unsigned int get_buffer_footprint( unsigned int block_size, unsigned int channels, unsigned int depth, 
+                                                  data_size_type data_size = data_size_32, bool float_buffers = true );
+        
+            /**
+                \brief run the process call back at the different sample rate. 
+                \param up interpolation factor. 
+                \param down decimation factor. 
+                \returns show the error status
+                \details
+                The call back runs at the codec rate * up / down. For example, 1/2 runs a 96kHz codec at 48kHz, 
+                1/3 runs a 48kHz codec at 16kHz, and 160/147 runs a 44.1kHz codec at 48kHz. 1/1 stops the resampling. 
+                
+                The received data is converted before the call back, and the transmission data is converted 
+                back after the call back, by the polyphase FIR of \ref Resampler. The block size and the 
+                init_cb parameter are at the internal rate. That is, block size * up / down. The block size 
+                must be chosen so that this is an integer. Otherwise, \ref start() returns \ref block_size_error. 
+                
+                Works with the floating point stereo and multi-channel call backs. The Q31 call back, the processing 
+                graph and \ref StaticFramework return \ref block_size_error. The delay of the filters is added to 
+                \ref get_latency(). The block size can't be changed while running. 
+                
+                This method have to be called before \ref start().
+            */
+        error_type set_resampling( unsigned int up, unsigned int down );
+        
+            /**
+                \brief select the action at the overrun. 
+                \param policy action. See \ref xrun_policy_type.
+                \details
+                By default, \ref xrun_ignore is selected. 
+                
+                With the drop policies, the late process can catch up by skipping the next block. Then, the 
+                consecutive overrun can be avoided for the temporary overload. 
+            */
+        void set_xrun_policy( xrun_policy_type policy );
+        
+            /**
+                \brief number of overruns since start. 
+                \returns the count of overrun. 
+                \details
+                Can be called from main(). The counter is updated by the interrupt, and never cleared. 
+                Take the difference of two calls to watch the overrun in a period. 
+            */
+        unsigned int get_xrun_count(void) const;
+        
+            /**
+                \brief number of blocks dropped by the xrun policy. 
+                \returns the count of dropped block. 
+                \details
+                Can be called from main(). Always 0 with \ref xrun_ignore. 
+            */
+        unsigned int get_dropped_block_count(void) const;
+        
+            /**
+                \brief set the call back to apply the parameter messages. 
+                \param cb The call back. Passing 0 let the framework discard the messages. 
+                \details
+                The call back is called in the process context, at the beginning of a block, before the 
+                process call back. It receives the fields of a \ref parameter_message posted by \ref post_parameter(). 
+                So, the process call back always sees a complete set of parameters. 
+                
+                Set before \ref start(). 
+            */
+        void set_parameter_callback( void (* cb ) ( unsigned int id, float value, void * data ) );
+        
+            /**
+                \brief maximum number of the parameter messages applied in a block. 
+                \param limit number of messages. 1 to \ref parameter_queue_size. 
+                \details
+                Bounds the time taken from the signal processing. The remaining messages are applied in 
+                the next blocks, in the posted order. By default, 4.
+            */
+        void set_parameter_drain_limit( unsigned int limit );
+        
+            /**
+                \brief send a parameter message to the process context. 
+                \param id Parameter ID. 
+                \param value New value. 
+                \param data Optional pointer. Can be NULL. 
+                \returns false if the queue is full. The message is not sent. 
+                \details
+                Wait-free. No interrupt is disabled. The message is queued, and applied at the beginning of 
+                a following block. See \ref set_parameter_callback(). 
+                
+                Must be called from one context only, usually main(). If data points to a memory, main() 
+                must not change it until the call back is done with it. 
+                
+                example : 
+                \code
+enum { gain_id, coefficients_id };
+
+void parameter_callback( unsigned int id, float value, void * data )
+{
+    if ( id == gain_id )
+        gain = value;
+    else if ( id == coefficients_id )
+        coefficients = (float *)data;
+}
+
+    ...
+    audio.post_parameter( gain_id, 0.5f );
+                \endcode
+            */
+        bool post_parameter( unsigned int id, float value, void * data = NULL );
+        
+            /**
+                \brief copy a channel of each block to a ring, for the recording and the metering. 
+                \param tap tap ID. 0 to \ref max_taps - 1. 
+                \param point \ref tap_rx or \ref tap_tx. 
+                \param channel channel to copy. 0 is left in I2S. 
+                \param length size of the ring [sample]. Must be the power of 2. 0 removes the tap. 
+                \param decimation copy one sample in every decimation samples. 1 copies all samples. 
+                \returns show the error status
+                \details
+                Set before \ref start(), after \ref set_channel_count(). After \ref start(), \ref tap_error is 
+                returned. The samples are read by \ref read_tap() from main(). No lock is needed. 
+                
+                Each block costs one memcpy() per tap. When the ring doesn't have room for the whole block, 
+                the block is not copied, and counted by \ref get_tap_overflow_count(). 
+                
+                The decimation doesn't filter. Use it for the meters and the scopes, or filter in the call back. 
+                
+                The taps work with the floating point call backs and the processing graph. With the Q31 call back, 
+                nothing is copied. 
+            */
+        error_type set_tap( unsigned int tap, tap_point_type point, unsigned int channel, unsigned int length, unsigned int decimation = 1 );
+        
+            /**
+                \brief take the samples from the ring of a tap. 
+                \param tap tap ID. 
+                \param buffer place to copy the samples. 
+                \param length maximum number of samples to take. 
+                \returns number of samples taken. 0 if the ring is empty. 
+                \details
+                Must be called from one context only, usually main(). 
+            */
+        unsigned int read_tap( unsigned int tap, float buffer[], unsigned int length );
+        
+            /**
+                \brief number of samples lost because the ring of a tap was full. 
+                \param tap tap ID. 
+                \returns the count of lost sample. After the decimation. 
+                \details
+                Can be called from main(). The counter is updated by the interrupt, and never cleared. 
+            */
+        unsigned int get_tap_overflow_count( unsigned int tap ) const;
+        
+            /**
+                \brief enable the profiler. 
+                \param enable true to measure. 
+                \details
+                The profiler reads the cycle counter at each stage of the interrupts ( See \ref profile_stage_type ), 
+                and keeps min, max, mean and a histogram of each stage. The counter is DWT CYCCNT on target, and 
+                the monotonic clock in ns on host. Enabling clears the statistics. 
+                
+                The cost is a few cycles per stage. Disabled by default. 
+            */
+        void set_profiling( bool enable );
+        
+            /**
+                \brief clear the statistics of the profiler. 
+                \details
+                Can be called from main(). Each stage is cleared at its next measurement. 
+            */
+        void reset_profile(void);
+        
+            /**
+                \brief statistics of a stage. 
+                \param stage the stage. 
+                \param statistics place to copy. 
+                \details
+                Can be called from main() without disabling the interrupts. The interrupt doesn't wait for main(). 
+                If the interrupt updates the stage while copying, it is copied again. 
+            */
+        void get_profile( profile_stage_type stage, profile_statistics & statistics ) const;
+        
+            /**
+                \brief CPU load of the framework [%]. 
+                \returns the total time of the interrupts and the process, relative to the block period.
+                \details
+                Can be called from main(). Average since the profiler was enabled, or reset. 0 before 
+                the first block period is measured. 
+            */
+        float get_cpu_load(void) const;
+        
+            /**
+                \brief frequency of the cycle counter of the profiler [Hz]. 
+                \details
+                Use this to convert the cycles of \ref profile_statistics to seconds. 
+            */
+        static unsigned int get_cycle_frequency(void);
+        
+        
             /**
                 \brief  the real audio signal transfer. Trigger the I2S interrupt and call the call back.
                 \param init_cb initializer call back for signal processing. This is invoked only once before processing. Can be NUL
                 \param process_cb The call back function
+                \returns show the error status
                 \details
                 Set the call back function, then start the transer on I2S
                 
@@ -161,12 +724,189 @@ int main()
                 
                 Note that the call back is called at interrupt context. Not the thread level context.
                 That mean, it is better to avoid to call mbed API except the mbed-RTOS API for interrupt handler.
+                See \ref set_execution() to call it from a thread.
+                
+                If the last \ref set_block_size() failed to allocate the buffers, this method returns 
+                \ref memory_allocation_error without starting the transfer. 
                 */
-        void start(
+        error_type start(
                 void (* init_cb ) (unsigned int),
                 void (* process_cb ) (float[], float[], float[], float[], unsigned int)
                 );
 
+            /**
+                \brief  the real audio signal transfer with the fixed point call back. 
+                \param init_cb initializer call back for signal processing. This is invoked only once before processing. Can be NUL
+                \param process_cb The call back function
+                \returns show the error status
+                \details
+                Same with the floating point version, except the parameters of the call back are Q31 fixed point.
+                The data is passed to process_cb without conversion. That is, the value is same with the data on I2S. 
+                
+                In this mode, the framework doesn't use the floating point buffers. The call back receives the 
+                deinterleaved data inside the internal I2S buffers. So, the call back have to stay inside the given 
+                length, and must not keep the pointers after return. 
+                */
+        error_type start(
+                void (* init_cb ) (unsigned int),
+                void (* process_cb ) (int32_t[], int32_t[], int32_t[], int32_t[], unsigned int)
+                );
+
+            /**
+                \brief  the real audio signal transfer with the multi-channel call back. 
+                \param init_cb initializer call back for signal processing. This is invoked only once before processing. Can be NUL
+                \param process_cb The call back function
+                \returns show the error status
+                \details
+                Same with the stereo version, except the parameters of the call back. The call back has 4 parameters.
+                \li rx        Array of the pointers to the received data. rx[0] is the first slot of the frame. 
+                \li tx        Array of the pointers to the buffer to fill the transmission data. 
+                \li channels  Number of channels. Length of above arrays. Set by \ref set_channel_count(). 
+                \li length    length of each buffer. 
+                
+                example : 
+                \code
+void process_callback( float * rx[], float * tx[], unsigned int channels, unsigned int block_size )
+{
+    for ( unsigned int ch=0; ch<channels; ch++ )
+        for ( unsigned int i=0; i<block_size; i++ )
+            tx[ch][i] = rx[ch][i];
+}
+                \endcode
+                */
+        error_type start(
+                void (* init_cb ) (unsigned int),
+                void (* process_cb ) (float *[], float *[], unsigned int, unsigned int)
+                );
+
+            /**
+                \brief  the real audio signal transfer with the interleaved call back. 
+                \param init_cb initializer call back for signal processing. This is invoked only once before processing. Can be NUL
+                \param process_cb The call back function
+                \returns show the error status
+                \details
+                Same with the multi-channel version, except the data is interleaved. The call back has 4 parameters.
+                \li in        Received data. Frame major, LRLR... in stereo. frames * channels samples.
+                \li out       Buffer to fill the transmission data. Same format with in. 
+                \li frames    Number of frames. Same with the block size. 
+                \li channels  Number of channels in a frame. Set by \ref set_channel_count(). 
+                
+                The I2S data is converted in one streaming pass each way, without the deinterleaving. It fits to 
+                the algorithms which work on the frames, like the M/S matrix or the cross channel limiter. 
+                
+                The resampling works on the channels. If \ref set_resampling() is set, this method returns 
+                \ref block_size_error. 
+                
+                example : 
+                \code
+void process_callback( float in[], float out[], unsigned int frames, unsigned int channels )
+{
+        // M/S width of a stereo pair
+    for ( unsigned int i=0; i<frames; i++ )
+    {
+        float mid = 0.5f * ( in[2*i] + in[2*i+1] );
+        float side = 0.5f * ( in[2*i] - in[2*i+1] ) * width;
+        
+        out[2*i] = mid + side;
+        out[2*i+1] = mid - side;
+    }
+}
+                \endcode
+                */
+        error_type start(
+                void (* init_cb ) (unsigned int),
+                void (* process_cb ) (float[], float[], unsigned int, unsigned int)
+                );
+
+            /**
+                \brief  the real audio signal transfer with the processing graph. 
+                \param init_cb initializer call back for signal processing. This is invoked only once before processing. Can be NUL
+                \param graph the graph of the processing nodes. See \ref ProcessGraph.
+                \returns show the error status
+                \details
+                Same with the multi-channel version, except the processing is done by the nodes of the graph. 
+                The execution order and the buffers of the graph are planned here. If the graph has a loop or 
+                an unconnected input, this method returns \ref graph_error without starting the transfer. 
+                
+                The graph must live while the framework is running. 
+                */
+        error_type start(
+                void (* init_cb ) (unsigned int),
+                ProcessGraph * graph
+                );
+        
+            /**
+                \brief start with the call backs which have a context pointer. 
+                \param init_cb initializer call back for signal processing. Can be NULL. 
+                \param process_cb The call back function. 
+                \param context given to both call backs as the last parameter. 
+                \returns show the error status
+                \details
+                Same with \ref start() of the floating point stereo call back, except the context. Then, the state 
+                of the signal processing can be an object, instead of the global variables. 
+                
+                example :
+                \code
+Equalizer eq;
+
+void process_callback( float rx_left[], float rx_right[], float tx_left[], float tx_right[], unsigned int block_size, void * context )
+{
+    ( (Equalizer *)context )->process( rx_left, rx_right, tx_left, tx_right, block_size );
+}
+
+    audio.start( NULL, process_callback, &eq );
+                \endcode
+                */
+        error_type start(
+                void (* init_cb ) (unsigned int, void *),
+                void (* process_cb ) (float[], float[], float[], float[], unsigned int, void *),
+                void * context
+                );
+        
+            /**
+                \brief start with a callable object. 
+                \tparam Processor type of the object. 
+                \param init_cb initializer call back for signal processing. Can be NULL. 
+                \param processor object which has operator()( float rx_left[], float rx_right[], float tx_left[], float tx_right[], unsigned int block_size ). 
+                \returns show the error status
+                \details
+                Same with \ref start() of the floating point stereo call back, except the call back. The code to process 
+                a block is generated for each Processor type. So, the compiler can inline operator() between the format 
+                conversions. There is no call through the function pointer for the signal processing. It matters for 
+                the small block size. 
+                
+                The object is referenced while running. A temporary object can't be given. 
+                
+                example :
+                \code
+struct Gain
+{
+    float gain;
+    
+    void operator()( float rx_left[], float rx_right[], float tx_left[], float tx_right[], unsigned int block_size )
+    {
+        for ( unsigned int i=0; i<block_size; i++ )
+        {
+            tx_left[i] = rx_left[i] * gain;
+            tx_right[i] = rx_right[i] * gain;
+        }
+    }
+};
+
+Gain gain = { 0.5f };
+
+    audio.start( NULL, gain );
+                \endcode
+                */
+        template < typename Processor >
+        error_type start(
+                void (* init_cb ) (unsigned int),
+                Processor & processor
+                )
+        {
+            return _start_processor( init_cb, _run_processor< Processor >, &processor );
+        }
+
 
             /**
                 \brief Debug hook for interrupt handler. 
@@ -212,6 +952,18 @@ int main()
             */
         void set_post_process_callback( void (* cb ) (void));
         
+            /**
+                \brief Debug hooks with a context pointer. 
+                \param cb A call back. The context is given as the parameter. 
+                \param context pointer given to cb. 
+                \details
+                Same with the hooks without the context. Setting one of them replaces the other. 
+            */
+        void set_pre_interrupt_callback( void (* cb ) (void *), void * context );
+        void set_post_interrupt_callback( void (* cb ) (void *), void * context );      ///< \copydoc set_pre_interrupt_callback(void(*)(void*),void*)
+        void set_pre_process_callback( void (* cb ) (void *), void * context );         ///< \copydoc set_pre_interrupt_callback(void(*)(void*),void*)
+        void set_post_process_callback( void (* cb ) (void *), void * context );        ///< \copydoc set_pre_interrupt_callback(void(*)(void*),void*)
+        
             /**
                 \brief optional priority control for I2S IRQ. 
                 \param pri Priority of IRQ.
@@ -243,45 +995,438 @@ int main()
 
             */
         void set_process_irq_priority( unsigned int pri );
+        
+            /**
+                \brief the I2S port of this framework. 
+            */
+        unsigned int get_port(void) const { return _port; }
+        
+            /**
+                \brief share one process IRQ by all ports. 
+                \param shared true to process the blocks of all ports in the process IRQ of port 0.
+                \details
+                By default, each port has its own process IRQ. On the target, the process IRQ is a killed 
+                interrupt of other peripheral. So, each port kills one more peripheral. 
+                
+                If shared, the blocks of all ports are processed in the process IRQ of port 0, in the order 
+                of the port. The IRQ of other ports are not touched. The priority is given by 
+                \ref set_process_irq_priority() of any framework. In \ref thread_execution, the thread of 
+                port 0 processes all ports. 
+                
+                Call before creating the frameworks.
+            */
+        static void set_shared_process_irq( bool shared );
 
     private:        
-        static Framework * _fw;
-    private:
-        void (* _pre_interrupt_callback )(void);
-        void (* _post_interrupt_callback )(void);
-        void (* _pre_process_callback )(void);
-        void (* _post_process_callback )(void);
+            // The framework of each port. The interrupt handlers dispatch by this. 
+        static Framework * _instances[max_ports];
+        static bool _shared_process_irq;
+        unsigned int _port;
+        
+            // The process IRQ of the port 0 serves all ports, or each port has its own. 
+        unsigned int _process_irq_port(void) const { return _shared_process_irq ? 0 : _port; }
+    protected:
+            /**
+                \brief constructor for the derived class which provides the buffers by itself. 
+                \param block_size fixed block size. 
+                \param channels fixed number of channels. 
+                \param depth fixed depth of the buffer ring. 
+                \param port I2S port to use. 
+                \details
+                The derived class must call \ref _attach_buffers() in its constructor. 
+                \ref set_block_size() returns \ref block_size_error for this object. 
+            */
+        Framework( unsigned int block_size, unsigned int channels, unsigned int depth, unsigned int port = 0 );
+        
+            /**
+                \brief constructor for the derived class which moves the samples by itself. 
+                \param transport \ref offline_transport. 
+                \details
+                The I2S and the interrupts are not touched. Then, the object can coexist with the 
+                running framework. The derived class calls \ref _process_block() to process a block. 
+            */
+        Framework( transport_type transport );
+        
+            /**
+                \brief give the statically allocated buffers to the framework. 
+                \param int_buffer_memory 2 * depth int buffers. tx buffers then rx buffers. Must be aligned to the cache line. 
+                \param int_buffer_stride size of one int buffer [word]. Multiple of \ref cache_line_words, and >= channels * block size.
+                \param float_buffer_memory 2 * channels float buffers. tx buffers then rx buffers. Each one has block size words. 
+            */
+        void _attach_buffers( int32_t int_buffer_memory[], int int_buffer_stride, float float_buffer_memory[] );
+        
+            /**
+                \brief conversion and the float call back. 
+                \param rx received data. LRLR...
+                \param tx place to write the transmission data. LRLR...
+                \details
+                The derived class can override to specialize the processing. 
+            */
+        virtual void _process_float_block( int32_t rx[], int32_t tx[] );
+        
+            /**
+                \brief conversion and the multi-channel call back. 
+                \param rx received data. Frame major.
+                \param tx place to write the transmission data. Frame major.
+                \details
+                The derived class can override to specialize the processing. 
+            */
+        virtual void _process_multichannel_block( int32_t rx[], int32_t tx[] );
+        
+            // conversion and the interleaved call back. The float buffers of the channel 0 are used as one 
+            // interleaved buffer. Each one has channels * stride words. 
+        void _process_interleaved_block( int32_t rx[], int32_t tx[] );
+        
+            // Cache line size of Cortex-M7 [word]. The DMA buffers are aligned to this size.
+        static const int cache_line_words = 8;
+        
+        void (* _init_callback )( unsigned int block_size );
+        void (* _init_context_callback )( unsigned int block_size, void * context );
+        void * _init_context;
+        
+            // Debug hooks. The plain call back, or the one with the context. 
+        struct hook_type
+        {
+            void (* callback )(void);
+            void (* context_callback )( void * context );
+            void * context;
+        };
+        hook_type _pre_interrupt_hook;
+        hook_type _post_interrupt_hook;
+        hook_type _pre_process_hook;
+        hook_type _post_process_hook;
+        
+        static inline void _call_hook( const hook_type & hook )
+        {
+            if ( hook.callback )
+                hook.callback();
+            else if ( hook.context_callback )
+                hook.context_callback( hook.context );
+        }
+        
+            // call the init call back, with or without the context. 
+        void _call_init( unsigned int block_size );
         
         void (* _process_callback )( float left_in[], float right_in[], float left_out[], float right_out[], unsigned int length );
+        void (* _q31_process_callback )( int32_t left_in[], int32_t right_in[], int32_t left_out[], int32_t right_out[], unsigned int length );
+        void (* _multichannel_process_callback )( float * in[], float * out[], unsigned int channels, unsigned int length );
+        void (* _interleaved_process_callback )( float in[], float out[], unsigned int frames, unsigned int channels );
+        ProcessGraph * _graph;
+        
+            // Processing of a block, generated for the type of the callable object. See start() of the Processor.
+            // _processor_context is the object.
+        void (* _block_processor )( Framework * framework, int32_t rx[], int32_t tx[] );
+        void * _processor_context;
+        
+            // The call back with the context, as a callable object. 
+        struct context_processor_type
+        {
+            void (* callback )( float[], float[], float[], float[], unsigned int, void * );
+            void * context;
+            
+            void operator()( float rx_left[], float rx_right[], float tx_left[], float tx_right[], unsigned int length )
+            {
+                callback( rx_left, rx_right, tx_left, tx_right, length, context );
+            }
+        };
+        context_processor_type _context_processor;
+        
+            // Common part of start() for the callable object. 
+        error_type _start_processor( 
+                void (* init_cb ) (unsigned int), 
+                void (* block_processor )( Framework *, int32_t[], int32_t[] ), 
+                void * context 
+                );
+        
+            // Conversion before and after the float call back. Gives the buffers and the length for the call back. 
+        void _begin_float_block( int32_t rx[], float ** & rx_buffer, float ** & tx_buffer, unsigned int & length );
+        void _end_float_block( int32_t tx[] );
+        
+        template < typename Processor >
+        static void _run_processor( Framework * framework, int32_t rx[], int32_t tx[] )
+        {
+            Processor & processor = *static_cast< Processor * >( framework->_processor_context );
+            float ** rx_buffer;
+            float ** tx_buffer;
+            unsigned int length;
+            
+            framework->_begin_float_block( rx, rx_buffer, tx_buffer, length );
+            processor( rx_buffer[0], rx_buffer[1], tx_buffer[0], tx_buffer[1], length );
+            framework->_end_float_block( tx );
+        }
+        
+            // Sample rate conversion around the float call backs. Both NULL without the resampling. 
+            // The call back works on the internal buffers, at the internal block size. 
+        unsigned int _resampling_up;
+        unsigned int _resampling_down;
+        Resampler * _input_resampler;
+        Resampler * _output_resampler;
+        int _internal_block_size;
+        float * _rx_internal_buffer[max_channels];
+        float * _tx_internal_buffer[max_channels];
+        float * _internal_buffer_memory;
+        
+            // Parameter messages from main() to the process irq. Applied at the beginning of each block. 
+        void (* _parameter_callback )( unsigned int id, float value, void * data );
+        SpscQueue< parameter_message, parameter_queue_size > _parameter_queue;
+        unsigned int _parameter_drain_limit;
+        
+            // Audio taps. Each one has a ring from the process irq to main(). 
+            // phase : index of the next sample to copy in the next block. Less than decimation. 
+        struct tap_type
+        {
+            SpscRing<float> ring;
+            tap_point_type point;
+            unsigned int channel;
+            unsigned int decimation;
+            unsigned int phase;
+            volatile unsigned int overflow_count;
+        };
+        tap_type _taps[max_taps];
+        int _tap_count;                 // number of taps from 0 which can be active. 
+        
+            // Transport method between I2S and buffer.
+        transport_type _transport;
+        
+            // Context of the process. 
+        execution_type _execution;
+        
+            // Block size 1 fast path. Allowed by the application, and by the configuration at start(). 
+        bool _single_frame_enabled;
+        bool _single_frame;
+        
+            // Size of a sample on the I2S wire, and in the int buffers. 
+        data_size_type _data_size;
+        
+            // Block queue between I2S irq and process irq. Lock free. Each counter is written only by one side. 
+            // _dispatched_blocks : I2S irq. Number of blocks given to the process irq. 
+            // _processed_blocks : process irq. Number of blocks completed or skipped. 
+            // _block_queue : I2S irq. Buffer index of each dispatched block, at [ count % max_buffer_depth ].
+            // If depth - 1 blocks are still waiting at the end of a block, the process is late. 
+            // The counters are stored with release after the queue entry or the tx buffer is written, 
+            // and loaded with acquire by the other side. The process may run in a thread on the other core of host. 
+        xrun_policy_type _xrun_policy;
+        std::atomic<unsigned int> _dispatched_blocks;
+        std::atomic<unsigned int> _processed_blocks;
+        std::atomic<int> _block_queue[max_buffer_depth];
+        volatile unsigned int _block_dispatch_cycle[max_buffer_depth];     // Cycle count at the dispatch, for profile_latency.
+        volatile bool _block_dispatch_profiled[max_buffer_depth];          // _block_dispatch_cycle is valid. 
+        volatile unsigned int _xrun_count;
+        volatile unsigned int _dropped_block_count;
+        
+            // Request from I2S irq to process irq for xrun_repeat policy. _repeat_index is published by _repeat_requests.
+        std::atomic<int> _repeat_index;
+        std::atomic<unsigned int> _repeat_requests;
+        std::atomic<unsigned int> _repeat_done;
         
             // Size of the blocks ( interval of interrupt to call process_callback. 1 means every interrupt. 2 means every 2 interrupt )
         int _block_size;
         
-            // Index for indentifying the buffer for interrupt. 0 or 1. 
+            // Number of channels in a frame. 2 is I2S. 
+        int _channels;
+        
+            // Number of blocks in the buffer ring. 2 is double buffer.
+        int _buffer_depth;
+        
+            // Index for indentifying the buffer for interrupt. 0 to _buffer_depth - 1. 
         int _buffer_index;
         
-            // Index for indentifying the buffer for processing. 0 or 1. 
-        int _process_index;
+            // Buffer index loaded in the memory address registers 0 and 1 of the DMA.
+        int _dma_buffer_index[2];
+        
+            // Set by the DMA irq, cleared by the process irq. The I2S is stopping to restart with the new buffers. 
+            // See _restart_dma(). 
+        std::atomic<bool> _dma_restarting;
         
             // next transfer position in buffer
         int _sample_index;
         
             // buffer for interrupt handler.
-            // data format is LRLR... 
-        int *_tx_int_buffer[2];
-        int *_rx_int_buffer[2];
+            // data format is LRLR... ( frame major in TDM ). int16_t samples in data_size_16. 
+        int32_t *_tx_int_buffer[max_buffer_depth];
+        int32_t *_rx_int_buffer[max_buffer_depth];
+        
+            // buffers for passing. One buffer for each channel. 0 is left, 1 is right in I2S.
+        float * _tx_float_buffer[max_channels];
+        float * _rx_float_buffer[max_channels];
+        
+            // One arena for all buffers. int tx, int rx, float tx, float rx. Aligned to the cache line. 
+            // _heap_memory : allocated by the framework. NULL when the application gives the memory. 
+            // _buffer_memory : given by set_buffer_memory(). 
+        int32_t *_heap_memory;
+        void * _buffer_memory;
+        unsigned int _buffer_memory_size;
+        
+            // true when buffers are given by the derived class. 
+        bool _fixed_buffers;
+        
+            // length of each int buffer [word]. Rounded up to the cache line. 
+        int _int_buffer_stride;
+        
+            // length of each float buffer [word]. Rounded up to the cache line. 
+        int _float_buffer_stride;
+        
+            // false with the Q31 call back. The float buffers are not in the memory, and their pointers are NULL. 
+        bool _float_buffers;
+        
+            // true after start(). 
+        bool _started;
+        
+            // Block size change while running. 
+            // main() prepares the new buffers, then requests. The process irq fades out the block being processed. 
+            // The I2S irq swaps the buffers after that block is sent. The process irq calls the initializer 
+            // and fades in the first new block. The atomic state orders the pending data between contexts. 
+            // The state goes back to idle after the fade in. Then, the next fade out starts from full scale. 
+        enum resize_state_type { resize_idle, resize_requested, resize_faded, resize_swapped, resize_fading_in };
+        std::atomic<int> _resize_state;
+        int32_t * _pending_memory;          // aligned memory of the new buffers. Cleared. 
+        int32_t * _pending_heap_memory;     // NULL if the memory is given by the application. 
+        int _pending_block_size;
+        int _pending_int_buffer_stride;
+        int _pending_float_buffer_stride;
+        int32_t * _retired_memory;          // heap memory of the old buffers. Released by main() later. 
+        int _fade_index;                    // process irq. Buffer index of the last faded out block. 
+        bool _fade_sent;                    // I2S irq. The last faded out block is sent. 
+        bool _fade_in;                      // process irq. Fade in the next blocks. 
+        int _fade_position;                 // process irq. Frames faded so far. 
+        int _fade_length;                   // process irq. Length of the fade [frame]. Multiple of the block size. 
         
-            // buffers for passing 
-        float * _tx_left_buffer, * _tx_right_buffer;
-        float * _rx_left_buffer, * _rx_right_buffer;
+            // Shortest fade [frame]. The small blocks are faded over several blocks. 
+        static const int min_fade_frames = 64;
                 
+            // common part of the constructors
+        void _initialize(void);
+        
+            // register this object to the interrupt handlers of the port
+        void _setup_irq( unsigned int port );
+        
+            // no_error if this object owns a valid port. 
+        error_type _check_port(void) const;
+        
+            // carve the buffers out from the aligned memory. The memory is not cleared. 
+        void _assign_int_buffers( int32_t aligned_memory[] );
+        void _assign_float_buffers( float aligned_memory[] );
+        
+            // length of each int buffer of a configuration [word]. Rounded up to the cache line. 
+        static int _int_buffer_words( unsigned int block_size, unsigned int channels, data_size_type data_size );
+        
+            // length of the data of a block in the int buffer [word]. Two samples per word in data_size_16. 
+        int _int_block_words(void) const
+        {
+            return _data_size == data_size_16 ? ( _block_size * _channels + 1 ) / 2 : _block_size * _channels;
+        }
+        
+            // format conversion between an int buffer and the float buffers of all channels. Q31 or Q15. 
+        void _convert_rx_block( const int32_t rx[] );
+        void _convert_tx_block( int32_t tx[] );
+        
+            // prepare the resamplers and the internal buffers for the current block size. 
+        error_type _setup_resampling(void);
+        
+            // convert the float buffers to the internal buffers, and back. 
+        void _resample_rx(void);
+        void _resample_tx(void);
+        
+            // prepare the buffers of the new block size while running, and request the swap. 
+        error_type _request_block_size( unsigned int new_block_size );
+        
+            // block size change at the end of a block in the I2S irq. Returns true if the block must not be dispatched. 
+        bool _resize_at_boundary( int completed_index );
+        void _swap_buffers(void);
+        
+            // restart the DMA with the swapped buffers, when the I2S has stopped. Otherwise, come back at the next process irq. 
+        void _restart_dma(void);
+        
+            // trigger the process irq, or wake up the process thread. 
+        void _signal_process(void);
+        
+            // apply the linear fade to the transmission data of a block. Returns true at the last block of the fade. 
+        bool _fade_block( int32_t tx[], bool fade_in );
+        
+            // release the arena, and clear the buffer pointers. 
+        void _release_buffers(void);
+        
+            // start the I2S transfer by the current configuration. 
+        void _start_transfer(void);
+        
+            // install the process IRQ handler, or start the process thread, by the execution mode. 
+        void _setup_process(void);
+        
+            // give the completed block to the process irq, with the overrun check. 
+        void _dispatch_block( int index );
+        
+            // true if the I2S irq can process the frame by itself. 
+            // No block must be left in the process irq. Otherwise, the call back is called from two contexts. 
+            // The fade out of the block size change is done here too. The ring has no data to fade out. 
+        bool _single_frame_ready(void) const
+        {
+            return _single_frame && _block_size == 1 && _tap_count == 0 && ! _fade_in && 
+                   ( _resize_state == resize_idle || _resize_state == resize_requested ) &&
+                   _processed_blocks.load( std::memory_order_acquire ) == _dispatched_blocks.load( std::memory_order_relaxed );
+        }
+        
+            // receive, process and send a frame in the I2S irq. 
+        void _process_single_frame(void);
+        
             // real processing method.
         void _do_i2s_irq(void);
         void _do_process_irq(void);
         
-            // handler for NIVC
-        static void _i2s_irq_handler();
-        static void _process_irq_handler();        
+            // conversion and call back for the buffer of the index. Common to the process irq and the offline mode.
+        void _process_block( int index );
+        void _do_dma_irq(void);
+        
+            // give the queued parameter messages to the parameter call back. 
+        void _apply_parameters(void);
+        
+            // copy the float buffers of the point to the taps. 
+        void _feed_taps( tap_point_type point );
+        
+            // handler for NIVC. One for each port. 
+        template < unsigned int Port > static void _i2s_irq_handler() { _instances[Port]->_do_i2s_irq(); }
+        template < unsigned int Port > static void _process_irq_handler() { _instances[Port]->_do_process_irq(); }
+        template < unsigned int Port > static void _dma_irq_handler() { _instances[Port]->_do_dma_irq(); }
+        
+            // handler of the shared process IRQ. 
+        static void _shared_process_irq_handler();
+        
+    private:
+            // Statistics of a stage. Written by one interrupt. Read by main() with the sequence lock. 
+            // The sequence is odd while writing. main() clears by the reset request. 
+        struct profile_counter_type
+        {
+            std::atomic<unsigned int> sequence;
+            std::atomic<unsigned int> reset_requests;
+            unsigned int reset_done;
+            unsigned int count;
+            unsigned int min;
+            unsigned int max;
+            unsigned long long sum;
+            unsigned int histogram[profile_histogram_bins];
+            
+            void add( unsigned int cycles );
+            void read( profile_statistics & statistics, unsigned long long & total ) const;
+        };
+        
+        profile_counter_type _profile_counters[number_of_profile_stages];
+        bool _profiling;                        // main(). Enable of the profiler. 
+        bool _profiling_block;                  // process irq. Enable latched at the beginning of a block. 
+        unsigned int _profile_block_start;      // process irq. Cycle count at the beginning of the block. 
+        unsigned int _profile_last_mark;        // process irq. Cycle count at the last mark. 
+        unsigned int _profile_last_boundary;    // I2S irq. Cycle count at the last completed block. 
+        bool _profile_has_boundary;             // I2S irq. _profile_last_boundary is valid. 
+        
+            // I2S irq. Measure the block period at the completion of a block. 
+        void _profile_boundary(void);
+    protected:
+            // Measure the stage from the last mark of the process. Then, the next stage starts. 
+        void _profile_mark( profile_stage_type stage )
+        {
+            if ( _profiling_block )
+                _record_profile( stage );
+        }
+        
+        void _record_profile( profile_stage_type stage );
     };
 
 
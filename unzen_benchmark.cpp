@@ -0,0 +1,953 @@
+#ifdef UNZEN_BENCHMARK
+
+// Micro benchmark of the unzen audio framework.
+// Build this file with the framework and UNZEN_BENCHMARK defined. The result is printed in JSON.
+//
+// host :
+//   g++ -std=c++11 -O2 -march=native -DUNZEN_HOST -DUNZEN_BENCHMARK -pthread
+//       unzen.cpp unzen_hal_host.cpp unzen_convert.cpp unzen_graph.cpp unzen_resampler.cpp unzen_convolver.cpp unzen_biquad.cpp unzen_benchmark.cpp -o unzen_benchmark
+// target :
+//   Add -DUNZEN_BENCHMARK to the compiler option of the mbed project, and remove its main().
+//   The JSON goes to the serial console by printf().
+//
+// A sample is one frame. That is, one left and right sample in stereo.
+// The cycles are the DWT cycle counter on target, and the time stamp counter on x86 host.
+// The kernels are checked against the references first, and the TDM path on host. A failed check is reported to stderr, and fails the exit code.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#ifdef UNZEN_HOST
+#include <chrono>
+#include <thread>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define UNZEN_BENCHMARK_TSC
+#endif
+#endif
+
+#include "unzen.h"
+#include "unzen_hal.h"
+#include "unzen_convert.h"
+#include "unzen_static.h"
+#include "unzen_convolver.h"
+#include "unzen_biquad.h"
+
+namespace unzen
+{
+        // Block sizes of the sweep.
+    static const unsigned int block_sizes[] = { 1, 2, 4, 8, 16, 32, 64, 128, 256 };
+    static const unsigned int max_block_size = 256;
+    static const unsigned int number_of_block_sizes = sizeof(block_sizes) / sizeof(block_sizes[0]);
+
+        // Each measurement processes this number of samples. Best of the repeats is taken.
+#ifdef UNZEN_HOST
+    static const unsigned int samples_per_measurement = 1 << 18;
+#else
+    static const unsigned int samples_per_measurement = 1 << 14;
+#endif
+    static const int repeats = 5;
+
+        // Time stamp [nS] and cycle counter.
+    static inline unsigned long long read_ns(void)
+    {
+#ifdef UNZEN_HOST
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch() ).count();
+#else
+        return 0;   // computed from the cycles
+#endif
+    }
+
+    static inline unsigned long long read_cycles(void)
+    {
+#if defined(UNZEN_BENCHMARK_TSC)
+        return __rdtsc();
+#elif defined(UNZEN_HOST)
+        return 0;
+#else
+        return DWT->CYCCNT;
+#endif
+    }
+
+    static const char * cycle_counter_name(void)
+    {
+#if defined(UNZEN_BENCHMARK_TSC)
+        return "tsc";
+#elif defined(UNZEN_HOST)
+        return "none";
+#else
+        return "dwt";
+#endif
+    }
+
+        // Framework with the internal methods opened for the measurement.
+    class BenchmarkFramework : public Framework
+    {
+    public:
+        explicit BenchmarkFramework( unsigned int port = 0 ) : Framework( port ) {}
+        
+        using Framework::_process_block;
+        using Framework::_dispatch_block;
+        using Framework::_do_i2s_irq;
+    };
+
+    template < unsigned int BlockSize >
+    class BenchmarkStaticFramework : public StaticFramework< BlockSize, 2 >
+    {
+    public:
+        using StaticFramework< BlockSize, 2 >::_process_block;
+    };
+
+        // Call backs for the measurement.
+    static void passthrough_callback( float rx_left[], float rx_right[], float tx_left[], float tx_right[], unsigned int block_size )
+    {
+        for ( unsigned int i=0; i<block_size; i++ )
+        {
+            tx_left[i] = rx_left[i];
+            tx_right[i] = rx_right[i];
+        }
+    }
+
+    static void q31_passthrough_callback( int32_t rx_left[], int32_t rx_right[], int32_t tx_left[], int32_t tx_right[], unsigned int block_size )
+    {
+        for ( unsigned int i=0; i<block_size; i++ )
+        {
+            tx_left[i] = rx_left[i];
+            tx_right[i] = rx_right[i];
+        }
+    }
+
+        // Same with passthrough_callback(), in the interleaved format. 
+    static void interleaved_passthrough_callback( float in[], float out[], unsigned int frames, unsigned int channels )
+    {
+        for ( unsigned int i=0; i<frames*channels; i++ )
+            out[i] = in[i];
+    }
+
+        // Same with passthrough_callback(), with the context. 
+    static void context_passthrough_callback( float rx_left[], float rx_right[], float tx_left[], float tx_right[], unsigned int block_size, void * )
+    {
+        passthrough_callback( rx_left, rx_right, tx_left, tx_right, block_size );
+    }
+
+        // Same with passthrough_callback(), as a callable object. The compiler can inline it.
+    struct PassthroughProcessor
+    {
+        void operator()( float rx_left[], float rx_right[], float tx_left[], float tx_right[], unsigned int block_size )
+        {
+            for ( unsigned int i=0; i<block_size; i++ )
+            {
+                tx_left[i] = rx_left[i];
+                tx_right[i] = rx_right[i];
+            }
+        }
+    };
+
+    static bool first_result = true;
+
+        // Run op for samples_per_measurement samples, and print the best of repeats.
+        // op processes samples_per_call samples.
+    template < typename Operation >
+    static void measure( const char * name, unsigned int block_size, unsigned int samples_per_call, Operation op )
+    {
+        unsigned int calls = samples_per_measurement / samples_per_call;
+        if ( calls == 0 )
+            calls = 1;
+
+        unsigned long long best_ns = ~0ULL;
+        unsigned long long best_cycles = ~0ULL;
+
+            // Warm up the cache and the branch predictor.
+        op();
+
+        for ( int r=0; r<repeats; r++ )
+        {
+            unsigned long long start_ns = read_ns();
+            unsigned long long start_cycles = read_cycles();
+
+            for ( unsigned int i=0; i<calls; i++ )
+                op();
+
+            unsigned long long cycles = read_cycles() - start_cycles;
+            unsigned long long ns = read_ns() - start_ns;
+
+#ifndef UNZEN_HOST
+                // 32bit counter. Good for 20 seconds at 216MHz.
+            cycles = (uint32_t)cycles;
+            ns = cycles * 1000000000ULL / SystemCoreClock;
+#endif
+            if ( ns < best_ns )
+                best_ns = ns;
+            if ( cycles < best_cycles )
+                best_cycles = cycles;
+        }
+
+        double samples = (double)calls * samples_per_call;
+
+        printf( "%s\n    { \"name\": \"%s\", \"block_size\": %u, \"ns_per_sample\": %.3f, \"ns_per_block\": %.1f, ",
+                first_result ? "" : ",", name, block_size, best_ns / samples, best_ns * (double)block_size / samples );
+        if ( best_cycles )
+            printf( "\"cycles_per_sample\": %.3f }", best_cycles / samples );
+        else
+            printf( "\"cycles_per_sample\": null }" );
+
+        first_result = false;
+    }
+
+        // Number of the failed checks. Non zero fails the benchmark.
+    static unsigned int check_failures = 0;
+
+        // Bit by bit comparison. Then, the sign of zero and NaN are compared, too.
+        // The first mismatch is reported to stderr, and counted as a failure.
+    template < typename T >
+    static void compare_bits( const char * name, const T actual[], const T expected[], unsigned int count )
+    {
+        for ( unsigned int i=0; i<count; i++ )
+        {
+            if ( memcmp( &actual[i], &expected[i], sizeof(T) ) != 0 )
+            {
+                fprintf( stderr, "FAIL : %s mismatches the reference at %u of %u words\n", name, i, count );
+                check_failures++;
+                return;
+            }
+        }
+    }
+
+        // Conversion kernels and the inline converters against the scalar reference. Bit exact.
+        // All lengths up to check_length run the vector loop and the scalar tail with the special values at every lane.
+    static void check_conversion(void)
+    {
+        static const unsigned int check_length = 67;
+        const float float_specials[] = { 
+            0.0f, -0.0f, 1.0f, -1.0f, 
+            nextafterf( 1.0f, 2.0f ), nextafterf( -1.0f, -2.0f ),     // just outside of the range
+            nextafterf( 1.0f, 0.0f ), nextafterf( -1.0f, 0.0f ),      // just inside of the range
+            32767.0f / 32768.0f, -32767.0f / 32768.0f, 
+            1e-10f, -1e-10f, 1e-40f,        // less than 1 LSB, and denormal
+            2.0f, -2.0f, 1e30f, -1e30f, 
+            INFINITY, -INFINITY, NAN, -NAN };
+        const int32_t int_specials[] = { INT32_MIN, INT32_MAX, INT32_MIN + 1, 0, 1, -1 };
+        const int16_t short_specials[] = { INT16_MIN, INT16_MAX, INT16_MIN + 1, 0, 1, -1 };
+        const unsigned int number_of_float_specials = sizeof(float_specials) / sizeof(float_specials[0]);
+        const unsigned int number_of_int_specials = sizeof(int_specials) / sizeof(int_specials[0]);
+        
+        static float frames[2 * check_length];
+        static float left[check_length];
+        static float right[check_length];
+        static int32_t q31[2 * check_length];
+        static int16_t q15[2 * check_length];
+        static float float_actual[2][2 * check_length];
+        static float float_expected[2][2 * check_length];
+        static int32_t q31_actual[2 * check_length];
+        static int32_t q31_expected[2 * check_length];
+        static int16_t q15_actual[2 * check_length];
+        static int16_t q15_expected[2 * check_length];
+        
+            // Every third word is a special value. Others are random, and saturate sometimes.
+        srand( 1 );
+        for ( unsigned int i=0; i<2*check_length; i++ )
+        {
+            bool special = ( i % 3 ) == 0;
+            
+            frames[i] = special ? float_specials[ i / 3 % number_of_float_specials ] : 3.0f * ( rand() / (float)RAND_MAX - 0.5f );
+            q31[i] = special ? int_specials[ i / 3 % number_of_int_specials ] : (int32_t)( ( (uint32_t)rand() << 16 ) ^ (uint32_t)rand() );
+            q15[i] = special ? short_specials[ i / 3 % number_of_int_specials ] : (int16_t)rand();
+        }
+        for ( unsigned int i=0; i<check_length; i++ )
+        {
+            left[i] = frames[2*i];
+            right[i] = frames[2*i+1];
+        }
+        
+        unsigned int failures = check_failures;
+        
+        for ( unsigned int count=1; count<=check_length; count++ )
+        {
+            deinterleave_to_float( q31, float_actual[0], float_actual[1], count );
+            deinterleave_to_float_reference( q31, float_expected[0], float_expected[1], count );
+            compare_bits( "deinterleave_to_float left", float_actual[0], float_expected[0], count );
+            compare_bits( "deinterleave_to_float right", float_actual[1], float_expected[1], count );
+            
+            interleave_to_int( left, right, q31_actual, count );
+            interleave_to_int_reference( left, right, q31_expected, count );
+            compare_bits( "interleave_to_int", q31_actual, q31_expected, 2 * count );
+            
+            convert_to_float( q31, float_actual[0], 2 * count );
+            convert_to_float_reference( q31, float_expected[0], 2 * count );
+            compare_bits( "convert_to_float", float_actual[0], float_expected[0], 2 * count );
+            
+            convert_to_int( frames, q31_actual, 2 * count );
+            convert_to_int_reference( frames, q31_expected, 2 * count );
+            compare_bits( "convert_to_int", q31_actual, q31_expected, 2 * count );
+            
+            deinterleave_to_float( q15, float_actual[0], float_actual[1], count );
+            deinterleave_to_float_reference( q15, float_expected[0], float_expected[1], count );
+            compare_bits( "deinterleave_to_float_q15 left", float_actual[0], float_expected[0], count );
+            compare_bits( "deinterleave_to_float_q15 right", float_actual[1], float_expected[1], count );
+            
+            interleave_to_int( left, right, q15_actual, count );
+            interleave_to_int_reference( left, right, q15_expected, count );
+            compare_bits( "interleave_to_int_q15", q15_actual, q15_expected, 2 * count );
+            
+            convert_to_float( q15, float_actual[0], 2 * count );
+            convert_to_float_reference( q15, float_expected[0], 2 * count );
+            compare_bits( "convert_to_float_q15", float_actual[0], float_expected[0], 2 * count );
+            
+            convert_to_int( frames, q15_actual, 2 * count );
+            convert_to_int_reference( frames, q15_expected, 2 * count );
+            compare_bits( "convert_to_int_q15", q15_actual, q15_expected, 2 * count );
+            
+                // Longer ones repeat the same report.
+            if ( check_failures != failures )
+                break;
+        }
+        
+            // The inline converters of the single frame and the multichannel kernels.
+        for ( unsigned int i=0; i<2*check_length; i++ )
+        {
+            float_actual[0][i] = q31_to_float( q31[i] );
+            q31_actual[i] = float_to_q31( frames[i] );
+            float_actual[1][i] = q15_to_float( q15[i] );
+            q15_actual[i] = float_to_q15( frames[i] );
+        }
+        convert_to_float_reference( q31, float_expected[0], 2 * check_length );
+        convert_to_int_reference( frames, q31_expected, 2 * check_length );
+        convert_to_float_reference( q15, float_expected[1], 2 * check_length );
+        convert_to_int_reference( frames, q15_expected, 2 * check_length );
+        compare_bits( "q31_to_float", float_actual[0], float_expected[0], 2 * check_length );
+        compare_bits( "float_to_q31", q31_actual, q31_expected, 2 * check_length );
+        compare_bits( "q15_to_float", float_actual[1], float_expected[1], 2 * check_length );
+        compare_bits( "float_to_q15", q15_actual, q15_expected, 2 * check_length );
+        
+        printf( "%s\n    { \"name\": \"conversion_check\", \"length\": %u, \"mismatches\": %u }",
+                first_result ? "" : ",", check_length, check_failures - failures );
+        first_result = false;
+    }
+
+        // Format conversion kernels. Stereo.
+    static void benchmark_conversion( unsigned int block_size )
+    {
+        static int32_t interleaved[2 * max_block_size];
+        static float left[max_block_size];
+        static float right[max_block_size];
+        static float frames[2 * max_block_size];
+
+        for ( unsigned int i=0; i<2*block_size; i++ )
+            interleaved[i] = i << 20;
+
+        measure( "deinterleave_to_float", block_size, block_size,
+                [=]{ deinterleave_to_float( interleaved, left, right, block_size ); } );
+        measure( "deinterleave_to_float_reference", block_size, block_size,
+                [=]{ deinterleave_to_float_reference( interleaved, left, right, block_size ); } );
+        measure( "interleave_to_int", block_size, block_size,
+                [=]{ interleave_to_int( left, right, interleaved, block_size ); } );
+        measure( "interleave_to_int_reference", block_size, block_size,
+                [=]{ interleave_to_int_reference( left, right, interleaved, block_size ); } );
+        measure( "convert_to_float", block_size, block_size,
+                [=]{ convert_to_float( interleaved, frames, 2 * block_size ); } );
+        measure( "convert_to_int", block_size, block_size,
+                [=]{ convert_to_int( frames, interleaved, 2 * block_size ); } );
+    }
+
+        // Format conversion kernels of the 16bit wire format. Stereo.
+    static void benchmark_short_conversion( unsigned int block_size )
+    {
+        static int16_t interleaved[2 * max_block_size];
+        static float left[max_block_size];
+        static float right[max_block_size];
+
+        for ( unsigned int i=0; i<2*block_size; i++ )
+            interleaved[i] = i << 4;
+
+        measure( "deinterleave_to_float_q15", block_size, block_size,
+                [=]{ deinterleave_to_float( interleaved, left, right, block_size ); } );
+        measure( "deinterleave_to_float_q15_reference", block_size, block_size,
+                [=]{ deinterleave_to_float_reference( interleaved, left, right, block_size ); } );
+        measure( "interleave_to_int_q15", block_size, block_size,
+                [=]{ interleave_to_int( left, right, interleaved, block_size ); } );
+        measure( "interleave_to_int_q15_reference", block_size, block_size,
+                [=]{ interleave_to_int_reference( left, right, interleaved, block_size ); } );
+    }
+
+        // Process irq path. Conversion, call back and the overhead around them.
+    static void benchmark_process( unsigned int block_size )
+    {
+            // The offline transport doesn't start the I2S in start().
+        {
+            BenchmarkFramework framework;
+            framework.set_block_size( block_size );
+            framework.set_transport( offline_transport );
+
+                // No call back. Cost of the dispatch from the I2S irq to the process irq.
+            measure( "dispatch", block_size, block_size,
+                    [&]{ framework._dispatch_block( 0 ); } );
+
+                // Per sample cost of the FIFO interrupt, including the buffer swap and the dispatch.
+            measure( "i2s_irq", block_size, 1,
+                    [&]{ framework._do_i2s_irq(); } );
+
+            framework.start( NULL, passthrough_callback );
+            measure( "process_float", block_size, block_size,
+                    [&]{ framework._process_block( 0 ); } );
+        }
+        {
+                // Overhead of the profiler.
+            BenchmarkFramework framework;
+            framework.set_block_size( block_size );
+            framework.set_transport( offline_transport );
+            framework.set_profiling( true );
+            framework.start( NULL, passthrough_callback );
+            measure( "process_float_profiled", block_size, block_size,
+                    [&]{ framework._process_block( 0 ); } );
+        }
+        {
+            BenchmarkFramework framework;
+            framework.set_block_size( block_size );
+            framework.set_transport( offline_transport );
+            framework.start( NULL, context_passthrough_callback, NULL );
+            measure( "process_float_context", block_size, block_size,
+                    [&]{ framework._process_block( 0 ); } );
+        }
+        {
+            static PassthroughProcessor processor;
+            BenchmarkFramework framework;
+            framework.set_block_size( block_size );
+            framework.set_transport( offline_transport );
+            framework.start( NULL, processor );
+            measure( "process_float_functor", block_size, block_size,
+                    [&]{ framework._process_block( 0 ); } );
+        }
+        {
+            BenchmarkFramework framework;
+            framework.set_block_size( block_size );
+            framework.set_transport( offline_transport );
+            framework.start( NULL, q31_passthrough_callback );
+            measure( "process_q31", block_size, block_size,
+                    [&]{ framework._process_block( 0 ); } );
+        }
+        {
+            BenchmarkFramework framework;
+            framework.set_block_size( block_size );
+            framework.set_transport( offline_transport );
+            framework.start( NULL, interleaved_passthrough_callback );
+            measure( "process_interleaved", block_size, block_size,
+                    [&]{ framework._process_block( 0 ); } );
+        }
+    }
+
+        // Same as process_float, with the compile time block size.
+    template < unsigned int BlockSize >
+    static void benchmark_static_process(void)
+    {
+        static BenchmarkStaticFramework< BlockSize > framework;
+
+        framework.set_transport( offline_transport );
+        framework.start( NULL, passthrough_callback );
+        measure( "process_float_static", BlockSize, BlockSize,
+                [&]{ framework._process_block( 0 ); } );
+        
+        static BenchmarkStaticFramework< BlockSize > functor_framework;
+        static PassthroughProcessor processor;
+        
+        functor_framework.set_transport( offline_transport );
+        functor_framework.start( NULL, processor );
+        measure( "process_float_static_functor", BlockSize, BlockSize,
+                [&]{ functor_framework._process_block( 0 ); } );
+    }
+
+        // process_float with the resampling. The call back runs at the internal rate.
+        // The block size is the multiple of down.
+    static void benchmark_resampling( const char * name, unsigned int up, unsigned int down, unsigned int block_size )
+    {
+        BenchmarkFramework framework;
+        framework.set_block_size( block_size );
+        framework.set_transport( offline_transport );
+        framework.set_resampling( up, down );
+        framework.start( NULL, passthrough_callback );
+        measure( name, block_size, block_size,
+                [&]{ framework._process_block( 0 ); } );
+    }
+
+        // Direct form FIR. The reference of the convolver. 
+        // history has length - 1 past samples, followed by the room for a block.
+    static void fir_reference( const float h[], unsigned int length, float history[], const float in[], float out[], unsigned int block_size )
+    {
+        memcpy( history + length - 1, in, block_size * sizeof(float) );
+        
+        for ( unsigned int n=0; n<block_size; n++ )
+        {
+            const float * x = &history[length - 1 + n];
+            float sum = 0;
+            
+            for ( unsigned int m=0; m<length; m++ )
+                sum += h[m] * x[-(int)m];
+            out[n] = sum;
+        }
+        memmove( history, history + block_size, ( length - 1 ) * sizeof(float) );
+    }
+    
+        // Partitioned convolution against the direct form FIR. The error is printed as a result, too.
+    static void benchmark_convolution( unsigned int block_size, unsigned int length, unsigned int tail_block_size )
+    {
+        static Convolver convolver;
+        float * h = new float[ length ];
+        float * history = new float[ length - 1 + block_size ];
+        float * in = new float[ block_size ];
+        float * out = new float[ block_size ];
+        float * expected = new float[ block_size ];
+        
+            // Decaying noise, like a room.
+        srand( 1 );
+        for ( unsigned int i=0; i<length; i++ )
+            h[i] = ( rand() / (float)RAND_MAX - 0.5f ) * expf( -5.0f * i / length );
+        memset( history, 0, ( length - 1 ) * sizeof(float) );
+        
+        convolver.setup( block_size, length, 1, tail_block_size );
+        convolver.set_impulse_response( h, length );
+        
+            // Longer than the response. Then, all partitions are compared.
+        float max_error = 0;
+        float max_output = 0;
+        for ( unsigned int b=0; b<2*length/block_size+2; b++ )
+        {
+            for ( unsigned int i=0; i<block_size; i++ )
+                in[i] = rand() / (float)RAND_MAX - 0.5f;
+            convolver.process( in, out );
+            fir_reference( h, length, history, in, expected, block_size );
+            
+            for ( unsigned int i=0; i<block_size; i++ )
+            {
+                max_error = fmaxf( max_error, fabsf( out[i] - expected[i] ) );
+                max_output = fmaxf( max_output, fabsf( expected[i] ) );
+            }
+        }
+        printf( "%s\n    { \"name\": \"convolver_error\", \"block_size\": %u, \"ir_length\": %u, \"tail_block_size\": %u, \"relative_error\": %.3g }",
+                first_result ? "" : ",", block_size, length, tail_block_size, max_error / max_output );
+        first_result = false;
+        
+        measure( tail_block_size ? "convolver_non_uniform" : "convolver", block_size, block_size,
+                [&]{ convolver.process( in, out ); } );
+        measure( "fir_reference", block_size, block_size,
+                [&]{ fir_reference( h, length, history, in, out, block_size ); } );
+        
+        delete [] h;
+        delete [] history;
+        delete [] in;
+        delete [] out;
+        delete [] expected;
+    }
+
+        // Hand written per sample loop of the direct form I. Sample by sample, section by section. 
+        // The reference of the biquad cascade.
+    static void biquad_reference( const biquad_coefficients c[], float state[][8], unsigned int sections, 
+                                  float left[], float right[], unsigned int length )
+    {
+        for ( unsigned int i=0; i<length; i++ )
+        {
+            float l = left[i];
+            float r = right[i];
+            
+            for ( unsigned int s=0; s<sections; s++ )
+            {
+                float * z = state[s];
+                float yl = c[s].b0 * l + c[s].b1 * z[0] + c[s].b2 * z[1] - c[s].a1 * z[2] - c[s].a2 * z[3];
+                float yr = c[s].b0 * r + c[s].b1 * z[4] + c[s].b2 * z[5] - c[s].a1 * z[6] - c[s].a2 * z[7];
+                z[1] = z[0]; z[0] = l; z[3] = z[2]; z[2] = yl;
+                z[5] = z[4]; z[4] = r; z[7] = z[6]; z[6] = yr;
+                l = yl;
+                r = yr;
+            }
+            left[i] = l;
+            right[i] = r;
+        }
+    }
+    
+        // Biquad cascade against the reference. The transposed form rounds differently from the direct form I. 
+        // Both are about 1e-4 off the exact result, with the low frequency poles of the benchmark. A wrong 
+        // coefficient or state is far over the tolerance. The error is printed as a result, too.
+    static void check_biquad( const biquad_coefficients c[], unsigned int sections, unsigned int block_size )
+    {
+        static const float tolerance = 1e-3f;
+        static float in_left[max_block_size];
+        static float in_right[max_block_size];
+        static float out_left[max_block_size];
+        static float out_right[max_block_size];
+        static float out_mono[max_block_size];
+        static float expected_left[max_block_size];
+        static float expected_right[max_block_size];
+        static float state[8][8];
+        BiquadCascade stereo;
+        BiquadCascade mono;
+        
+        stereo.set_coefficients( c, sections );
+        mono.set_coefficients( c, sections );
+        memset( state, 0, sizeof(state) );
+        
+            // Several blocks. Then, the state is carried over the blocks.
+        float max_error = 0;
+        float max_output = 0;
+        for ( int b=0; b<16; b++ )
+        {
+            for ( unsigned int i=0; i<block_size; i++ )
+            {
+                in_left[i] = expected_left[i] = rand() / (float)RAND_MAX - 0.5f;
+                in_right[i] = expected_right[i] = rand() / (float)RAND_MAX - 0.5f;
+            }
+            stereo.process( in_left, in_right, out_left, out_right, block_size );
+            mono.process( in_left, out_mono, block_size );
+            biquad_reference( c, state, sections, expected_left, expected_right, block_size );
+            
+            for ( unsigned int i=0; i<block_size; i++ )
+            {
+                max_error = fmaxf( max_error, fabsf( out_left[i] - expected_left[i] ) );
+                max_error = fmaxf( max_error, fabsf( out_right[i] - expected_right[i] ) );
+                max_error = fmaxf( max_error, fabsf( out_mono[i] - expected_left[i] ) );
+                max_output = fmaxf( max_output, fmaxf( fabsf( expected_left[i] ), fabsf( expected_right[i] ) ) );
+            }
+        }
+        printf( "%s\n    { \"name\": \"biquad_error\", \"block_size\": %u, \"sections\": %u, \"relative_error\": %.3g }",
+                first_result ? "" : ",", block_size, sections, max_error / max_output );
+        first_result = false;
+        
+            // NaN fails, too.
+        if ( !( max_error <= tolerance * max_output ) )
+        {
+            fprintf( stderr, "FAIL : biquad cascade of %u sections is off the reference by %g\n", sections, max_error / max_output );
+            check_failures++;
+        }
+    }
+    
+        // Biquad cascade of 1, 2, 4 and 8 sections.
+        // "biquad_stereo_section" counts a section of a stereo sample as a sample.
+    static void benchmark_biquad( unsigned int block_size )
+    {
+        static const char * stereo_names[] = { "biquad_stereo_1", "biquad_stereo_2", "biquad_stereo_4", "biquad_stereo_8" };
+        static const char * reference_names[] = { "biquad_reference_1", "biquad_reference_2", "biquad_reference_4", "biquad_reference_8" };
+        static float left[max_block_size];
+        static float right[max_block_size];
+        static float state[8][8];
+        biquad_coefficients c[8];
+        
+        for ( unsigned int i=0; i<block_size; i++ )
+        {
+            left[i] = rand() / (float)RAND_MAX - 0.5f;
+            right[i] = rand() / (float)RAND_MAX - 0.5f;
+        }
+        for ( int s=0; s<8; s++ )
+            c[s] = BiquadCascade::peaking( 48000, 100.0f * ( s + 1 ), 1.0f, 0.5f );
+            
+        for ( int n=0; n<4; n++ )
+        {
+            unsigned int sections = 1 << n;
+            BiquadCascade cascade;
+            
+            check_biquad( c, sections, block_size );
+            cascade.set_coefficients( c, sections );
+            measure( stereo_names[n], block_size, block_size,
+                    [&]{ cascade.process( left, right, left, right, block_size ); } );
+            if ( sections == 8 )
+                measure( "biquad_stereo_section", block_size, block_size * sections,
+                        [&]{ cascade.process( left, right, left, right, block_size ); } );
+            
+            memset( state, 0, sizeof(state) );
+            measure( reference_names[n], block_size, block_size,
+                    [&]{ biquad_reference( c, state, sections, left, right, block_size ); } );
+        }
+        
+        BiquadCascade mono;
+        mono.set_coefficients( c, 8 );
+        measure( "biquad_mono_8", block_size, block_size,
+                [&]{ mono.process( left, left, block_size ); } );
+    }
+
+#ifdef UNZEN_HOST
+        // Whole framework on the simulated I2S, with the passthrough call back.
+    static void benchmark_end_to_end( unsigned int block_size, transport_type transport, data_size_type data_size = data_size_32 )
+    {
+        BenchmarkFramework framework;
+        framework.set_block_size( block_size );
+        framework.set_transport( transport );
+        framework.set_data_size( data_size );
+
+        hal_host_set_clock( host_manual_clock );
+        framework.start( NULL, passthrough_callback );
+
+        const char * name;
+        if ( data_size == data_size_16 )
+            name = ( transport == dma_transport ) ? "end_to_end_dma_16bit" : "end_to_end_fifo_16bit";
+        else
+            name = ( transport == dma_transport ) ? "end_to_end_dma" : "end_to_end_fifo";
+        measure( name, block_size, block_size,
+                [&]{ hal_host_run( block_size ); } );
+
+        hal_host_stop();
+    }
+    
+        // Block size 1 in the FIFO transport. The fast path in the I2S irq, or the normal path through 
+        // the buffer ring and the process IRQ.
+    static void benchmark_single_frame( bool fast )
+    {
+        BenchmarkFramework framework;
+        framework.set_block_size( 1 );
+        framework.set_single_frame_path( fast );
+
+        hal_host_set_clock( host_manual_clock );
+        framework.start( NULL, passthrough_callback );
+
+        measure( fast ? "end_to_end_fifo_single_frame" : "end_to_end_fifo_normal_path", 1, 1,
+                [&]{ hal_host_run( 1 ); } );
+
+        hal_host_stop();
+    }
+    
+        // Two ports in parallel. The process IRQ of each port, or one shared process IRQ.
+        // A sample is one frame of each port.
+    static void benchmark_end_to_end_ports( unsigned int block_size, bool shared )
+    {
+        Framework::set_shared_process_irq( shared );
+        
+        BenchmarkFramework framework_a;
+        BenchmarkFramework framework_b( 1 );
+        framework_a.set_block_size( block_size );
+        framework_a.set_transport( dma_transport );
+        framework_b.set_block_size( block_size );
+        framework_b.set_transport( dma_transport );
+
+        hal_host_set_clock( host_manual_clock );
+        framework_a.start( NULL, passthrough_callback );
+        framework_b.start( NULL, passthrough_callback );
+
+        measure( shared ? "end_to_end_dma_2ports_shared" : "end_to_end_dma_2ports", block_size, 2 * block_size,
+                [&]{ hal_host_run( block_size ); } );
+
+        hal_host_stop();
+        Framework::set_shared_process_irq( false );
+    }
+    
+        // Delay from the end of a block to the start of its process, in the real time clock. 
+        // The process IRQ is a deferred call on host. The thread is woken by the condition variable.
+    static void benchmark_latency( unsigned int block_size, execution_type execution )
+    {
+        BenchmarkFramework framework;
+        framework.set_block_size( block_size );
+        framework.set_transport( dma_transport );
+        framework.set_execution( execution );
+        framework.set_profiling( true );
+
+        hal_host_set_clock( host_realtime_clock );
+        framework.start( NULL, passthrough_callback );
+            // One second at the default sample rate.
+        while ( hal_host_get_frame_count() < 48000 )
+            std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+        hal_host_stop();
+
+        profile_statistics latency;
+        double ns_per_cycle = 1e9 / Framework::get_cycle_frequency();
+        framework.get_profile( profile_latency, latency );
+
+        printf( "%s\n    { \"name\": \"%s\", \"block_size\": %u, \"latency_min_ns\": %.1f, \"latency_mean_ns\": %.1f, \"latency_max_ns\": %.1f }",
+                first_result ? "" : ",", execution == thread_execution ? "process_latency_thread" : "process_latency_irq", 
+                block_size, latency.min * ns_per_cycle, latency.mean * ns_per_cycle, latency.max * ns_per_cycle );
+        first_result = false;
+    }
+    
+        // TDM of 8 channels through the multi-channel call back. Frame major on the simulated wire. 
+    static const unsigned int tdm_channels = 8;
+    static const unsigned int tdm_frames = 2048;
+    static unsigned long tdm_source_frame;
+    static unsigned long tdm_sink_frame;
+    static int32_t tdm_sent[tdm_frames][tdm_channels];
+    
+        // Each channel has its own offset and slope. The bits are in 31 to 16. Then, the value is exact in float 
+        // and on the 16bit wire. 
+    static int32_t tdm_ramp( unsigned long frame, unsigned int channel )
+    {
+        return (int32_t)( ( channel + 1 ) << 27 ) + (int32_t)( ( frame * ( channel + 1 ) % 1024 ) << 16 );
+    }
+    
+    static void tdm_source( int32_t rx[], unsigned int length )
+    {
+        for ( unsigned int i=0; i<length; i++ )
+        {
+            rx[i] = tdm_ramp( tdm_source_frame, i % tdm_channels );
+            if ( i % tdm_channels == tdm_channels - 1 )
+                tdm_source_frame++;
+        }
+    }
+    
+    static void tdm_sink( const int32_t tx[], unsigned int length )
+    {
+        for ( unsigned int i=0; i<length && tdm_sink_frame<tdm_frames; i++ )
+        {
+            tdm_sent[tdm_sink_frame][i % tdm_channels] = tx[i];
+            if ( i % tdm_channels == tdm_channels - 1 )
+                tdm_sink_frame++;
+        }
+    }
+    
+        // Negate. Then, a pass through by mistake fails, too.
+    static void tdm_negate_callback( float * rx[], float * tx[], unsigned int channels, unsigned int block_size )
+    {
+        for ( unsigned int ch=0; ch<channels; ch++ )
+            for ( unsigned int i=0; i<block_size; i++ )
+                tx[ch][i] = -rx[ch][i];
+    }
+    
+        // Each channel of the output must be the negated ramp of the same channel, after the latency. 
+        // A swapped or shifted channel, or a wrong stride of the frame major conversion fails. 
+    template < typename FrameworkType >
+    static void check_tdm( const char * name, FrameworkType & framework )
+    {
+        tdm_source_frame = 0;
+        tdm_sink_frame = 0;
+        memset( tdm_sent, 0, sizeof(tdm_sent) );
+        hal_host_set_source( tdm_source );
+        hal_host_set_sink( tdm_sink );
+        hal_host_set_clock( host_manual_clock );
+        
+        error_type error = framework.start( NULL, tdm_negate_callback );
+        if ( error == no_error )
+            hal_host_run( tdm_frames );
+        hal_host_stop();
+        hal_host_set_source( NULL );
+        hal_host_set_sink( NULL );
+        
+            // The ramp of the first channel is never zero. So, the first non zero frame is the latency.
+        unsigned int latency = 0;
+        while ( latency < tdm_sink_frame && tdm_sent[latency][0] == 0 )
+            latency++;
+        
+        unsigned int mismatches = 0;
+        for ( unsigned int n=latency; n<tdm_sink_frame; n++ )
+            for ( unsigned int ch=0; ch<tdm_channels; ch++ )
+                if ( tdm_sent[n][ch] != -tdm_ramp( n - latency, ch ) )
+                    mismatches++;
+        
+        printf( "%s\n    { \"name\": \"tdm_check\", \"framework\": \"%s\", \"channels\": %u, \"latency\": %u, \"frames\": %u, \"mismatches\": %u }",
+                first_result ? "" : ",", name, tdm_channels, latency, (unsigned int)tdm_sink_frame - latency, mismatches );
+        first_result = false;
+        
+            // At least half of the frames must be compared. 
+        if ( error != no_error || mismatches || tdm_sink_frame < latency + tdm_frames / 2 )
+        {
+            fprintf( stderr, "FAIL : TDM %s, error %d, %u mismatches in %u frames\n", 
+                     name, (int)error, mismatches, (unsigned int)tdm_sink_frame - latency );
+            check_failures++;
+        }
+    }
+    
+        // Framework::_process_multichannel_block() in both transports and data sizes, and the one of StaticFramework. 
+    static void check_tdm(void)
+    {
+        static const transport_type transports[] = { dma_transport, fifo_transport };
+        static const data_size_type data_sizes[] = { data_size_32, data_size_16 };
+        static const char * names[2][2] = { { "dma", "dma_16bit" }, { "fifo", "fifo_16bit" } };
+        
+        for ( int t=0; t<2; t++ )
+        {
+            for ( int d=0; d<2; d++ )
+            {
+                Framework framework;
+                framework.set_channel_count( tdm_channels );
+                framework.set_block_size( 16 );
+                framework.set_transport( transports[t] );
+                framework.set_data_size( data_sizes[d] );
+                check_tdm( names[t][d], framework );
+            }
+        }
+        
+        StaticFramework< 16, tdm_channels > static_dma;
+        static_dma.set_transport( dma_transport );
+        check_tdm( "static_dma", static_dma );
+        
+        StaticFramework< 16, tdm_channels > static_fifo;
+        static_fifo.set_transport( fifo_transport );
+        check_tdm( "static_fifo", static_fifo );
+    }
+#endif
+
+        // Returns EXIT_FAILURE when any check fails.
+    static int run_benchmarks(void)
+    {
+#ifdef UNZEN_HOST
+        const char * platform = "host";
+#else
+        const char * platform = "target";
+
+            // Start the cycle counter.
+        CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+        DWT->CYCCNT = 0;
+        DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+#endif
+
+        printf( "{\n  \"platform\": \"%s\",\n  \"kernel\": \"%s\",\n  \"cycle_counter\": \"%s\",\n  \"results\": [",
+                platform, convert_kernel_name(), cycle_counter_name() );
+
+        check_conversion();
+#ifdef UNZEN_HOST
+        check_tdm();
+#endif
+        
+        for ( unsigned int i=0; i<number_of_block_sizes; i++ )
+        {
+            benchmark_conversion( block_sizes[i] );
+            benchmark_short_conversion( block_sizes[i] );
+            benchmark_process( block_sizes[i] );
+#ifdef UNZEN_HOST
+            benchmark_end_to_end( block_sizes[i], fifo_transport );
+            benchmark_end_to_end( block_sizes[i], dma_transport );
+            benchmark_end_to_end( block_sizes[i], fifo_transport, data_size_16 );
+            benchmark_end_to_end( block_sizes[i], dma_transport, data_size_16 );
+            benchmark_end_to_end_ports( block_sizes[i], false );
+            benchmark_end_to_end_ports( block_sizes[i], true );
+#endif
+        }
+        
+#ifdef UNZEN_HOST
+        benchmark_single_frame( true );
+        benchmark_single_frame( false );
+        benchmark_latency( 64, irq_execution );
+        benchmark_latency( 64, thread_execution );
+#endif
+
+        benchmark_static_process<1>();
+        benchmark_static_process<2>();
+        benchmark_static_process<4>();
+        benchmark_static_process<8>();
+        benchmark_static_process<16>();
+        benchmark_static_process<32>();
+        benchmark_static_process<64>();
+        benchmark_static_process<128>();
+        benchmark_static_process<256>();
+        
+        benchmark_resampling( "process_float_resample_1_2", 1, 2, 128 );
+        benchmark_resampling( "process_float_resample_1_3", 1, 3, 96 );
+        benchmark_resampling( "process_float_resample_160_147", 160, 147, 147 );
+        
+        benchmark_biquad( 64 );
+        
+        benchmark_convolution( 64, 1024, 0 );
+        benchmark_convolution( 64, 4096, 0 );
+        benchmark_convolution( 16, 4096, 0 );
+        benchmark_convolution( 16, 4096, 256 );
+
+        printf( "\n  ]\n}\n" );
+        
+        if ( check_failures )
+        {
+            fprintf( stderr, "FAIL : %u checks failed\n", check_failures );
+            return EXIT_FAILURE;
+        }
+        return EXIT_SUCCESS;
+    }
+}
+
+int main()
+{
+    return unzen::run_benchmarks();
+}
+
+#endif  // UNZEN_BENCHMARK
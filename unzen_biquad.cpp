@@ -0,0 +1,303 @@
+#include <math.h>
+#include <string.h>
+
+#include "unzen_biquad.h"
+#include "unzen_convert.h"
+
+#if defined(UNZEN_CONVERT_AVX2) || defined(UNZEN_CONVERT_SSE2)
+#include <emmintrin.h>
+#elif defined(UNZEN_CONVERT_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace unzen
+{
+        // M_PI is not in the strict C++ mode of some tool chains.
+    static const double pi = 3.14159265358979323846;
+
+        // Transposed direct form II of a section. Both channels.
+    static void filter_stereo( const biquad_coefficients & c, float state[4],
+                               const float in_left[], const float in_right[], float out_left[], float out_right[], unsigned int length )
+    {
+#if defined(UNZEN_CONVERT_AVX2) || defined(UNZEN_CONVERT_SSE2)
+            // Left and right in the lane 0 and 1. A wider vector has no use, because of the recursion.
+        const __m128 b0 = _mm_set1_ps( c.b0 );
+        const __m128 b1 = _mm_set1_ps( c.b1 );
+        const __m128 b2 = _mm_set1_ps( c.b2 );
+        const __m128 a1 = _mm_set1_ps( c.a1 );
+        const __m128 a2 = _mm_set1_ps( c.a2 );
+        __m128 z1 = _mm_setr_ps( state[0], state[1], 0, 0 );
+        __m128 z2 = _mm_setr_ps( state[2], state[3], 0, 0 );
+
+        for ( unsigned int i=0; i<length; i++ )
+        {
+            __m128 x = _mm_unpacklo_ps( _mm_load_ss( &in_left[i] ), _mm_load_ss( &in_right[i] ) );
+            __m128 y = _mm_add_ps( _mm_mul_ps( b0, x ), z1 );
+            z1 = _mm_add_ps( _mm_sub_ps( _mm_mul_ps( b1, x ), _mm_mul_ps( a1, y ) ), z2 );
+            z2 = _mm_sub_ps( _mm_mul_ps( b2, x ), _mm_mul_ps( a2, y ) );
+            _mm_store_ss( &out_left[i], y );
+            _mm_store_ss( &out_right[i], _mm_shuffle_ps( y, y, _MM_SHUFFLE( 1, 1, 1, 1 ) ) );
+        }
+
+        float z[4];
+        _mm_storeu_ps( z, _mm_unpacklo_ps( z1, z2 ) );     // z1 L, z2 L, z1 R, z2 R
+        state[0] = z[0];
+        state[1] = z[2];
+        state[2] = z[1];
+        state[3] = z[3];
+#elif defined(UNZEN_CONVERT_NEON)
+            // Left and right in a 64bit register.
+        float32x2_t z1 = vld1_f32( &state[0] );
+        float32x2_t z2 = vld1_f32( &state[2] );
+
+        for ( unsigned int i=0; i<length; i++ )
+        {
+            float32x2_t x = vset_lane_f32( in_right[i], vdup_n_f32( in_left[i] ), 1 );
+            float32x2_t y = vmla_n_f32( z1, x, c.b0 );
+            z1 = vmls_n_f32( vmla_n_f32( z2, x, c.b1 ), y, c.a1 );
+            z2 = vmls_n_f32( vmul_n_f32( x, c.b2 ), y, c.a2 );
+            out_left[i] = vget_lane_f32( y, 0 );
+            out_right[i] = vget_lane_f32( y, 1 );
+        }
+
+        vst1_f32( &state[0], z1 );
+        vst1_f32( &state[2], z2 );
+#else
+            // Two independent chains. The FPU of Cortex-M7 runs one while the other waits for the result.
+        float b0 = c.b0, b1 = c.b1, b2 = c.b2, a1 = c.a1, a2 = c.a2;
+        float z1l = state[0], z1r = state[1], z2l = state[2], z2r = state[3];
+
+        for ( unsigned int i=0; i<length; i++ )
+        {
+            float xl = in_left[i];
+            float xr = in_right[i];
+            float yl = b0 * xl + z1l;
+            float yr = b0 * xr + z1r;
+            z1l = b1 * xl - a1 * yl + z2l;
+            z1r = b1 * xr - a1 * yr + z2r;
+            z2l = b2 * xl - a2 * yl;
+            z2r = b2 * xr - a2 * yr;
+            out_left[i] = yl;
+            out_right[i] = yr;
+        }
+
+        state[0] = z1l;
+        state[1] = z1r;
+        state[2] = z2l;
+        state[3] = z2r;
+#endif
+    }
+
+        // Same for one channel. The state of the left channel.
+    static void filter_mono( const biquad_coefficients & c, float state[4], const float in[], float out[], unsigned int length )
+    {
+        float b0 = c.b0, b1 = c.b1, b2 = c.b2, a1 = c.a1, a2 = c.a2;
+        float z1 = state[0], z2 = state[2];
+
+        for ( unsigned int i=0; i<length; i++ )
+        {
+            float x = in[i];
+            float y = b0 * x + z1;
+            z1 = b1 * x - a1 * y + z2;
+            z2 = b2 * x - a2 * y;
+            out[i] = y;
+        }
+
+        state[0] = z1;
+        state[2] = z2;
+    }
+
+    BiquadCascade::BiquadCascade(void) : _active_bank( 0 ), _requested_bank( 0 ), _running( false )
+    {
+            // Pass through sections. Then, set_section() can extend the cascade.
+        for ( int b=0; b<2; b++ )
+        {
+            _bank[b].sections = 0;
+            for ( int s=0; s<max_sections; s++ )
+            {
+                biquad_coefficients & c = _bank[b].coefficients[s];
+                c.b0 = 1;
+                c.b1 = c.b2 = c.a1 = c.a2 = 0;
+            }
+        }
+        reset();
+    }
+
+    void BiquadCascade::reset(void)
+    {
+        memset( _state, 0, sizeof(_state) );
+    }
+
+    BiquadCascade::bank_type * BiquadCascade::_prepare_bank(void)
+    {
+            // The interrupt has not taken the last one yet.
+        int active = _active_bank.load( std::memory_order_acquire );
+        if ( _requested_bank.load( std::memory_order_relaxed ) != active )
+            return NULL;
+
+            // Start from the current one.
+        _bank[1 - active] = _bank[active];
+        return &_bank[1 - active];
+    }
+
+    void BiquadCascade::_publish_bank( bank_type * bank )
+    {
+        int index = (int)( bank - _bank );
+
+            // Request first, then check _running. If the process has not started at the check, its first block
+            // takes this request anyway. Then, taking it here too is safe. Both sides are seq_cst for this order.
+        _requested_bank.store( index );
+        if ( ! _running.load() )
+            _active_bank.store( index, std::memory_order_release );
+    }
+
+    error_type BiquadCascade::set_coefficients( const biquad_coefficients coefficients[], unsigned int sections )
+    {
+        if ( sections > (unsigned int)max_sections )
+            return memory_size_error;
+
+        bank_type * bank = _prepare_bank();
+        if ( bank == NULL )
+            return busy_error;
+
+        for ( unsigned int s=0; s<sections; s++ )
+            bank->coefficients[s] = coefficients[s];
+        bank->sections = sections;
+
+        _publish_bank( bank );
+        return no_error;
+    }
+
+    error_type BiquadCascade::set_section( unsigned int section, const biquad_coefficients & coefficients )
+    {
+        if ( section >= (unsigned int)max_sections )
+            return memory_size_error;
+
+        bank_type * bank = _prepare_bank();
+        if ( bank == NULL )
+            return busy_error;
+
+        bank->coefficients[section] = coefficients;
+        if ( bank->sections <= section )
+            bank->sections = section + 1;
+
+        _publish_bank( bank );
+        return no_error;
+    }
+
+    void BiquadCascade::process( const float in_left[], const float in_right[], float out_left[], float out_right[], unsigned int length )
+    {
+            // Tell main() before taking the request. See _publish_bank().
+        _running.store( true );
+        _active_bank.store( _requested_bank.load(), std::memory_order_release );
+
+        const bank_type & bank = _bank[ _active_bank.load( std::memory_order_relaxed ) ];
+
+        if ( bank.sections == 0 )
+        {
+            if ( out_left != in_left )
+                memmove( out_left, in_left, length * sizeof(float) );
+            if ( out_right != in_right )
+                memmove( out_right, in_right, length * sizeof(float) );
+            return;
+        }
+
+            // The first section reads the input. Others work in place on the output.
+        filter_stereo( bank.coefficients[0], _state[0], in_left, in_right, out_left, out_right, length );
+        for ( unsigned int s=1; s<bank.sections; s++ )
+            filter_stereo( bank.coefficients[s], _state[s], out_left, out_right, out_left, out_right, length );
+    }
+
+    void BiquadCascade::process( const float in[], float out[], unsigned int length )
+    {
+            // Tell main() before taking the request. See _publish_bank().
+        _running.store( true );
+        _active_bank.store( _requested_bank.load(), std::memory_order_release );
+
+        const bank_type & bank = _bank[ _active_bank.load( std::memory_order_relaxed ) ];
+
+        if ( bank.sections == 0 )
+        {
+            if ( out != in )
+                memmove( out, in, length * sizeof(float) );
+            return;
+        }
+
+        filter_mono( bank.coefficients[0], _state[0], in, out, length );
+        for ( unsigned int s=1; s<bank.sections; s++ )
+            filter_mono( bank.coefficients[s], _state[s], out, out, length );
+    }
+
+        // Normalize by a0.
+    static biquad_coefficients normalize( double b0, double b1, double b2, double a0, double a1, double a2 )
+    {
+        biquad_coefficients c;
+
+        c.b0 = (float)( b0 / a0 );
+        c.b1 = (float)( b1 / a0 );
+        c.b2 = (float)( b2 / a0 );
+        c.a1 = (float)( a1 / a0 );
+        c.a2 = (float)( a2 / a0 );
+        return c;
+    }
+
+    biquad_coefficients BiquadCascade::low_pass( float fs, float f0, float q )
+    {
+        double w0 = 2 * pi * f0 / fs;
+        double alpha = sin( w0 ) / ( 2 * q );
+        double cw = cos( w0 );
+
+        return normalize( ( 1 - cw ) / 2, 1 - cw, ( 1 - cw ) / 2, 1 + alpha, -2 * cw, 1 - alpha );
+    }
+
+    biquad_coefficients BiquadCascade::high_pass( float fs, float f0, float q )
+    {
+        double w0 = 2 * pi * f0 / fs;
+        double alpha = sin( w0 ) / ( 2 * q );
+        double cw = cos( w0 );
+
+        return normalize( ( 1 + cw ) / 2, -( 1 + cw ), ( 1 + cw ) / 2, 1 + alpha, -2 * cw, 1 - alpha );
+    }
+
+    biquad_coefficients BiquadCascade::peaking( float fs, float f0, float q, float gain )
+    {
+        double a = pow( 10.0, gain / 40.0 );
+        double w0 = 2 * pi * f0 / fs;
+        double alpha = sin( w0 ) / ( 2 * q );
+        double cw = cos( w0 );
+
+        return normalize( 1 + alpha * a, -2 * cw, 1 - alpha * a, 1 + alpha / a, -2 * cw, 1 - alpha / a );
+    }
+
+    biquad_coefficients BiquadCascade::low_shelf( float fs, float f0, float q, float gain )
+    {
+        double a = pow( 10.0, gain / 40.0 );
+        double w0 = 2 * pi * f0 / fs;
+        double alpha = sin( w0 ) / ( 2 * q );
+        double cw = cos( w0 );
+        double sa = 2 * sqrt( a ) * alpha;
+
+        return normalize( a * ( ( a + 1 ) - ( a - 1 ) * cw + sa ),
+                          2 * a * ( ( a - 1 ) - ( a + 1 ) * cw ),
+                          a * ( ( a + 1 ) - ( a - 1 ) * cw - sa ),
+                          ( a + 1 ) + ( a - 1 ) * cw + sa,
+                          -2 * ( ( a - 1 ) + ( a + 1 ) * cw ),
+                          ( a + 1 ) + ( a - 1 ) * cw - sa );
+    }
+
+    biquad_coefficients BiquadCascade::high_shelf( float fs, float f0, float q, float gain )
+    {
+        double a = pow( 10.0, gain / 40.0 );
+        double w0 = 2 * pi * f0 / fs;
+        double alpha = sin( w0 ) / ( 2 * q );
+        double cw = cos( w0 );
+        double sa = 2 * sqrt( a ) * alpha;
+
+        return normalize( a * ( ( a + 1 ) + ( a - 1 ) * cw + sa ),
+                          -2 * a * ( ( a - 1 ) + ( a + 1 ) * cw ),
+                          a * ( ( a + 1 ) + ( a - 1 ) * cw - sa ),
+                          ( a + 1 ) - ( a - 1 ) * cw + sa,
+                          2 * ( ( a - 1 ) - ( a + 1 ) * cw ),
+                          ( a + 1 ) - ( a - 1 ) * cw - sa );
+    }
+}
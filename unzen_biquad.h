@@ -0,0 +1,196 @@
+/**
+* \brief header file for the biquad filter cascade of the unzen audio frame work
+*/
+
+#ifndef _unzen_biquad_h_
+#define _unzen_biquad_h_
+
+#include <atomic>
+
+#include "unzen.h"
+
+namespace unzen
+{
+    /**
+      \brief coefficients of a biquad section. Normalized by a0.
+      \details
+      H(z) = ( b0 + b1 z^-1 + b2 z^-2 ) / ( 1 + a1 z^-1 + a2 z^-2 )
+    */
+    struct biquad_coefficients
+    {
+        float b0;
+        float b1;
+        float b2;
+        float a1;
+        float a2;
+    };
+
+    /**
+      \brief cascade of the biquad filters, for the block processing.
+      \details
+      Each section is the transposed direct form II. The block is filtered section by section. Then, the
+      coefficients and the state of a section stay in the registers during the block.
+
+      The left and right channels are filtered together, with the same coefficients. They are in the two
+      lanes of the SIMD register on NEON and SSE2. On Cortex-M7, they are two independent chains of the
+      FPU. So, stereo costs little more than mono.
+
+      The coefficients can be changed from main() while the interrupt is running \ref process(). The new
+      ones are written in the other bank, and taken at the next block. The state of the filters is kept.
+
+      example :
+      \code
+unzen::BiquadCascade eq;
+
+int main()
+{
+    unzen::biquad_coefficients sections[2];
+
+    sections[0] = unzen::BiquadCascade::low_shelf( 48000, 100, 0.707f, 3.0f );
+    sections[1] = unzen::BiquadCascade::peaking( 48000, 2500, 1.0f, -4.0f );
+    eq.set_coefficients( sections, 2 );
+    ...
+}
+
+void process_callback( float rx_left[], float rx_right[], float tx_left[], float tx_right[], unsigned int block_size )
+{
+    eq.process( rx_left, rx_right, tx_left, tx_right, block_size );
+}
+      \endcode
+    */
+    class BiquadCascade
+    {
+    public:
+            /// maximum number of the sections.
+        static const int max_sections = 16;
+
+            /**
+                \constructor
+                \details
+                No section. \ref process() copies the input to the output.
+            */
+        BiquadCascade(void);
+
+            /**
+                \brief set all sections.
+                \param coefficients array of the coefficients of each section.
+                \param sections number of sections.
+                \returns show the error status
+                \details
+                Can be called from main() while the interrupt is running \ref process(). If the last change is
+                not taken by \ref process() yet, \ref busy_error is returned. If sections is more than
+                \ref max_sections, \ref memory_size_error is returned.
+            */
+        error_type set_coefficients( const biquad_coefficients coefficients[], unsigned int sections );
+
+            /**
+                \brief set a section.
+                \param section index of the section.
+                \param coefficients the coefficients.
+                \returns show the error status
+                \details
+                Other sections are not changed. If the index is beyond the current sections, the cascade
+                is extended. The sections between are pass through. Same rule with \ref set_coefficients()
+                for main().
+            */
+        error_type set_section( unsigned int section, const biquad_coefficients & coefficients );
+
+            /**
+                \brief filter a block of stereo.
+                \param in_left input of the left channel.
+                \param in_right input of the right channel.
+                \param out_left output of the left channel. Can be same with in_left.
+                \param out_right output of the right channel. Can be same with in_right.
+                \param length number of samples.
+            */
+        void process( const float in_left[], const float in_right[], float out_left[], float out_right[], unsigned int length );
+
+            /**
+                \brief filter a block of mono.
+                \param in input.
+                \param out output. Can be same with in.
+                \param length number of samples.
+                \details
+                Uses the state of the left channel.
+            */
+        void process( const float in[], float out[], unsigned int length );
+
+            /**
+                \brief clear the state of the filters.
+                \details
+                Don't call while \ref process() is running.
+            */
+        void reset(void);
+
+            /**
+                \brief design a low pass filter.
+                \param fs sample rate [Hz].
+                \param f0 cut off frequency [Hz].
+                \param q Q. 0.707 for Butterworth.
+                \returns the coefficients.
+                \details
+                The design functions follow the Audio EQ Cookbook by R. Bristow-Johnson.
+            */
+        static biquad_coefficients low_pass( float fs, float f0, float q );
+
+            /**
+                \brief design a high pass filter.
+                \param fs sample rate [Hz].
+                \param f0 cut off frequency [Hz].
+                \param q Q. 0.707 for Butterworth.
+                \returns the coefficients.
+            */
+        static biquad_coefficients high_pass( float fs, float f0, float q );
+
+            /**
+                \brief design a peaking EQ.
+                \param fs sample rate [Hz].
+                \param f0 center frequency [Hz].
+                \param q Q.
+                \param gain gain at f0 [dB].
+                \returns the coefficients.
+            */
+        static biquad_coefficients peaking( float fs, float f0, float q, float gain );
+
+            /**
+                \brief design a low shelf EQ.
+                \param fs sample rate [Hz].
+                \param f0 mid point frequency [Hz].
+                \param q Q. 0.707 for the steepest slope without the overshoot.
+                \param gain gain of the shelf [dB].
+                \returns the coefficients.
+            */
+        static biquad_coefficients low_shelf( float fs, float f0, float q, float gain );
+
+            /**
+                \brief design a high shelf EQ.
+                \param fs sample rate [Hz].
+                \param f0 mid point frequency [Hz].
+                \param q Q. 0.707 for the steepest slope without the overshoot.
+                \param gain gain of the shelf [dB].
+                \returns the coefficients.
+            */
+        static biquad_coefficients high_shelf( float fs, float f0, float q, float gain );
+
+    private:
+        struct bank_type
+        {
+            unsigned int sections;
+            biquad_coefficients coefficients[max_sections];
+        };
+
+            // Two banks. The interrupt uses _active_bank. main() writes the other one.
+        bank_type _bank[2];
+        std::atomic<int> _active_bank;
+        std::atomic<int> _requested_bank;
+        std::atomic<bool> _running;
+
+            // z1 left, z1 right, z2 left, z2 right of each section.
+        float _state[max_sections][4];
+
+        bank_type * _prepare_bank(void);
+        void _publish_bank( bank_type * bank );
+    };
+}
+
+#endif
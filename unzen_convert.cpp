@@ -0,0 +1,690 @@
+#include "unzen_convert.h"
+
+#if defined(UNZEN_CONVERT_AVX2)
+#include <immintrin.h>
+#elif defined(UNZEN_CONVERT_SSE2)
+#include <emmintrin.h>
+#elif defined(UNZEN_CONVERT_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace unzen
+{
+        // Scale factors between Q31 and float.
+        // Multiplying the power of 2 is exact. Then, it is same as the division by -(float)INT_MIN.
+    static const float int_to_float_scale = 1.0f / 2147483648.0f;
+    static const float float_to_int_scale = 2147483648.0f;
+    
+        // Same for Q15. 
+    static const float short_to_float_scale = 1.0f / 32768.0f;
+    static const float float_to_short_scale = 32768.0f;
+
+        // Convert a scaled float to int with saturation. NaN is 0, same as the VCVT of ARM.
+    static inline int32_t saturate_to_int( float value )
+    {
+        if ( value != value )
+            return 0;
+        else if ( value >= float_to_int_scale )
+            return INT_MAX;
+        else if ( value <= -float_to_int_scale )
+            return INT_MIN;
+        else
+            return (int)value;     // round toward zero
+    }
+
+        // Convert a scaled float to int16_t with saturation. NaN is 0.
+    static inline int16_t saturate_to_short( float value )
+    {
+        if ( value != value )
+            return 0;
+        else if ( value >= float_to_short_scale )
+            return SHRT_MAX;
+        else if ( value <= -float_to_short_scale )
+            return SHRT_MIN;
+        else
+            return (int16_t)(int)value;     // round toward zero
+    }
+
+    void deinterleave_to_float_reference( const int32_t src[], float left[], float right[], unsigned int count )
+    {
+        for ( unsigned int i=0; i<count; i++ )
+        {
+            left[i]  = src[2*i]   * int_to_float_scale;
+            right[i] = src[2*i+1] * int_to_float_scale;
+        }
+    }
+
+    void interleave_to_int_reference( const float left[], const float right[], int32_t dst[], unsigned int count )
+    {
+        for ( unsigned int i=0; i<count; i++ )
+        {
+            dst[2*i]   = saturate_to_int( left[i]  * float_to_int_scale );
+            dst[2*i+1] = saturate_to_int( right[i] * float_to_int_scale );
+        }
+    }
+
+    void convert_to_float_reference( const int32_t src[], float dst[], unsigned int count )
+    {
+        for ( unsigned int i=0; i<count; i++ )
+            dst[i] = src[i] * int_to_float_scale;
+    }
+
+    void convert_to_int_reference( const float src[], int32_t dst[], unsigned int count )
+    {
+        for ( unsigned int i=0; i<count; i++ )
+            dst[i] = saturate_to_int( src[i] * float_to_int_scale );
+    }
+
+    void deinterleave_to_float_reference( const int16_t src[], float left[], float right[], unsigned int count )
+    {
+        for ( unsigned int i=0; i<count; i++ )
+        {
+            left[i]  = src[2*i]   * short_to_float_scale;
+            right[i] = src[2*i+1] * short_to_float_scale;
+        }
+    }
+
+    void interleave_to_int_reference( const float left[], const float right[], int16_t dst[], unsigned int count )
+    {
+        for ( unsigned int i=0; i<count; i++ )
+        {
+            dst[2*i]   = saturate_to_short( left[i]  * float_to_short_scale );
+            dst[2*i+1] = saturate_to_short( right[i] * float_to_short_scale );
+        }
+    }
+
+    void convert_to_float_reference( const int16_t src[], float dst[], unsigned int count )
+    {
+        for ( unsigned int i=0; i<count; i++ )
+            dst[i] = src[i] * short_to_float_scale;
+    }
+
+    void convert_to_int_reference( const float src[], int16_t dst[], unsigned int count )
+    {
+        for ( unsigned int i=0; i<count; i++ )
+            dst[i] = saturate_to_short( src[i] * float_to_short_scale );
+    }
+
+#if defined(UNZEN_CONVERT_AVX2)
+
+    void deinterleave_to_float( const int32_t src[], float left[], float right[], unsigned int count )
+    {
+        const __m256 scale = _mm256_set1_ps( int_to_float_scale );
+        unsigned int i = 0;
+
+            // 8 stereo samples per iteration
+        for ( ; i+8 <= count; i+=8 )
+        {
+            __m256 a = _mm256_mul_ps( _mm256_cvtepi32_ps( _mm256_loadu_si256( (const __m256i *)&src[2*i]   ) ), scale );  // L0R0..L3R3
+            __m256 b = _mm256_mul_ps( _mm256_cvtepi32_ps( _mm256_loadu_si256( (const __m256i *)&src[2*i+8] ) ), scale );  // L4R4..L7R7
+                // shuffle works in 128bit lane. Then, fix the order of 64bit pairs.
+            __m256 l = _mm256_shuffle_ps( a, b, _MM_SHUFFLE( 2, 0, 2, 0 ) );    // L0L1L4L5 L2L3L6L7
+            __m256 r = _mm256_shuffle_ps( a, b, _MM_SHUFFLE( 3, 1, 3, 1 ) );
+            l = _mm256_castpd_ps( _mm256_permute4x64_pd( _mm256_castps_pd( l ), _MM_SHUFFLE( 3, 1, 2, 0 ) ) );
+            r = _mm256_castpd_ps( _mm256_permute4x64_pd( _mm256_castps_pd( r ), _MM_SHUFFLE( 3, 1, 2, 0 ) ) );
+            _mm256_storeu_ps( &left[i], l );
+            _mm256_storeu_ps( &right[i], r );
+        }
+        deinterleave_to_float_reference( &src[2*i], &left[i], &right[i], count - i );
+    }
+
+        // cvttps returns INT_MIN for the positive overflow. Flip it to INT_MAX.
+        // NaN is cleared to +0 beforehand. Then, it is 0 as saturate_to_int().
+    static inline __m256i saturate_to_int8( __m256 value )
+    {
+        const __m256 limit = _mm256_set1_ps( float_to_int_scale );
+        value = _mm256_and_ps( value, _mm256_cmp_ps( value, value, _CMP_ORD_Q ) );
+        __m256i overflow = _mm256_castps_si256( _mm256_cmp_ps( value, limit, _CMP_GE_OQ ) );
+        return _mm256_xor_si256( _mm256_cvttps_epi32( value ), overflow );
+    }
+
+    void interleave_to_int( const float left[], const float right[], int32_t dst[], unsigned int count )
+    {
+        const __m256 scale = _mm256_set1_ps( float_to_int_scale );
+        unsigned int i = 0;
+
+            // 8 stereo samples per iteration
+        for ( ; i+8 <= count; i+=8 )
+        {
+            __m256i l = saturate_to_int8( _mm256_mul_ps( _mm256_loadu_ps( &left[i] ), scale ) );
+            __m256i r = saturate_to_int8( _mm256_mul_ps( _mm256_loadu_ps( &right[i] ), scale ) );
+            __m256i lo = _mm256_unpacklo_epi32( l, r );     // L0R0L1R1 L4R4L5R5
+            __m256i hi = _mm256_unpackhi_epi32( l, r );     // L2R2L3R3 L6R6L7R7
+            _mm256_storeu_si256( (__m256i *)&dst[2*i],   _mm256_permute2x128_si256( lo, hi, 0x20 ) );
+            _mm256_storeu_si256( (__m256i *)&dst[2*i+8], _mm256_permute2x128_si256( lo, hi, 0x31 ) );
+        }
+        interleave_to_int_reference( &left[i], &right[i], &dst[2*i], count - i );
+    }
+
+    void convert_to_float( const int32_t src[], float dst[], unsigned int count )
+    {
+        const __m256 scale = _mm256_set1_ps( int_to_float_scale );
+        unsigned int i = 0;
+
+            // 8 words per iteration. No shuffle.
+        for ( ; i+8 <= count; i+=8 )
+            _mm256_storeu_ps( &dst[i], _mm256_mul_ps( _mm256_cvtepi32_ps( _mm256_loadu_si256( (const __m256i *)&src[i] ) ), scale ) );
+        convert_to_float_reference( &src[i], &dst[i], count - i );
+    }
+
+    void convert_to_int( const float src[], int32_t dst[], unsigned int count )
+    {
+        const __m256 scale = _mm256_set1_ps( float_to_int_scale );
+        unsigned int i = 0;
+
+        for ( ; i+8 <= count; i+=8 )
+            _mm256_storeu_si256( (__m256i *)&dst[i], saturate_to_int8( _mm256_mul_ps( _mm256_loadu_ps( &src[i] ), scale ) ) );
+        convert_to_int_reference( &src[i], &dst[i], count - i );
+    }
+
+    void deinterleave_to_float( const int16_t src[], float left[], float right[], unsigned int count )
+    {
+        const __m256 scale = _mm256_set1_ps( short_to_float_scale );
+        unsigned int i = 0;
+
+            // 8 stereo samples per iteration. Each 32bit lane has a LR pair. No shuffle.
+        for ( ; i+8 <= count; i+=8 )
+        {
+            __m256i lr = _mm256_loadu_si256( (const __m256i *)&src[2*i] );
+            __m256i l = _mm256_srai_epi32( _mm256_slli_epi32( lr, 16 ), 16 );
+            __m256i r = _mm256_srai_epi32( lr, 16 );
+            _mm256_storeu_ps( &left[i],  _mm256_mul_ps( _mm256_cvtepi32_ps( l ), scale ) );
+            _mm256_storeu_ps( &right[i], _mm256_mul_ps( _mm256_cvtepi32_ps( r ), scale ) );
+        }
+        deinterleave_to_float_reference( &src[2*i], &left[i], &right[i], count - i );
+    }
+
+        // Clamp before cvttps. Then, the result is in the 16bit range. Same as saturate_to_short().
+        // max_ps returns the second operand for NaN. So, clear NaN to +0 first.
+    static inline __m256i saturate_to_short8( __m256 value )
+    {
+        value = _mm256_and_ps( value, _mm256_cmp_ps( value, value, _CMP_ORD_Q ) );
+        value = _mm256_min_ps( _mm256_max_ps( value, _mm256_set1_ps( -32768.0f ) ), _mm256_set1_ps( 32767.0f ) );
+        return _mm256_cvttps_epi32( value );
+    }
+
+    void interleave_to_int( const float left[], const float right[], int16_t dst[], unsigned int count )
+    {
+        const __m256 scale = _mm256_set1_ps( float_to_short_scale );
+        const __m256i mask = _mm256_set1_epi32( 0xFFFF );
+        unsigned int i = 0;
+
+            // 8 stereo samples per iteration. Merge L and R into each 32bit lane.
+        for ( ; i+8 <= count; i+=8 )
+        {
+            __m256i l = saturate_to_short8( _mm256_mul_ps( _mm256_loadu_ps( &left[i] ), scale ) );
+            __m256i r = saturate_to_short8( _mm256_mul_ps( _mm256_loadu_ps( &right[i] ), scale ) );
+            _mm256_storeu_si256( (__m256i *)&dst[2*i], _mm256_or_si256( _mm256_and_si256( l, mask ), _mm256_slli_epi32( r, 16 ) ) );
+        }
+        interleave_to_int_reference( &left[i], &right[i], &dst[2*i], count - i );
+    }
+
+    void convert_to_float( const int16_t src[], float dst[], unsigned int count )
+    {
+        const __m256 scale = _mm256_set1_ps( short_to_float_scale );
+        unsigned int i = 0;
+
+            // 8 samples per iteration. Sign extension to 32bit.
+        for ( ; i+8 <= count; i+=8 )
+        {
+            __m256i value = _mm256_cvtepi16_epi32( _mm_loadu_si128( (const __m128i *)&src[i] ) );
+            _mm256_storeu_ps( &dst[i], _mm256_mul_ps( _mm256_cvtepi32_ps( value ), scale ) );
+        }
+        convert_to_float_reference( &src[i], &dst[i], count - i );
+    }
+
+    void convert_to_int( const float src[], int16_t dst[], unsigned int count )
+    {
+        const __m256 scale = _mm256_set1_ps( float_to_short_scale );
+        unsigned int i = 0;
+
+        for ( ; i+8 <= count; i+=8 )
+        {
+            __m256i value = saturate_to_short8( _mm256_mul_ps( _mm256_loadu_ps( &src[i] ), scale ) );
+            _mm_storeu_si128( (__m128i *)&dst[i], _mm_packs_epi32( _mm256_castsi256_si128( value ), _mm256_extracti128_si256( value, 1 ) ) );
+        }
+        convert_to_int_reference( &src[i], &dst[i], count - i );
+    }
+
+#elif defined(UNZEN_CONVERT_SSE2)
+
+    void deinterleave_to_float( const int32_t src[], float left[], float right[], unsigned int count )
+    {
+        const __m128 scale = _mm_set1_ps( int_to_float_scale );
+        unsigned int i = 0;
+
+            // 4 stereo samples per iteration
+        for ( ; i+4 <= count; i+=4 )
+        {
+            __m128 a = _mm_mul_ps( _mm_cvtepi32_ps( _mm_loadu_si128( (const __m128i *)&src[2*i]   ) ), scale );    // L0R0L1R1
+            __m128 b = _mm_mul_ps( _mm_cvtepi32_ps( _mm_loadu_si128( (const __m128i *)&src[2*i+4] ) ), scale );    // L2R2L3R3
+            _mm_storeu_ps( &left[i],  _mm_shuffle_ps( a, b, _MM_SHUFFLE( 2, 0, 2, 0 ) ) );
+            _mm_storeu_ps( &right[i], _mm_shuffle_ps( a, b, _MM_SHUFFLE( 3, 1, 3, 1 ) ) );
+        }
+        deinterleave_to_float_reference( &src[2*i], &left[i], &right[i], count - i );
+    }
+
+        // cvttps returns INT_MIN for the positive overflow. Flip it to INT_MAX.
+        // NaN is cleared to +0 beforehand. Then, it is 0 as saturate_to_int().
+    static inline __m128i saturate_to_int4( __m128 value )
+    {
+        const __m128 limit = _mm_set1_ps( float_to_int_scale );
+        value = _mm_and_ps( value, _mm_cmpord_ps( value, value ) );
+        __m128i overflow = _mm_castps_si128( _mm_cmpge_ps( value, limit ) );
+        return _mm_xor_si128( _mm_cvttps_epi32( value ), overflow );
+    }
+
+    void interleave_to_int( const float left[], const float right[], int32_t dst[], unsigned int count )
+    {
+        const __m128 scale = _mm_set1_ps( float_to_int_scale );
+        unsigned int i = 0;
+
+            // 4 stereo samples per iteration
+        for ( ; i+4 <= count; i+=4 )
+        {
+            __m128i l = saturate_to_int4( _mm_mul_ps( _mm_loadu_ps( &left[i] ), scale ) );
+            __m128i r = saturate_to_int4( _mm_mul_ps( _mm_loadu_ps( &right[i] ), scale ) );
+            _mm_storeu_si128( (__m128i *)&dst[2*i],   _mm_unpacklo_epi32( l, r ) );
+            _mm_storeu_si128( (__m128i *)&dst[2*i+4], _mm_unpackhi_epi32( l, r ) );
+        }
+        interleave_to_int_reference( &left[i], &right[i], &dst[2*i], count - i );
+    }
+
+    void convert_to_float( const int32_t src[], float dst[], unsigned int count )
+    {
+        const __m128 scale = _mm_set1_ps( int_to_float_scale );
+        unsigned int i = 0;
+
+            // 4 words per iteration. No shuffle.
+        for ( ; i+4 <= count; i+=4 )
+            _mm_storeu_ps( &dst[i], _mm_mul_ps( _mm_cvtepi32_ps( _mm_loadu_si128( (const __m128i *)&src[i] ) ), scale ) );
+        convert_to_float_reference( &src[i], &dst[i], count - i );
+    }
+
+    void convert_to_int( const float src[], int32_t dst[], unsigned int count )
+    {
+        const __m128 scale = _mm_set1_ps( float_to_int_scale );
+        unsigned int i = 0;
+
+        for ( ; i+4 <= count; i+=4 )
+            _mm_storeu_si128( (__m128i *)&dst[i], saturate_to_int4( _mm_mul_ps( _mm_loadu_ps( &src[i] ), scale ) ) );
+        convert_to_int_reference( &src[i], &dst[i], count - i );
+    }
+
+    void deinterleave_to_float( const int16_t src[], float left[], float right[], unsigned int count )
+    {
+        const __m128 scale = _mm_set1_ps( short_to_float_scale );
+        unsigned int i = 0;
+
+            // 4 stereo samples per iteration. Each 32bit lane has a LR pair. No shuffle.
+        for ( ; i+4 <= count; i+=4 )
+        {
+            __m128i lr = _mm_loadu_si128( (const __m128i *)&src[2*i] );
+            __m128i l = _mm_srai_epi32( _mm_slli_epi32( lr, 16 ), 16 );
+            __m128i r = _mm_srai_epi32( lr, 16 );
+            _mm_storeu_ps( &left[i],  _mm_mul_ps( _mm_cvtepi32_ps( l ), scale ) );
+            _mm_storeu_ps( &right[i], _mm_mul_ps( _mm_cvtepi32_ps( r ), scale ) );
+        }
+        deinterleave_to_float_reference( &src[2*i], &left[i], &right[i], count - i );
+    }
+
+        // Clamp before cvttps. Then, the result is in the 16bit range. Same as saturate_to_short().
+        // max_ps returns the second operand for NaN. So, clear NaN to +0 first.
+    static inline __m128i saturate_to_short4( __m128 value )
+    {
+        value = _mm_and_ps( value, _mm_cmpord_ps( value, value ) );
+        value = _mm_min_ps( _mm_max_ps( value, _mm_set1_ps( -32768.0f ) ), _mm_set1_ps( 32767.0f ) );
+        return _mm_cvttps_epi32( value );
+    }
+
+    void interleave_to_int( const float left[], const float right[], int16_t dst[], unsigned int count )
+    {
+        const __m128 scale = _mm_set1_ps( float_to_short_scale );
+        const __m128i mask = _mm_set1_epi32( 0xFFFF );
+        unsigned int i = 0;
+
+            // 4 stereo samples per iteration. Merge L and R into each 32bit lane.
+        for ( ; i+4 <= count; i+=4 )
+        {
+            __m128i l = saturate_to_short4( _mm_mul_ps( _mm_loadu_ps( &left[i] ), scale ) );
+            __m128i r = saturate_to_short4( _mm_mul_ps( _mm_loadu_ps( &right[i] ), scale ) );
+            _mm_storeu_si128( (__m128i *)&dst[2*i], _mm_or_si128( _mm_and_si128( l, mask ), _mm_slli_epi32( r, 16 ) ) );
+        }
+        interleave_to_int_reference( &left[i], &right[i], &dst[2*i], count - i );
+    }
+
+    void convert_to_float( const int16_t src[], float dst[], unsigned int count )
+    {
+        const __m128 scale = _mm_set1_ps( short_to_float_scale );
+        unsigned int i = 0;
+
+            // 8 samples per iteration. Sign extension by the arithmetic shift.
+        for ( ; i+8 <= count; i+=8 )
+        {
+            __m128i value = _mm_loadu_si128( (const __m128i *)&src[i] );
+            __m128i lo = _mm_srai_epi32( _mm_unpacklo_epi16( value, value ), 16 );
+            __m128i hi = _mm_srai_epi32( _mm_unpackhi_epi16( value, value ), 16 );
+            _mm_storeu_ps( &dst[i],   _mm_mul_ps( _mm_cvtepi32_ps( lo ), scale ) );
+            _mm_storeu_ps( &dst[i+4], _mm_mul_ps( _mm_cvtepi32_ps( hi ), scale ) );
+        }
+        convert_to_float_reference( &src[i], &dst[i], count - i );
+    }
+
+    void convert_to_int( const float src[], int16_t dst[], unsigned int count )
+    {
+        const __m128 scale = _mm_set1_ps( float_to_short_scale );
+        unsigned int i = 0;
+
+        for ( ; i+8 <= count; i+=8 )
+        {
+            __m128i lo = saturate_to_short4( _mm_mul_ps( _mm_loadu_ps( &src[i] ), scale ) );
+            __m128i hi = saturate_to_short4( _mm_mul_ps( _mm_loadu_ps( &src[i+4] ), scale ) );
+            _mm_storeu_si128( (__m128i *)&dst[i], _mm_packs_epi32( lo, hi ) );
+        }
+        convert_to_int_reference( &src[i], &dst[i], count - i );
+    }
+
+#elif defined(UNZEN_CONVERT_NEON)
+
+    void deinterleave_to_float( const int32_t src[], float left[], float right[], unsigned int count )
+    {
+        unsigned int i = 0;
+
+            // 4 stereo samples per iteration. vld2 deinterleaves by itself.
+        for ( ; i+4 <= count; i+=4 )
+        {
+            int32x4x2_t lr = vld2q_s32( &src[2*i] );
+            vst1q_f32( &left[i],  vcvtq_n_f32_s32( lr.val[0], 31 ) );
+            vst1q_f32( &right[i], vcvtq_n_f32_s32( lr.val[1], 31 ) );
+        }
+        deinterleave_to_float_reference( &src[2*i], &left[i], &right[i], count - i );
+    }
+
+    void interleave_to_int( const float left[], const float right[], int32_t dst[], unsigned int count )
+    {
+        unsigned int i = 0;
+
+            // 4 stereo samples per iteration. Fixed point VCVT saturates and rounds toward zero.
+        for ( ; i+4 <= count; i+=4 )
+        {
+            int32x4x2_t lr;
+            lr.val[0] = vcvtq_n_s32_f32( vld1q_f32( &left[i] ), 31 );
+            lr.val[1] = vcvtq_n_s32_f32( vld1q_f32( &right[i] ), 31 );
+            vst2q_s32( &dst[2*i], lr );
+        }
+        interleave_to_int_reference( &left[i], &right[i], &dst[2*i], count - i );
+    }
+
+    void convert_to_float( const int32_t src[], float dst[], unsigned int count )
+    {
+        unsigned int i = 0;
+
+            // 4 words per iteration. No shuffle.
+        for ( ; i+4 <= count; i+=4 )
+            vst1q_f32( &dst[i], vcvtq_n_f32_s32( vld1q_s32( &src[i] ), 31 ) );
+        convert_to_float_reference( &src[i], &dst[i], count - i );
+    }
+
+    void convert_to_int( const float src[], int32_t dst[], unsigned int count )
+    {
+        unsigned int i = 0;
+
+        for ( ; i+4 <= count; i+=4 )
+            vst1q_s32( &dst[i], vcvtq_n_s32_f32( vld1q_f32( &src[i] ), 31 ) );
+        convert_to_int_reference( &src[i], &dst[i], count - i );
+    }
+
+    void deinterleave_to_float( const int16_t src[], float left[], float right[], unsigned int count )
+    {
+        unsigned int i = 0;
+
+            // 4 stereo samples per iteration. Widen to 32bit, then the fixed point VCVT.
+        for ( ; i+4 <= count; i+=4 )
+        {
+            int16x4x2_t lr = vld2_s16( &src[2*i] );
+            vst1q_f32( &left[i],  vcvtq_n_f32_s32( vmovl_s16( lr.val[0] ), 15 ) );
+            vst1q_f32( &right[i], vcvtq_n_f32_s32( vmovl_s16( lr.val[1] ), 15 ) );
+        }
+        deinterleave_to_float_reference( &src[2*i], &left[i], &right[i], count - i );
+    }
+
+    void interleave_to_int( const float left[], const float right[], int16_t dst[], unsigned int count )
+    {
+        unsigned int i = 0;
+
+            // 4 stereo samples per iteration. The saturating narrow clips to the 16bit range.
+        for ( ; i+4 <= count; i+=4 )
+        {
+            int16x4x2_t lr;
+            lr.val[0] = vqmovn_s32( vcvtq_n_s32_f32( vld1q_f32( &left[i] ), 15 ) );
+            lr.val[1] = vqmovn_s32( vcvtq_n_s32_f32( vld1q_f32( &right[i] ), 15 ) );
+            vst2_s16( &dst[2*i], lr );
+        }
+        interleave_to_int_reference( &left[i], &right[i], &dst[2*i], count - i );
+    }
+
+    void convert_to_float( const int16_t src[], float dst[], unsigned int count )
+    {
+        unsigned int i = 0;
+
+        for ( ; i+4 <= count; i+=4 )
+            vst1q_f32( &dst[i], vcvtq_n_f32_s32( vmovl_s16( vld1_s16( &src[i] ) ), 15 ) );
+        convert_to_float_reference( &src[i], &dst[i], count - i );
+    }
+
+    void convert_to_int( const float src[], int16_t dst[], unsigned int count )
+    {
+        unsigned int i = 0;
+
+        for ( ; i+4 <= count; i+=4 )
+            vst1_s16( &dst[i], vqmovn_s32( vcvtq_n_s32_f32( vld1q_f32( &src[i] ), 15 ) ) );
+        convert_to_int_reference( &src[i], &dst[i], count - i );
+    }
+
+#elif defined(UNZEN_CONVERT_VFP)
+
+        // Cortex-M7 has no float SIMD. But the fixed point VCVT converts and scales in one instruction.
+        // See q31_to_float() and float_to_q31() in the header.
+    void deinterleave_to_float( const int32_t src[], float left[], float right[], unsigned int count )
+    {
+        for ( unsigned int i=0; i<count; i++ )
+        {
+            left[i]  = q31_to_float( src[2*i] );
+            right[i] = q31_to_float( src[2*i+1] );
+        }
+    }
+
+    void interleave_to_int( const float left[], const float right[], int32_t dst[], unsigned int count )
+    {
+        for ( unsigned int i=0; i<count; i++ )
+        {
+            dst[2*i]   = float_to_q31( left[i] );
+            dst[2*i+1] = float_to_q31( right[i] );
+        }
+    }
+
+    void convert_to_float( const int32_t src[], float dst[], unsigned int count )
+    {
+        for ( unsigned int i=0; i<count; i++ )
+            dst[i] = q31_to_float( src[i] );
+    }
+
+    void convert_to_int( const float src[], int32_t dst[], unsigned int count )
+    {
+        for ( unsigned int i=0; i<count; i++ )
+            dst[i] = float_to_q31( src[i] );
+    }
+
+        // Same with Q31. The 16bit fixed point VCVT. See q15_to_float() and float_to_q15().
+    void deinterleave_to_float( const int16_t src[], float left[], float right[], unsigned int count )
+    {
+        for ( unsigned int i=0; i<count; i++ )
+        {
+            left[i]  = q15_to_float( src[2*i] );
+            right[i] = q15_to_float( src[2*i+1] );
+        }
+    }
+
+    void interleave_to_int( const float left[], const float right[], int16_t dst[], unsigned int count )
+    {
+        for ( unsigned int i=0; i<count; i++ )
+        {
+            dst[2*i]   = float_to_q15( left[i] );
+            dst[2*i+1] = float_to_q15( right[i] );
+        }
+    }
+
+    void convert_to_float( const int16_t src[], float dst[], unsigned int count )
+    {
+        for ( unsigned int i=0; i<count; i++ )
+            dst[i] = q15_to_float( src[i] );
+    }
+
+    void convert_to_int( const float src[], int16_t dst[], unsigned int count )
+    {
+        for ( unsigned int i=0; i<count; i++ )
+            dst[i] = float_to_q15( src[i] );
+    }
+
+#else
+
+    void deinterleave_to_float( const int32_t src[], float left[], float right[], unsigned int count )
+    {
+        deinterleave_to_float_reference( src, left, right, count );
+    }
+
+    void interleave_to_int( const float left[], const float right[], int32_t dst[], unsigned int count )
+    {
+        interleave_to_int_reference( left, right, dst, count );
+    }
+
+    void convert_to_float( const int32_t src[], float dst[], unsigned int count )
+    {
+        convert_to_float_reference( src, dst, count );
+    }
+
+    void convert_to_int( const float src[], int32_t dst[], unsigned int count )
+    {
+        convert_to_int_reference( src, dst, count );
+    }
+
+    void deinterleave_to_float( const int16_t src[], float left[], float right[], unsigned int count )
+    {
+        deinterleave_to_float_reference( src, left, right, count );
+    }
+
+    void interleave_to_int( const float left[], const float right[], int16_t dst[], unsigned int count )
+    {
+        interleave_to_int_reference( left, right, dst, count );
+    }
+
+    void convert_to_float( const int16_t src[], float dst[], unsigned int count )
+    {
+        convert_to_float_reference( src, dst, count );
+    }
+
+    void convert_to_int( const float src[], int16_t dst[], unsigned int count )
+    {
+        convert_to_int_reference( src, dst, count );
+    }
+
+#endif
+
+        // Stereo is the most common. Use the vectorized kernel. 
+        // Otherwise, convert each channel by the strided access.
+    void deinterleave_to_float( const int32_t src[], float * const dst[], unsigned int channels, unsigned int count )
+    {
+        if ( channels == 2 )
+        {
+            deinterleave_to_float( src, dst[0], dst[1], count );
+            return;
+        }
+        
+        for ( unsigned int ch=0; ch<channels; ch++ )
+        {
+            const int32_t * p = &src[ch];
+            float * q = dst[ch];
+            
+            for ( unsigned int i=0; i<count; i++ )
+                q[i] = q31_to_float( p[i*channels] );
+        }
+    }
+
+    void interleave_to_int( const float * const src[], int32_t dst[], unsigned int channels, unsigned int count )
+    {
+        if ( channels == 2 )
+        {
+            interleave_to_int( src[0], src[1], dst, count );
+            return;
+        }
+        
+        for ( unsigned int ch=0; ch<channels; ch++ )
+        {
+            const float * p = src[ch];
+            int32_t * q = &dst[ch];
+            
+            for ( unsigned int i=0; i<count; i++ )
+                q[i*channels] = float_to_q31( p[i] );
+        }
+    }
+
+    void deinterleave_to_float( const int16_t src[], float * const dst[], unsigned int channels, unsigned int count )
+    {
+        if ( channels == 2 )
+        {
+            deinterleave_to_float( src, dst[0], dst[1], count );
+            return;
+        }
+        
+        for ( unsigned int ch=0; ch<channels; ch++ )
+        {
+            const int16_t * p = &src[ch];
+            float * q = dst[ch];
+            
+            for ( unsigned int i=0; i<count; i++ )
+                q[i] = q15_to_float( p[i*channels] );
+        }
+    }
+
+    void interleave_to_int( const float * const src[], int16_t dst[], unsigned int channels, unsigned int count )
+    {
+        if ( channels == 2 )
+        {
+            interleave_to_int( src[0], src[1], dst, count );
+            return;
+        }
+        
+        for ( unsigned int ch=0; ch<channels; ch++ )
+        {
+            const float * p = src[ch];
+            int16_t * q = &dst[ch];
+            
+            for ( unsigned int i=0; i<count; i++ )
+                q[i*channels] = float_to_q15( p[i] );
+        }
+    }
+
+        // Pure data movement. Simple enough for the auto vectorization of the compiler.
+    void deinterleave_q31( const int32_t src[], int32_t left[], int32_t right[], unsigned int count )
+    {
+        for ( unsigned int i=0; i<count; i++ )
+        {
+            left[i]  = src[2*i];
+            right[i] = src[2*i+1];
+        }
+    }
+
+    void interleave_q31( const int32_t left[], const int32_t right[], int32_t dst[], unsigned int count )
+    {
+        for ( unsigned int i=0; i<count; i++ )
+        {
+            dst[2*i]   = left[i];
+            dst[2*i+1] = right[i];
+        }
+    }
+
+    const char * convert_kernel_name(void)
+    {
+        return UNZEN_CONVERT_KERNEL_NAME;
+    }
+}
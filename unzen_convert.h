@@ -0,0 +1,322 @@
+#ifndef _UNZEN_CONVERT_H_
+#define _UNZEN_CONVERT_H_
+
+/**
+* \brief format conversion kernels between the I2S interrupt buffer and the signal processing buffer. 
+* \details
+* The I2S data is 32bit fixed point ( Q31 ) in LRLR... format. The signal processing data is 
+* floating point in range of [-1, 1), and separated for each channel. With the 16bit wire format, 
+* the I2S data is 16bit fixed point ( Q15 ). The int16_t overloads convert it. 
+*
+* The kernels are selected at compile time : 
+* \li Cortex-M7 FPU : VCVT with fixed point operand. Conversion and scaling in one instruction.
+* \li AVX2 / SSE2 / NEON : vectorized conversion on host.
+* \li Otherwise : scalar reference. 
+*
+* Define UNZEN_CONVERT_REFERENCE to force the scalar reference. 
+* All kernels are bit exact with the reference, including the saturation. NaN is converted to 0, 
+* same as the VCVT of ARM. The benchmark build checks it. 
+*/
+
+#include <stdint.h>
+#include <limits.h>
+
+#if defined(UNZEN_CONVERT_REFERENCE)
+#define UNZEN_CONVERT_KERNEL_NAME "reference"
+#elif defined(__AVX2__)
+#define UNZEN_CONVERT_AVX2
+#define UNZEN_CONVERT_KERNEL_NAME "avx2"
+#elif defined(__SSE2__)
+#define UNZEN_CONVERT_SSE2
+#define UNZEN_CONVERT_KERNEL_NAME "sse2"
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define UNZEN_CONVERT_NEON
+#define UNZEN_CONVERT_KERNEL_NAME "neon"
+#elif defined(__GNUC__) && defined(__ARM_ARCH_7EM__) && defined(__VFP_FP__) && !defined(__SOFTFP__)
+#define UNZEN_CONVERT_VFP
+#define UNZEN_CONVERT_KERNEL_NAME "vfp"
+#else
+#define UNZEN_CONVERT_KERNEL_NAME "reference"
+#endif
+
+namespace unzen 
+{
+        /**
+            \brief convert one Q31 sample to float. Output is value / 2^31. 
+            \details
+            Inline version for the loops which have the compile time constant length. 
+            Bit exact with \ref deinterleave_to_float().
+        */
+    inline float q31_to_float( int32_t value )
+    {
+#if defined(UNZEN_CONVERT_VFP)
+            // Fixed point VCVT converts and scales in one instruction.
+        float result;
+        __asm__ ( "vmov %0, %1\n\t"
+                  "vcvt.f32.s32 %0, %0, #31"
+                  : "=t" ( result ) : "r" ( value ) );
+        return result;
+#else
+            // Multiplying the power of 2 is exact. Then, it is same as the division by -(float)INT_MIN.
+        return value * ( 1.0f / 2147483648.0f );
+#endif
+    }
+    
+        /**
+            \brief convert one float sample to Q31. Output is value * 2^31, rounded toward zero and saturated. NaN is 0. 
+            \details
+            Inline version for the loops which have the compile time constant length. 
+            Bit exact with \ref interleave_to_int().
+        */
+    inline int32_t float_to_q31( float value )
+    {
+#if defined(UNZEN_CONVERT_VFP)
+            // float to fixed point VCVT saturates and rounds toward zero.
+        int32_t result;
+        __asm__ ( "vcvt.s32.f32 %1, %1, #31\n\t"
+                  "vmov %0, %1"
+                  : "=r" ( result ), "+t" ( value ) );
+        return result;
+#else
+        value *= 2147483648.0f;
+        if ( value != value )
+            return 0;
+        else if ( value >= 2147483648.0f )
+            return INT_MAX;
+        else if ( value <= -2147483648.0f )
+            return INT_MIN;
+        else
+            return (int32_t)value;     // round toward zero
+#endif
+    }
+
+        /**
+            \brief convert one Q15 sample to float. Output is value / 2^15. 
+            \details
+            Inline version for the single frame. Bit exact with the int16_t version of \ref deinterleave_to_float().
+        */
+    inline float q15_to_float( int16_t value )
+    {
+#if defined(UNZEN_CONVERT_VFP)
+            // The 16bit fixed point VCVT reads the bottom half of the register.
+        float result;
+        __asm__ ( "vmov %0, %1\n\t"
+                  "vcvt.f32.s16 %0, %0, #15"
+                  : "=t" ( result ) : "r" ( (int32_t)value ) );
+        return result;
+#else
+        return value * ( 1.0f / 32768.0f );
+#endif
+    }
+    
+        /**
+            \brief convert one float sample to Q15. Output is value * 2^15, rounded toward zero and saturated. NaN is 0. 
+            \details
+            Inline version for the single frame. Bit exact with the int16_t version of \ref interleave_to_int().
+        */
+    inline int16_t float_to_q15( float value )
+    {
+#if defined(UNZEN_CONVERT_VFP)
+            // float to 16bit fixed point VCVT saturates to the 16bit range, and rounds toward zero.
+        int32_t result;
+        __asm__ ( "vcvt.s16.f32 %1, %1, #15\n\t"
+                  "vmov %0, %1"
+                  : "=r" ( result ), "+t" ( value ) );
+        return (int16_t)result;
+#else
+        value *= 32768.0f;
+        if ( value != value )
+            return 0;
+        else if ( value >= 32768.0f )
+            return SHRT_MAX;
+        else if ( value <= -32768.0f )
+            return SHRT_MIN;
+        else
+            return (int16_t)(int32_t)value;     // round toward zero
+#endif
+    }
+
+        /**
+            \brief deinterleave the LRLR... fixed point data into the left and right floating point data.
+            \param src LRLR... Q31 data. 2 * count words.
+            \param left left floating point data. count words. 
+            \param right right floating point data. count words. 
+            \param count number of the stereo samples.
+            \details
+            Output is src / 2^31. 
+        */
+    void deinterleave_to_float( const int32_t src[], float left[], float right[], unsigned int count );
+    
+        /**
+            \brief interleave the left and right floating point data into LRLR... fixed point data. 
+            \param left left floating point data. count words. 
+            \param right right floating point data. count words. 
+            \param dst LRLR... Q31 data. 2 * count words.
+            \param count number of the stereo samples.
+            \details
+            Output is input * 2^31, rounded toward zero. Out of range input is saturated to INT_MIN / INT_MAX. NaN is 0. 
+        */
+    void interleave_to_int( const float left[], const float right[], int32_t dst[], unsigned int count );
+    
+        /**
+            \brief deinterleave the frame major fixed point data into the floating point data of each channel.
+            \param src frame major Q31 data. channels * count words.
+            \param dst array of the pointers to the channel data. Each one has count words. 
+            \param channels number of channels. 
+            \param count number of the frames.
+            \details
+            Same conversion with the stereo version. The cost is linear to channels. 
+        */
+    void deinterleave_to_float( const int32_t src[], float * const dst[], unsigned int channels, unsigned int count );
+    
+        /**
+            \brief interleave the floating point data of each channel into the frame major fixed point data.
+            \param src array of the pointers to the channel data. Each one has count words. 
+            \param dst frame major Q31 data. channels * count words.
+            \param channels number of channels. 
+            \param count number of the frames.
+            \details
+            Same conversion with the stereo version. The cost is linear to channels. 
+        */
+    void interleave_to_int( const float * const src[], int32_t dst[], unsigned int channels, unsigned int count );
+    
+        /**
+            \brief convert the fixed point data into the floating point data, keeping the order.
+            \param src Q31 data. count words.
+            \param dst floating point data. count words. 
+            \param count number of words. 
+            \details
+            For the interleaved call back. The frame major data is converted in one streaming pass, for any 
+            number of channels. Output is src / 2^31. 
+        */
+    void convert_to_float( const int32_t src[], float dst[], unsigned int count );
+    
+        /**
+            \brief convert the floating point data into the fixed point data, keeping the order.
+            \param src floating point data. count words. 
+            \param dst Q31 data. count words.
+            \param count number of words. 
+            \details
+            Same rounding and saturation with \ref interleave_to_int().
+        */
+    void convert_to_int( const float src[], int32_t dst[], unsigned int count );
+    
+        /**
+            \brief Q15 version of \ref deinterleave_to_float(). Output is src / 2^15. 
+            \param src LRLR... Q15 data. 2 * count samples.
+            \param left left floating point data. count words. 
+            \param right right floating point data. count words. 
+            \param count number of the stereo samples.
+        */
+    void deinterleave_to_float( const int16_t src[], float left[], float right[], unsigned int count );
+    
+        /**
+            \brief Q15 version of \ref interleave_to_int(). 
+            \param left left floating point data. count words. 
+            \param right right floating point data. count words. 
+            \param dst LRLR... Q15 data. 2 * count samples.
+            \param count number of the stereo samples.
+            \details
+            Output is input * 2^15, rounded toward zero. Out of range input is saturated to SHRT_MIN / SHRT_MAX. 
+        */
+    void interleave_to_int( const float left[], const float right[], int16_t dst[], unsigned int count );
+    
+        /**
+            \brief Q15 version of the multi-channel \ref deinterleave_to_float().
+            \param src frame major Q15 data. channels * count samples.
+            \param dst array of the pointers to the channel data. Each one has count words. 
+            \param channels number of channels. 
+            \param count number of the frames.
+        */
+    void deinterleave_to_float( const int16_t src[], float * const dst[], unsigned int channels, unsigned int count );
+    
+        /**
+            \brief Q15 version of the multi-channel \ref interleave_to_int().
+            \param src array of the pointers to the channel data. Each one has count words. 
+            \param dst frame major Q15 data. channels * count samples.
+            \param channels number of channels. 
+            \param count number of the frames.
+        */
+    void interleave_to_int( const float * const src[], int16_t dst[], unsigned int channels, unsigned int count );
+    
+        /**
+            \brief Q15 version of \ref convert_to_float(). 
+            \param src Q15 data. count samples.
+            \param dst floating point data. count words. 
+            \param count number of samples. 
+        */
+    void convert_to_float( const int16_t src[], float dst[], unsigned int count );
+    
+        /**
+            \brief Q15 version of \ref convert_to_int(). 
+            \param src floating point data. count words. 
+            \param dst Q15 data. count samples.
+            \param count number of samples. 
+        */
+    void convert_to_int( const float src[], int16_t dst[], unsigned int count );
+    
+        /**
+            \brief deinterleave the LRLR... fixed point data into the left and right fixed point data.
+            \param src LRLR... Q31 data. 2 * count words.
+            \param left left Q31 data. count words. 
+            \param right right Q31 data. count words. 
+            \param count number of the stereo samples.
+        */
+    void deinterleave_q31( const int32_t src[], int32_t left[], int32_t right[], unsigned int count );
+    
+        /**
+            \brief interleave the left and right fixed point data into LRLR... fixed point data. 
+            \param left left Q31 data. count words. 
+            \param right right Q31 data. count words. 
+            \param dst LRLR... Q31 data. 2 * count words.
+            \param count number of the stereo samples.
+        */
+    void interleave_q31( const int32_t left[], const int32_t right[], int32_t dst[], unsigned int count );
+    
+        /**
+            \brief scalar reference of \ref deinterleave_to_float().
+        */
+    void deinterleave_to_float_reference( const int32_t src[], float left[], float right[], unsigned int count );
+    
+        /**
+            \brief scalar reference of \ref interleave_to_int().
+        */
+    void interleave_to_int_reference( const float left[], const float right[], int32_t dst[], unsigned int count );
+    
+        /**
+            \brief scalar reference of \ref convert_to_float().
+        */
+    void convert_to_float_reference( const int32_t src[], float dst[], unsigned int count );
+    
+        /**
+            \brief scalar reference of \ref convert_to_int().
+        */
+    void convert_to_int_reference( const float src[], int32_t dst[], unsigned int count );
+    
+        /**
+            \brief scalar reference of the Q15 version of \ref deinterleave_to_float().
+        */
+    void deinterleave_to_float_reference( const int16_t src[], float left[], float right[], unsigned int count );
+    
+        /**
+            \brief scalar reference of the Q15 version of \ref interleave_to_int().
+        */
+    void interleave_to_int_reference( const float left[], const float right[], int16_t dst[], unsigned int count );
+    
+        /**
+            \brief scalar reference of the Q15 version of \ref convert_to_float().
+        */
+    void convert_to_float_reference( const int16_t src[], float dst[], unsigned int count );
+    
+        /**
+            \brief scalar reference of the Q15 version of \ref convert_to_int().
+        */
+    void convert_to_int_reference( const float src[], int16_t dst[], unsigned int count );
+    
+        /**
+            \brief name of the kernel selected at compile time. For logging and benchmark. 
+        */
+    const char * convert_kernel_name(void);
+}
+
+#endif
@@ -0,0 +1,631 @@
+#include <math.h>
+#include <string.h>
+#include <new>
+
+#include "unzen_convolver.h"
+#include "unzen_convert.h"
+
+#if defined(UNZEN_CONVERT_AVX2)
+#include <immintrin.h>
+#elif defined(UNZEN_CONVERT_SSE2)
+#include <emmintrin.h>
+#elif defined(UNZEN_CONVERT_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace unzen
+{
+        // M_PI is not in the strict C++ mode of some tool chains.
+    static const double pi = 3.14159265358979323846;
+
+        // Smallest power of 2, which is 2 * block_size or more. At least 4.
+    static unsigned int fft_size_for( unsigned int block_size )
+    {
+        unsigned int size = 4;
+
+        while ( size < 2 * block_size )
+            size <<= 1;
+        return size;
+    }
+
+        // Bins are padded to the multiple of 8 by zero. Then, the vector kernels need no remainder loop.
+    static unsigned int padded_bins( unsigned int bins )
+    {
+        return ( bins + 7 ) / 8 * 8;
+    }
+
+        // y += x * h, for the complex numbers in the split format. The count is the multiple of 8.
+    static inline void multiply_accumulate( const float xr[], const float xi[], const float hr[], const float hi[],
+                                            float yr[], float yi[], unsigned int count )
+    {
+#if defined(UNZEN_CONVERT_AVX2)
+        for ( unsigned int i=0; i<count; i+=8 )
+        {
+            __m256 a = _mm256_loadu_ps( &xr[i] );
+            __m256 b = _mm256_loadu_ps( &xi[i] );
+            __m256 c = _mm256_loadu_ps( &hr[i] );
+            __m256 d = _mm256_loadu_ps( &hi[i] );
+            __m256 re = _mm256_sub_ps( _mm256_mul_ps( a, c ), _mm256_mul_ps( b, d ) );
+            __m256 im = _mm256_add_ps( _mm256_mul_ps( a, d ), _mm256_mul_ps( b, c ) );
+            _mm256_storeu_ps( &yr[i], _mm256_add_ps( _mm256_loadu_ps( &yr[i] ), re ) );
+            _mm256_storeu_ps( &yi[i], _mm256_add_ps( _mm256_loadu_ps( &yi[i] ), im ) );
+        }
+#elif defined(UNZEN_CONVERT_SSE2)
+        for ( unsigned int i=0; i<count; i+=4 )
+        {
+            __m128 a = _mm_loadu_ps( &xr[i] );
+            __m128 b = _mm_loadu_ps( &xi[i] );
+            __m128 c = _mm_loadu_ps( &hr[i] );
+            __m128 d = _mm_loadu_ps( &hi[i] );
+            __m128 re = _mm_sub_ps( _mm_mul_ps( a, c ), _mm_mul_ps( b, d ) );
+            __m128 im = _mm_add_ps( _mm_mul_ps( a, d ), _mm_mul_ps( b, c ) );
+            _mm_storeu_ps( &yr[i], _mm_add_ps( _mm_loadu_ps( &yr[i] ), re ) );
+            _mm_storeu_ps( &yi[i], _mm_add_ps( _mm_loadu_ps( &yi[i] ), im ) );
+        }
+#elif defined(UNZEN_CONVERT_NEON)
+        for ( unsigned int i=0; i<count; i+=4 )
+        {
+            float32x4_t a = vld1q_f32( &xr[i] );
+            float32x4_t b = vld1q_f32( &xi[i] );
+            float32x4_t c = vld1q_f32( &hr[i] );
+            float32x4_t d = vld1q_f32( &hi[i] );
+            vst1q_f32( &yr[i], vmlsq_f32( vmlaq_f32( vld1q_f32( &yr[i] ), a, c ), b, d ) );
+            vst1q_f32( &yi[i], vmlaq_f32( vmlaq_f32( vld1q_f32( &yi[i] ), a, d ), b, c ) );
+        }
+#else
+            // Cortex-M7 has no float SIMD. 2 bins per iteration keeps the FPU pipeline busy.
+        for ( unsigned int i=0; i<count; i+=2 )
+        {
+            float a0 = xr[i],   b0 = xi[i],   c0 = hr[i],   d0 = hi[i];
+            float a1 = xr[i+1], b1 = xi[i+1], c1 = hr[i+1], d1 = hi[i+1];
+            yr[i]   += a0 * c0 - b0 * d0;
+            yi[i]   += a0 * d0 + b0 * c0;
+            yr[i+1] += a1 * c1 - b1 * d1;
+            yi[i+1] += a1 * d1 + b1 * c1;
+        }
+#endif
+    }
+
+    RealFft::RealFft(void)
+    {
+        _size = 0;
+        _half = 0;
+        _table = NULL;
+        _cos = NULL;
+        _sin = NULL;
+        _split_cos = NULL;
+        _split_sin = NULL;
+        _reverse = NULL;
+    }
+
+    RealFft::~RealFft(void)
+    {
+        _release();
+    }
+
+    void RealFft::_release(void)
+    {
+        delete [] _table;
+        delete [] _reverse;
+        _table = NULL;
+        _reverse = NULL;
+        _size = 0;
+        _half = 0;
+    }
+
+    error_type RealFft::setup( unsigned int size )
+    {
+        if ( size < 4 || ( size & ( size - 1 ) ) )
+            return block_size_error;
+
+        _release();
+
+        unsigned int half = size / 2;
+
+        _table = new ( std::nothrow ) float[ half + 2 * ( half + 1 ) ];
+        _reverse = new ( std::nothrow ) unsigned int[ half ];
+        if ( _table == NULL || _reverse == NULL )
+        {
+            _release();
+            return memory_allocation_error;
+        }
+        _size = size;
+        _half = half;
+
+            // Twiddle factors of the complex FFT of half points.
+        _cos = _table;
+        _sin = _table + half / 2;
+        for ( unsigned int k=0; k<half/2; k++ )
+        {
+            _cos[k] = (float)cos( 2.0 * pi * k / half );
+            _sin[k] = (float)sin( 2.0 * pi * k / half );
+        }
+
+            // Twiddle factors to split the result into the real FFT of size points.
+        _split_cos = _table + half;
+        _split_sin = _split_cos + half + 1;
+        for ( unsigned int k=0; k<=half; k++ )
+        {
+            _split_cos[k] = (float)cos( 2.0 * pi * k / size );
+            _split_sin[k] = (float)sin( 2.0 * pi * k / size );
+        }
+
+        unsigned int bits = 0;
+        while ( ( 1u << bits ) < half )
+            bits ++;
+        for ( unsigned int n=0; n<half; n++ )
+        {
+            unsigned int r = 0;
+            for ( unsigned int b=0; b<bits; b++ )
+                if ( n & ( 1u << b ) )
+                    r |= 1u << ( bits - 1 - b );
+            _reverse[n] = r;
+        }
+
+        return no_error;
+    }
+
+        // Radix 2 decimation in time. The input is in the bit reversed order.
+    void RealFft::_transform( float re[], float im[], bool inverse ) const
+    {
+            // First stage. The twiddle factor is 1.
+        for ( unsigned int i=0; i<_half; i+=2 )
+        {
+            float ar = re[i], ai = im[i];
+            float br = re[i+1], bi = im[i+1];
+            re[i] = ar + br;
+            im[i] = ai + bi;
+            re[i+1] = ar - br;
+            im[i+1] = ai - bi;
+        }
+
+        for ( unsigned int length=4; length<=_half; length<<=1 )
+        {
+            unsigned int half_length = length / 2;
+            unsigned int step = _half / length;
+
+            for ( unsigned int start=0; start<_half; start+=length )
+            {
+                float * ar = &re[start];
+                float * ai = &im[start];
+                float * br = &re[start + half_length];
+                float * bi = &im[start + half_length];
+
+                for ( unsigned int j=0; j<half_length; j++ )
+                {
+                    float wr = _cos[j * step];
+                    float wi = inverse ? _sin[j * step] : - _sin[j * step];
+                    float tr = br[j] * wr - bi[j] * wi;
+                    float ti = br[j] * wi + bi[j] * wr;
+                    br[j] = ar[j] - tr;
+                    bi[j] = ai[j] - ti;
+                    ar[j] += tr;
+                    ai[j] += ti;
+                }
+            }
+        }
+    }
+
+    void RealFft::forward( const float in[], float re[], float im[] ) const
+    {
+            // Even samples as the real part, odd samples as the imaginary part.
+        for ( unsigned int n=0; n<_half; n++ )
+        {
+            unsigned int r = _reverse[n];
+            re[r] = in[2*n];
+            im[r] = in[2*n+1];
+        }
+
+        _transform( re, im, false );
+
+            // X[k] = E[k] + W^k O[k]. E and O are the spectrum of the even and odd samples.
+            // E[k] = ( Z[k] + conj Z[half-k] ) / 2, O[k] = ( Z[k] - conj Z[half-k] ) / 2i.
+        re[_half] = re[0];
+        im[_half] = im[0];
+        for ( unsigned int k=0; k<=_half/2; k++ )
+        {
+            unsigned int m = _half - k;
+            float er = ( re[k] + re[m] ) * 0.5f;
+            float ei = ( im[k] - im[m] ) * 0.5f;
+            float or_ = ( im[k] + im[m] ) * 0.5f;
+            float oi = ( re[m] - re[k] ) * 0.5f;
+
+                // X[m] uses conj E[k] and conj O[k].
+            float c = _split_cos[k], s = _split_sin[k];
+            float cm = _split_cos[m], sm = _split_sin[m];
+            re[k] = er + or_ * c + oi * s;
+            im[k] = ei + oi * c - or_ * s;
+            re[m] = er + or_ * cm - oi * sm;
+            im[m] = - ei - oi * cm - or_ * sm;
+        }
+    }
+
+    void RealFft::inverse( float re[], float im[], float out[] ) const
+    {
+            // Z[k] = E[k] + i O[k]. E[k] = X[k] + conj X[half-k], O[k] = ( X[k] - conj X[half-k] ) W^-k.
+            // Not divided by 2. See the scale in the header.
+        for ( unsigned int k=0; k<=_half/2; k++ )
+        {
+            unsigned int m = _half - k;
+            float xr = re[k], xi = im[k];
+            float yr = re[m], yi = im[m];
+            float c = _split_cos[k], s = _split_sin[k];
+            float cm = _split_cos[m], sm = _split_sin[m];
+
+                // For k. E = X[k] + conj X[m], D = X[k] - conj X[m], O = D * ( c + i s ).
+            float er = xr + yr, ei = xi - yi;
+            float dr = xr - yr, di = xi + yi;
+            float or_ = dr * c - di * s, oi = dr * s + di * c;
+
+                // For m. E = X[m] + conj X[k], D = X[m] - conj X[k].
+            float er2 = yr + xr, ei2 = yi - xi;
+            float dr2 = yr - xr, di2 = yi + xi;
+            float or2 = dr2 * cm - di2 * sm, oi2 = dr2 * sm + di2 * cm;
+
+            re[k] = er - oi;
+            im[k] = ei + or_;
+            re[m] = er2 - oi2;
+            im[m] = ei2 + or2;
+        }
+
+            // Bit reversed order for the transform.
+        for ( unsigned int n=0; n<_half; n++ )
+        {
+            unsigned int r = _reverse[n];
+            if ( n < r )
+            {
+                float t = re[n]; re[n] = re[r]; re[r] = t;
+                t = im[n]; im[n] = im[r]; im[r] = t;
+            }
+        }
+
+        _transform( re, im, true );
+
+        for ( unsigned int n=0; n<_half; n++ )
+        {
+            out[2*n] = re[n];
+            out[2*n+1] = im[n];
+        }
+    }
+
+    Convolver::Convolver(void) : _active_bank( 0 ), _requested_bank( 0 )
+    {
+        _block_size = 0;
+        _channels = 0;
+        _max_length = 0;
+        _partitions = 0;
+        _bins = 0;
+        _spectrum_stride = 0;
+        _position = 0;
+        _tail_block_size = 0;
+        _tail_partitions = 0;
+        _tail_bins = 0;
+        _tail_spectrum_stride = 0;
+        _tail_position = 0;
+        _tail_step = 0;
+        _tail_steps = 1;
+        _running = false;
+        _bank[0] = _bank[1] = NULL;
+        _tail_bank[0] = _tail_bank[1] = NULL;
+        for ( int ch=0; ch<max_channels; ch++ )
+        {
+            _window[ch] = NULL;
+            _delay_line[ch] = NULL;
+            _tail_window[ch] = NULL;
+            _tail_delay_line[ch] = NULL;
+            _tail_accumulator[ch] = NULL;
+            _tail_output[ch] = NULL;
+        }
+        _accumulator = NULL;
+        _time = NULL;
+        _tail_time = NULL;
+        _load_time = NULL;
+        _memory = NULL;
+    }
+
+    Convolver::~Convolver(void)
+    {
+        _release();
+    }
+
+    void Convolver::_release(void)
+    {
+        delete [] _memory;
+        _memory = NULL;
+        _channels = 0;
+        _partitions = 0;
+        _tail_partitions = 0;
+    }
+
+    error_type Convolver::setup( unsigned int block_size, unsigned int max_length, unsigned int channels, unsigned int tail_block_size )
+    {
+        if ( channels < 1 || channels > (unsigned int)max_channels )
+            return channel_error;
+        if ( block_size == 0 )
+            return block_size_error;
+        if ( tail_block_size && ( tail_block_size % block_size || tail_block_size < 2 * block_size ) )
+            return block_size_error;
+        if ( max_length == 0 )
+            return memory_size_error;
+
+        _release();
+
+            // The tail starts at 2 * tail block size. Not needed for the short response.
+        if ( max_length <= 2 * tail_block_size )
+            tail_block_size = 0;
+
+        unsigned int head_length = tail_block_size ? 2 * tail_block_size : max_length;
+        unsigned int size = fft_size_for( block_size );
+        error_type error = _fft.setup( size );
+        if ( error != no_error )
+            return error;
+
+        _block_size = block_size;
+        _max_length = max_length;
+        _partitions = ( head_length + block_size - 1 ) / block_size;
+        _bins = size / 2 + 1;
+        _spectrum_stride = 2 * padded_bins( _bins );
+
+        unsigned int tail_size = 0;
+        _tail_block_size = tail_block_size;
+        _tail_partitions = 0;
+        _tail_steps = 1;
+        if ( tail_block_size )
+        {
+            tail_size = fft_size_for( tail_block_size );
+            error = _tail_fft.setup( tail_size );
+            if ( error != no_error )
+                return error;
+
+            _tail_partitions = ( max_length - head_length + tail_block_size - 1 ) / tail_block_size;
+            _tail_bins = tail_size / 2 + 1;
+            _tail_spectrum_stride = 2 * padded_bins( _tail_bins );
+            _tail_steps = tail_block_size / block_size;
+        }
+
+            // Banks, then the channels, then the work area.
+        unsigned int bank_size = _partitions * _spectrum_stride;
+        unsigned int tail_bank_size = _tail_partitions * _tail_spectrum_stride;
+        unsigned int channel_size = size + bank_size;
+        if ( tail_block_size )
+            channel_size += tail_size + tail_bank_size + _tail_spectrum_stride + tail_block_size;
+        unsigned int load_size = ( size > tail_size ) ? size : tail_size;
+        unsigned int total = 2 * ( bank_size + tail_bank_size ) + channels * channel_size + _spectrum_stride 
+                           + size + tail_size + load_size;
+
+        _memory = new ( std::nothrow ) float[ total ];
+        if ( _memory == NULL )
+            return memory_allocation_error;
+        memset( _memory, 0, total * sizeof(float) );
+        _channels = channels;
+
+        float * p = _memory;
+        for ( int b=0; b<2; b++ )
+        {
+            _bank[b] = p;
+            p += bank_size;
+            _tail_bank[b] = p;
+            p += tail_bank_size;
+        }
+        for ( unsigned int ch=0; ch<channels; ch++ )
+        {
+            _window[ch] = p;
+            p += size;
+            _delay_line[ch] = p;
+            p += bank_size;
+            if ( tail_block_size )
+            {
+                _tail_window[ch] = p;
+                p += tail_size;
+                _tail_delay_line[ch] = p;
+                p += tail_bank_size;
+                _tail_accumulator[ch] = p;
+                p += _tail_spectrum_stride;
+                _tail_output[ch] = p;
+                p += tail_block_size;
+            }
+        }
+        _accumulator = p;
+        p += _spectrum_stride;
+        _time = p;
+        p += size;
+        _tail_time = p;
+        p += tail_size;
+        _load_time = p;
+
+        _active_bank = 0;
+        _requested_bank = 0;
+        reset();
+        return no_error;
+    }
+
+    void Convolver::reset(void)
+    {
+        unsigned int size = _fft.get_size();
+        unsigned int tail_size = _tail_fft.get_size();
+
+        for ( unsigned int ch=0; ch<_channels; ch++ )
+        {
+            memset( _window[ch], 0, size * sizeof(float) );
+            memset( _delay_line[ch], 0, _partitions * _spectrum_stride * sizeof(float) );
+            if ( _tail_partitions )
+            {
+                memset( _tail_window[ch], 0, tail_size * sizeof(float) );
+                memset( _tail_delay_line[ch], 0, _tail_partitions * _tail_spectrum_stride * sizeof(float) );
+                memset( _tail_accumulator[ch], 0, _tail_spectrum_stride * sizeof(float) );
+                memset( _tail_output[ch], 0, _tail_block_size * sizeof(float) );
+            }
+        }
+        _position = 0;
+        _tail_position = 0;
+        _tail_step = 0;
+        _running = false;
+    }
+
+    error_type Convolver::set_impulse_response( const float ir[], unsigned int length )
+    {
+        if ( _memory == NULL )
+            return memory_allocation_error;
+        if ( length > _max_length )
+            return memory_size_error;
+
+            // The interrupt has not taken the last one yet.
+        int active = _active_bank.load( std::memory_order_acquire );
+        if ( _requested_bank.load( std::memory_order_relaxed ) != active )
+            return busy_error;
+
+        int bank = 1 - active;
+        unsigned int size = _fft.get_size();
+        unsigned int half = padded_bins( _bins );
+
+            // Each partition is zero padded to the FFT size. 1/size cancels the scale of the inverse FFT.
+        for ( unsigned int p=0; p<_partitions; p++ )
+        {
+            float * spectrum = _bank[bank] + p * _spectrum_stride;
+            unsigned int start = p * _block_size;
+
+            memset( _load_time, 0, size * sizeof(float) );
+            for ( unsigned int i=0; i<_block_size && start + i < length; i++ )
+                _load_time[i] = ir[start + i] / size;
+            _fft.forward( _load_time, spectrum, spectrum + half );
+        }
+
+        if ( _tail_partitions )
+        {
+            unsigned int tail_size = _tail_fft.get_size();
+            unsigned int tail_half = padded_bins( _tail_bins );
+
+            for ( unsigned int p=0; p<_tail_partitions; p++ )
+            {
+                float * spectrum = _tail_bank[bank] + p * _tail_spectrum_stride;
+                unsigned int start = 2 * _tail_block_size + p * _tail_block_size;
+
+                memset( _load_time, 0, tail_size * sizeof(float) );
+                for ( unsigned int i=0; i<_tail_block_size && start + i < length; i++ )
+                    _load_time[i] = ir[start + i] / tail_size;
+                _tail_fft.forward( _load_time, spectrum, spectrum + tail_half );
+            }
+        }
+
+            // Request first, then check _running. If the process has not started at the check, its first block
+            // takes this request anyway. Then, taking it here too is safe. Both sides are seq_cst for this order.
+        _requested_bank.store( bank );
+        if ( ! _running.load() )
+            _active_bank.store( bank, std::memory_order_release );
+
+        return no_error;
+    }
+
+    void Convolver::process( const float * const in[], float * const out[] )
+    {
+            // Take the new impulse response at the boundary of the tail block. Then, the tail is computed
+            // with one impulse response.
+            // Tell set_impulse_response() before taking the request.
+        _running.store( true );
+        if ( _tail_step == 0 )
+            _active_bank.store( _requested_bank.load(), std::memory_order_release );
+
+        int bank = _active_bank.load( std::memory_order_relaxed );
+        unsigned int size = _fft.get_size();
+        unsigned int half = padded_bins( _bins );
+        unsigned int keep = size - _block_size;
+
+        for ( unsigned int ch=0; ch<_channels; ch++ )
+        {
+                // The latest size samples. Then, the spectrum of this block goes to the delay line.
+            float * window = _window[ch];
+            memmove( window, window + _block_size, keep * sizeof(float) );
+            memcpy( window + keep, in[ch], _block_size * sizeof(float) );
+
+            float * newest = _delay_line[ch] + _position * _spectrum_stride;
+            _fft.forward( window, newest, newest + half );
+
+                // Sum of the partition p times the input of p blocks before.
+            memset( _accumulator, 0, _spectrum_stride * sizeof(float) );
+            unsigned int slot = _position;
+            for ( unsigned int p=0; p<_partitions; p++ )
+            {
+                const float * x = _delay_line[ch] + slot * _spectrum_stride;
+                const float * h = _bank[bank] + p * _spectrum_stride;
+                multiply_accumulate( x, x + half, h, h + half, _accumulator, _accumulator + half, half );
+                slot = ( slot == 0 ) ? _partitions - 1 : slot - 1;
+            }
+            _fft.inverse( _accumulator, _accumulator + half, _time );
+
+            if ( _tail_partitions )
+            {
+                    // The output of the tail is added from the last result, before it is overwritten.
+                const float * tail = _tail_output[ch] + _tail_step * _block_size;
+                for ( unsigned int i=0; i<_block_size; i++ )
+                    _time[keep + i] += tail[i];
+                _process_tail( ch, in[ch], bank );
+            }
+
+                // Overlap save. The last block of the circular convolution is valid.
+            memcpy( out[ch], _time + keep, _block_size * sizeof(float) );
+        }
+
+        _position = ( _position + 1 == _partitions ) ? 0 : _position + 1;
+
+        if ( _tail_partitions )
+        {
+            _tail_step ++;
+            if ( _tail_step == _tail_steps )
+            {
+                _tail_step = 0;
+                _tail_position = ( _tail_position + 1 == _tail_partitions ) ? 0 : _tail_position + 1;
+            }
+        }
+    }
+
+    void Convolver::_process_tail( unsigned int ch, const float in[], int bank )
+    {
+        unsigned int tail_size = _tail_fft.get_size();
+        unsigned int tail_half = padded_bins( _tail_bins );
+        float * accumulator = _tail_accumulator[ch];
+        float * window = _tail_window[ch];
+
+            // First step. The window has the last tail block. Start the computation of its result.
+        if ( _tail_step == 0 )
+        {
+            float * newest = _tail_delay_line[ch] + _tail_position * _tail_spectrum_stride;
+            _tail_fft.forward( window, newest, newest + tail_half );
+            memset( accumulator, 0, _tail_spectrum_stride * sizeof(float) );
+        }
+
+            // Share of the partitions for this step.
+        unsigned int first = _tail_partitions * _tail_step / _tail_steps;
+        unsigned int last = _tail_partitions * ( _tail_step + 1 ) / _tail_steps;
+        unsigned int slot = ( _tail_position + _tail_partitions - first ) % _tail_partitions;
+        for ( unsigned int p=first; p<last; p++ )
+        {
+            const float * x = _tail_delay_line[ch] + slot * _tail_spectrum_stride;
+            const float * h = _tail_bank[bank] + p * _tail_spectrum_stride;
+            multiply_accumulate( x, x + tail_half, h, h + tail_half, accumulator, accumulator + tail_half, tail_half );
+            slot = ( slot == 0 ) ? _tail_partitions - 1 : slot - 1;
+        }
+
+        memmove( window, window + _block_size, ( tail_size - _block_size ) * sizeof(float) );
+        memcpy( window + tail_size - _block_size, in, _block_size * sizeof(float) );
+
+            // Last step. The result is the output of the next tail block.
+        if ( _tail_step + 1 == _tail_steps )
+        {
+            _tail_fft.inverse( accumulator, accumulator + tail_half, _tail_time );
+            memcpy( _tail_output[ch], _tail_time + tail_size - _tail_block_size, _tail_block_size * sizeof(float) );
+        }
+    }
+
+    void Convolver::process( const float in[], float out[] )
+    {
+        const float * const ins[1] = { in };
+        float * const outs[1] = { out };
+
+        process( ins, outs );
+    }
+
+    void Convolver::node( void * context, float ** in[], float * out[], unsigned int, unsigned int )
+    {
+        ( (Convolver *)context )->process( in[0], out );
+    }
+}
@@ -0,0 +1,254 @@
+/**
+* \brief header file for the partitioned convolution of the unzen audio frame work
+*/
+
+#ifndef _unzen_convolver_h_
+#define _unzen_convolver_h_
+
+#include <atomic>
+
+#include "unzen.h"
+
+namespace unzen
+{
+    /**
+      \brief FFT of the real signal.
+      \details
+      The size N is the power of 2. The real signal of N samples is transformed as the complex signal of
+      N/2 samples. Then, the result is split into N/2+1 bins. The twiddle factors and the bit reversed
+      index are precomputed in \ref setup().
+
+      The spectrum is in the split format. The real part and the imaginary part are separated arrays of
+      N/2+1 floats. It fits to the vector kernels of the multiplication in the frequency domain.
+
+      The transform is not scaled. inverse( forward( x ) ) is N * x.
+
+      The methods don't modify the object. An object can be shared by the interrupt and main().
+    */
+    class RealFft
+    {
+    public:
+            /**
+                \constructor
+            */
+        RealFft(void);
+
+            /**
+                \destructor
+            */
+        ~RealFft(void);
+
+            /**
+                \brief prepare the tables.
+                \param size FFT size. Power of 2, 4 or more.
+                \returns show the error status
+            */
+        error_type setup( unsigned int size );
+
+            /**
+                \brief FFT size.
+            */
+        unsigned int get_size(void) const { return _size; }
+
+            /**
+                \brief forward transform.
+                \param in size samples of the real signal.
+                \param re real part of size/2+1 bins.
+                \param im imaginary part of size/2+1 bins.
+            */
+        void forward( const float in[], float re[], float im[] ) const;
+
+            /**
+                \brief inverse transform.
+                \param re real part of size/2+1 bins. Destroyed.
+                \param im imaginary part of size/2+1 bins. Destroyed.
+                \param out size samples of the real signal.
+            */
+        void inverse( float re[], float im[], float out[] ) const;
+
+    private:
+        unsigned int _size;
+        unsigned int _half;
+
+            // cos and sin of 2 pi k / half, k < half/2. Then, cos and sin of 2 pi k / size, k <= half.
+        float * _table;
+        float * _cos;
+        float * _sin;
+        float * _split_cos;
+        float * _split_sin;
+
+            // Bit reversed index of half.
+        unsigned int * _reverse;
+
+        void _transform( float re[], float im[], bool inverse ) const;
+        void _release(void);
+    };
+
+    /**
+      \brief partitioned convolution by FFT, for the long impulse response.
+      \details
+      The impulse response is split into the partitions of the block size. Each partition is convolved
+      in the frequency domain, with the spectrum of the past input in the frequency domain delay line.
+      The cost per sample grows with the FFT size, and not with the block size times the length. And the
+      latency is zero, other than the block of the framework.
+
+      The block size can be any number. The FFT size is the power of 2, 2 * block size or more.
+
+      Optionally, the tail of the impulse response is convolved by the longer partitions. The tail starts at
+      2 * tail block size. The head before it is convolved by the block size. The work of the tail is spread
+      over the blocks of a tail block. So, the CPU load is flat. This reduces the cost for the long impulse
+      response, especially with the small block size.
+
+      All channels are convolved with the same impulse response. Use two objects for the true stereo.
+
+      The impulse response can be loaded from main() while the interrupt is processing. The new one is
+      prepared in the other bank, and taken at the next block ( next tail block, with the tail ).
+
+      example :
+      \code
+unzen::Convolver cabinet;
+
+void init_callback( unsigned int block_size )
+{
+    cabinet.setup( block_size, 4096, 2 );
+    cabinet.set_impulse_response( cabinet_ir, 4096 );
+}
+
+void process_callback( float rx_left[], float rx_right[], float tx_left[], float tx_right[], unsigned int block_size )
+{
+    float * in[2] = { rx_left, rx_right };
+    float * out[2] = { tx_left, tx_right };
+
+    cabinet.process( in, out );
+}
+      \endcode
+    */
+    class Convolver
+    {
+    public:
+            /**
+                \constructor
+                \details
+                The convolver is not ready until \ref setup() is called.
+            */
+        Convolver(void);
+
+            /**
+                \destructor
+            */
+        ~Convolver(void);
+
+            /**
+                \brief allocate the memory and prepare the FFT.
+                \param block_size number of samples per \ref process(). Same with the framework.
+                \param max_length maximum length of the impulse response.
+                \param channels number of channels.
+                \param tail_block_size partition size of the tail. 0 for the uniform partitions.
+                \returns show the error status
+                \details
+                tail_block_size must be the multiple of the block size, and 2 * block size or more.
+                Otherwise, \ref block_size_error is returned. If max_length is 2 * tail_block_size or shorter,
+                the tail is not used.
+
+                The impulse response and the history are cleared. Don't call while \ref process() is running.
+            */
+        error_type setup( unsigned int block_size, unsigned int max_length, unsigned int channels = 1, unsigned int tail_block_size = 0 );
+
+            /**
+                \brief load the impulse response.
+                \param ir the impulse response.
+                \param length length of ir. max_length or shorter.
+                \returns show the error status
+                \details
+                Can be called from main() while the interrupt is running \ref process(). The spectrum of the
+                partitions is computed here. So, it takes time.
+
+                If the last impulse response is not taken by \ref process() yet, \ref busy_error is returned.
+                If length is longer than max_length of \ref setup(), \ref memory_size_error is returned.
+            */
+        error_type set_impulse_response( const float ir[], unsigned int length );
+
+            /**
+                \brief convolve a block.
+                \param in array of the input of each channel.
+                \param out array of the output of each channel. Can be same with in.
+                \details
+                Each buffer has block size samples.
+            */
+        void process( const float * const in[], float * const out[] );
+
+            /**
+                \brief convolve a block of the single channel.
+                \param in input.
+                \param out output. Can be same with in.
+            */
+        void process( const float in[], float out[] );
+
+            /**
+                \brief clear the history.
+                \details
+                Don't call while \ref process() is running.
+            */
+        void reset(void);
+
+            /**
+                \brief node call back of \ref ProcessGraph.
+                \details
+                Give the convolver as the context. The channel count and the block size must be same with
+                \ref setup().
+                \code
+    int cabinet_node = graph.add_node( unzen::Convolver::node, &cabinet, 1, true );
+                \endcode
+            */
+        static void node( void * context, float ** in[], float * out[], unsigned int channels, unsigned int length );
+
+    private:
+            // Partitions of the block size.
+        RealFft _fft;
+        unsigned int _block_size;
+        unsigned int _channels;
+        unsigned int _max_length;
+        unsigned int _partitions;
+        unsigned int _bins;
+        unsigned int _spectrum_stride;
+        unsigned int _position;
+
+            // Partitions of the tail block size. Not used if _tail_partitions is 0.
+        RealFft _tail_fft;
+        unsigned int _tail_block_size;
+        unsigned int _tail_partitions;
+        unsigned int _tail_bins;
+        unsigned int _tail_spectrum_stride;
+        unsigned int _tail_position;
+        unsigned int _tail_step;
+        unsigned int _tail_steps;
+
+            // Spectrum of the impulse response. Two banks. The interrupt uses _active_bank.
+        float * _bank[2];
+        float * _tail_bank[2];
+        std::atomic<int> _active_bank;
+        std::atomic<int> _requested_bank;
+        std::atomic<bool> _running;
+
+            // Per channel. The last FFT size input samples, and the frequency domain delay line.
+        float * _window[max_channels];
+        float * _delay_line[max_channels];
+        float * _tail_window[max_channels];
+        float * _tail_delay_line[max_channels];
+        float * _tail_accumulator[max_channels];
+        float * _tail_output[max_channels];
+
+            // Work area of process(), and set_impulse_response().
+        float * _accumulator;
+        float * _time;
+        float * _tail_time;
+        float * _load_time;
+
+        float * _memory;
+
+        void _process_tail( unsigned int ch, const float in[], int bank );
+        void _release(void);
+    };
+}
+
+#endif
@@ -0,0 +1,231 @@
+#include <new>
+
+#include "unzen_graph.h"
+
+namespace unzen
+{
+    ProcessGraph::ProcessGraph(void)
+    {
+        _node_count = 0;
+        _output_node = -1;
+        _block_size = 0;
+        _channels = 0;
+        _arena = NULL;
+        _buffer_count = 0;
+    }
+
+    ProcessGraph::~ProcessGraph(void)
+    {
+        delete [] _arena;
+    }
+
+    int ProcessGraph::add_node( node_callback_type callback, void * context, unsigned int inputs, bool in_place )
+    {
+        if ( _node_count >= max_nodes || inputs > max_node_inputs || callback == NULL )
+            return -1;
+
+            // in-place needs the input 0.
+        if ( inputs == 0 )
+            in_place = false;
+
+        node_type & node = _nodes[_node_count];
+        node.callback = callback;
+        node.context = context;
+        node.inputs = inputs;
+        node.in_place = in_place;
+        for ( int i=0; i<max_node_inputs; i++ )
+            node.source[i] = unconnected;
+
+        return _node_count ++;
+    }
+
+    error_type ProcessGraph::connect( int from, int to, unsigned int input )
+    {
+        if ( from < graph_input || from >= _node_count )
+            return graph_error;
+        if ( to < 0 || to >= _node_count )
+            return graph_error;
+        if ( input >= (unsigned int)_nodes[to].inputs )
+            return graph_error;
+
+        _nodes[to].source[input] = from;
+        return no_error;
+    }
+
+    error_type ProcessGraph::set_output( int node )
+    {
+        if ( node < 0 || node >= _node_count )
+            return graph_error;
+
+        _output_node = node;
+        return no_error;
+    }
+
+    unsigned int ProcessGraph::get_buffer_count(void) const
+    {
+        return _buffer_count;
+    }
+
+    bool ProcessGraph::_is_single_input( const node_type & node ) const
+    {
+            // The input 0 is not connected to the other inputs. 
+        for ( int i=1; i<node.inputs; i++ )
+            if ( node.source[i] == node.source[0] )
+                return false;
+        return true;
+    }
+
+    float ** ProcessGraph::_get_channel_table( int buffer )
+    {
+            // rx, tx, then the arena buffers.
+        return _channel_table[ buffer + 2 ];
+    }
+
+    error_type ProcessGraph::plan( unsigned int block_size, unsigned int channels, float * rx[], float * tx[] )
+    {
+        int readers[max_nodes + 1];     // number of inputs which read each output. [0] is the graph input.
+        int waiting[max_nodes];         // number of inputs which source is not executed yet.
+        int free_buffers[max_nodes];
+        int free_count = 0;
+
+        if ( _output_node < 0 )
+            return graph_error;
+
+            // Count the readers of each output.
+        for ( int n=0; n<=_node_count; n++ )
+            readers[n] = 0;
+
+        for ( int n=0; n<_node_count; n++ )
+        {
+            waiting[n] = 0;
+            for ( int i=0; i<_nodes[n].inputs; i++ )
+            {
+                int source = _nodes[n].source[i];
+
+                if ( source == unconnected )
+                    return graph_error;
+
+                readers[ source + 1 ] ++;
+                if ( source != graph_input )
+                    waiting[n] ++;
+            }
+        }
+
+            // Topological sort. A node is ready when all its sources are executed.
+        int ordered = 0;
+        int scanned = 0;
+
+        for ( int n=0; n<_node_count; n++ )
+            if ( waiting[n] == 0 )
+                _order[ordered++] = n;
+
+        while ( scanned < ordered )
+        {
+            int done = _order[scanned++];
+
+            for ( int n=0; n<_node_count; n++ )
+                for ( int i=0; i<_nodes[n].inputs; i++ )
+                    if ( _nodes[n].source[i] == done && --waiting[n] == 0 )
+                        _order[ordered++] = n;
+        }
+
+            // Some nodes are never ready. There is a loop.
+        if ( ordered != _node_count )
+            return graph_error;
+
+            // Assign the output buffer of each node in the execution order.
+            // The buffer of an output is released after its last reader.
+        _buffer_count = 0;
+        for ( int k=0; k<_node_count; k++ )
+        {
+            node_type & node = _nodes[ _order[k] ];
+            int taken_source = unconnected;
+
+                // Each input of this node is one reader of its source.
+            for ( int i=0; i<node.inputs; i++ )
+                readers[ node.source[i] + 1 ] --;
+
+            if ( _order[k] == _output_node )
+            {
+                    // The output of the graph goes to tx directly.
+                node.buffer = tx_buffer;
+            }
+            else if ( node.in_place && readers[ node.source[0] + 1 ] == 0 && _is_single_input( node ) && 
+                      ( node.source[0] == graph_input || _nodes[ node.source[0] ].buffer != tx_buffer ) )
+            {
+                    // Nobody reads the input 0 later. Take over its buffer.
+                taken_source = node.source[0];
+                node.buffer = ( taken_source == graph_input ) ? rx_buffer : _nodes[taken_source].buffer;
+            }
+            else
+            {
+                node.buffer = free_count ? free_buffers[--free_count] : _buffer_count++;
+            }
+
+                // Release the buffers which have no more reader.
+            for ( int i=0; i<node.inputs; i++ )
+            {
+                int source = node.source[i];
+
+                if ( source == graph_input || source == taken_source || readers[ source + 1 ] != 0 )
+                    continue;
+
+                    // rx and tx are not in the arena.
+                if ( _nodes[source].buffer < 0 )
+                    continue;
+
+                    // An output connected to several inputs of this node is released only once.
+                readers[ source + 1 ] = -1;
+                free_buffers[free_count++] = _nodes[source].buffer;
+            }
+
+                // Nobody reads this output. Release it now.
+            if ( readers[ _order[k] + 1 ] == 0 && node.buffer >= 0 )
+                free_buffers[free_count++] = node.buffer;
+        }
+
+            // One arena for all buffers.
+        delete [] _arena;
+        _arena = NULL;
+        _block_size = block_size;
+        _channels = channels;
+
+        if ( _buffer_count )
+        {
+            _arena = new ( std::nothrow ) float[ _buffer_count * channels * block_size ];
+            if ( _arena == NULL )
+                return memory_allocation_error;
+            for ( unsigned int i=0; i<_buffer_count * channels * block_size; i++ )
+                _arena[i] = 0;
+        }
+
+            // Channel tables.
+        for ( unsigned int ch=0; ch<channels; ch++ )
+        {
+            _get_channel_table( rx_buffer )[ch] = rx[ch];
+            _get_channel_table( tx_buffer )[ch] = tx[ch];
+            for ( int b=0; b<_buffer_count; b++ )
+                _get_channel_table( b )[ch] = _arena + ( b * channels + ch ) * block_size;
+        }
+
+        for ( int n=0; n<_node_count; n++ )
+        {
+            node_type & node = _nodes[n];
+
+            node.out = _get_channel_table( node.buffer );
+            for ( int i=0; i<node.inputs; i++ )
+                node.in[i] = _get_channel_table( node.source[i] == graph_input ? rx_buffer : _nodes[ node.source[i] ].buffer );
+        }
+
+        return no_error;
+    }
+
+    void ProcessGraph::run(void)
+    {
+        for ( int k=0; k<_node_count; k++ )
+        {
+            node_type & node = _nodes[ _order[k] ];
+            node.callback( node.context, node.in, node.out, _channels, _block_size );
+        }
+    }
+}
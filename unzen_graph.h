@@ -0,0 +1,180 @@
+/**
+* \brief header file for the processing graph of the unzen audio frame work
+*/
+
+#ifndef _unzen_graph_h_
+#define _unzen_graph_h_
+
+#include "unzen.h"
+
+namespace unzen
+{
+    /**
+      \brief call back of a processing node.
+      \param context the pointer given to \ref ProcessGraph::add_node(). The state of the node.
+      \param in array of the input signals. in[k][ch] is the channel ch of the input k.
+      \param out output signal. out[ch] is the channel ch.
+      \param channels number of channels in each signal.
+      \param length length of each buffer [sample].
+      \details
+      If the node is added as in-place, out may be same with in[0]. Then, the node must read a sample
+      before writing the same index.
+    */
+    typedef void (* node_callback_type )( void * context, float ** in[], float * out[], unsigned int channels, unsigned int length );
+
+    /**
+      \brief graph of the processing nodes.
+      \details
+      Instead of one big process call back, the signal processing can be built from the nodes like
+      EQ, compressor and limiter. Add the nodes, connect them, and give the graph to \ref Framework::start().
+
+      At start, the graph decides the execution order, and plans the intermediate buffers. A buffer is
+      reused as soon as its last reader is done. Then, a chain of any length needs only one or two
+      buffers. All intermediate buffers are allocated in one arena. The in-place nodes write their
+      output into the input buffer, when no other node reads it later.
+
+      Each signal has the channel count of the framework. The input of the graph is the received data,
+      and the output of the graph is the transmission data.
+
+      example :
+      \code
+unzen::Framework audio;
+unzen::ProcessGraph graph;
+
+int main()
+{
+    int eq = graph.add_node( eq_callback, &eq_state, 1, true );
+    int compressor = graph.add_node( compressor_callback, &compressor_state );
+
+    graph.connect( unzen::ProcessGraph::graph_input, eq );
+    graph.connect( eq, compressor );
+    graph.set_output( compressor );
+
+    audio.start( init_callback, &graph );
+    ...
+}
+      \endcode
+    */
+    class ProcessGraph
+    {
+    public:
+            /// maximum number of the nodes in a graph.
+        static const int max_nodes = 32;
+
+            /// maximum number of the inputs of a node.
+        static const int max_node_inputs = 4;
+
+            /// node ID of the graph input. Use as the source of \ref connect().
+        static const int graph_input = -1;
+
+            /**
+                \constructor
+            */
+        ProcessGraph(void);
+
+            /**
+                \destructor
+            */
+        ~ProcessGraph(void);
+
+            /**
+                \brief add a node.
+                \param callback process call back of the node.
+                \param context pointer passed to the call back. Can be NULL.
+                \param inputs number of the inputs. 0 to \ref max_node_inputs.
+                \param in_place true if the node can write its output over the input 0.
+                \returns node ID. -1 if the graph is full or the parameter is wrong.
+                \details
+                The graph can't be changed after it is given to \ref Framework::start().
+            */
+        int add_node( node_callback_type callback, void * context, unsigned int inputs = 1, bool in_place = false );
+
+            /**
+                \brief connect the output of a node to the input of another node.
+                \param from source node ID, or \ref graph_input.
+                \param to destination node ID.
+                \param input index of the input of the destination node.
+                \returns \ref graph_error if a parameter is out of range.
+                \details
+                An output can be connected to several inputs. An input can have only one source. The last
+                connection wins.
+            */
+        error_type connect( int from, int to, unsigned int input = 0 );
+
+            /**
+                \brief select the node which output goes to the output of the graph.
+                \param node node ID.
+                \returns \ref graph_error if the node ID is out of range.
+            */
+        error_type set_output( int node );
+
+            /**
+                \brief number of the intermediate buffers planned.
+                \returns buffer count. Valid after \ref Framework::start().
+                \details
+                Each buffer has channels * block size samples.
+            */
+        unsigned int get_buffer_count(void) const;
+
+            /**
+                \brief plan the execution order and the buffers.
+                \param block_size block size [sample].
+                \param channels number of channels.
+                \param rx input buffers of the graph. One for each channel.
+                \param tx output buffers of the graph. One for each channel.
+                \returns \ref graph_error if the graph has a loop or an unconnected input.
+                \details
+                Called by \ref Framework::start(). The arena is allocated here.
+            */
+        error_type plan( unsigned int block_size, unsigned int channels, float * rx[], float * tx[] );
+
+            /**
+                \brief run all nodes in the planned order.
+                \details
+                Called by the framework for each block.
+            */
+        void run(void);
+
+    private:
+            // Special buffer IDs. The others are the index in the arena.
+        static const int rx_buffer = -1;
+        static const int tx_buffer = -2;
+
+            // Source of the input which is not connected yet.
+        static const int unconnected = -2;
+
+        struct node_type
+        {
+            node_callback_type callback;
+            void * context;
+            int inputs;
+            bool in_place;
+            int source[max_node_inputs];        // node ID connected to each input
+            int buffer;                         // buffer ID of the output
+            float ** in[max_node_inputs];       // channel table of each input
+            float ** out;                       // channel table of the output
+        };
+
+        node_type _nodes[max_nodes];
+        int _node_count;
+        int _output_node;
+
+            // Execution order. Index of _nodes.
+        int _order[max_nodes];
+
+        unsigned int _block_size;
+        unsigned int _channels;
+
+            // One memory for all intermediate buffers.
+        float * _arena;
+        int _buffer_count;
+
+            // Channel tables of each buffer. rx, tx, then the arena buffers.
+        float * _channel_table[max_nodes + 2][max_channels];
+
+        bool _is_single_input( const node_type & node ) const;
+        float ** _get_channel_table( int buffer );
+    };
+}
+
+#endif
@@ -1,3 +1,11 @@
+#ifndef UNZEN_HOST
+
+    // mbed OS defines MBED_CONF_RTOS_PRESENT with RTOS. The classic mbed and the bare metal profile don't have it.
+#if defined( MBED_CONF_RTOS_PRESENT )
+#include "rtos.h"
+#endif
+
+#include "unzen.h"
 #include "unzen_hal.h"
 
 // #define DEBUGSAI
@@ -6,16 +14,111 @@ namespace unzen
         // for timing control.     
     volatile unsigned int dummy;
     
+        // A pin of SAI. 
+    struct sai_pin_type
+    {
+        GPIO_TypeDef * gpio;
+        unsigned int pin;
+        unsigned int af;                    // Alternate function number
+        bool output;                        // DAC is driven by SAI. Others are input.
+    };
+    
+        // Resources of a port. 
+        // In both ports, Block A is RX and slave to the external BCLK/WS. Block B is TX and sync with Block A. 
+    struct sai_port_type
+    {
+        SAI_TypeDef * sai;
+        SAI_Block_TypeDef * rx;
+        SAI_Block_TypeDef * tx;
+        unsigned int rcc_enable_bit;        // SAIxEN of RCC_APB2ENR, and SAIxRST of RCC_APB2RSTR
+        unsigned int rcc_select_shift;      // SAIxSEL of RCC_DCKCFGR1
+        unsigned int gpio_enable_bits;      // GPIOxEN of RCC_AHB1ENR
+        sai_pin_type pins[4];               // DAC, WS, CLK, ADC
+        DMA_Stream_TypeDef * rx_stream;
+        DMA_Stream_TypeDef * tx_stream;
+        unsigned int rx_channel;
+        unsigned int tx_channel;
+        volatile uint32_t * rx_flag_clear;  // LIFCR or HIFCR of DMA2
+        unsigned int rx_flag_shift;         // Position of the flags of the stream in rx_flag_clear
+        volatile uint32_t * tx_flag_clear;
+        unsigned int tx_flag_shift;
+        IRQn_Type i2s_irq;
+        IRQn_Type dma_irq;
+        IRQn_Type process_irq;
+    };
+    
+        // See DM00166116.pdf ST32F746ZG Datasheet Rev 4 Table 12, and RM0385 Table 28 for the DMA request mapping.
+        // The process IRQs are killed peripheral interrupts. The SPI6 and SPI5 can't be used with Unzen.
+    static const sai_port_type sai_ports[max_ports] = {
+        {   // Port 0 : SAI1
+            SAI1, SAI1_Block_A, SAI1_Block_B, 22, 20, 
+            1 << 4,     // GPIOE
+            {
+                { GPIOE, 3, 6, true  },     // PE3  SAI1_SD_B   (AF6) : DAC
+                { GPIOE, 4, 6, false },     // PE4  SAI1_FS_A   (AF6) : WS
+                { GPIOE, 5, 6, false },     // PE5  SAI1_SCK_A  (AF6) : CLK
+                { GPIOE, 6, 6, false }      // PE6  SAI1_SD_A   (AF6) : ADC
+            },
+            DMA2_Stream1, DMA2_Stream5, 0, 0,       // SAI1_A : Stream 1 Channel 0, SAI1_B : Stream 5 Channel 0
+            &DMA2->LIFCR, 6, &DMA2->HIFCR, 6, 
+            SAI1_IRQn, DMA2_Stream1_IRQn, SPI6_IRQn
+        },
+        {   // Port 1 : SAI2
+            SAI2, SAI2_Block_A, SAI2_Block_B, 23, 22, 
+            1 << 3 | 1 << 4,    // GPIOD, GPIOE
+            {
+                { GPIOE, 11, 10, true  },   // PE11 SAI2_SD_B   (AF10) : DAC
+                { GPIOD, 12, 10, false },   // PD12 SAI2_FS_A   (AF10) : WS
+                { GPIOD, 13, 10, false },   // PD13 SAI2_SCK_A  (AF10) : CLK
+                { GPIOD, 11, 10, false }    // PD11 SAI2_SD_A   (AF10) : ADC
+            },
+            DMA2_Stream4, DMA2_Stream7, 3, 0,       // SAI2_A : Stream 4 Channel 3, SAI2_B : Stream 7 Channel 0
+            &DMA2->HIFCR, 0, &DMA2->HIFCR, 22, 
+            SAI2_IRQn, DMA2_Stream4_IRQn, SPI5_IRQn
+        }
+    };
+    
+        // DMA buffers given by hal_i2s_dma_setup()
+    static int32_t * dma_rx_buffer[max_ports][2];
+    
+        // number of words in one frame. Given by hal_i2s_setup()
+    static unsigned int words_per_frame[max_ports] = { 2, 2 };
+    static unsigned int dma_buffer_length[max_ports];
+    
+        // size of a sample in the DMA buffers [byte]. Given by hal_i2s_setup()
+    static unsigned int sample_bytes[max_ports] = { 4, 4 };
+    
         // Set up I2S peripheral to ready to start.
         // By this HAL, the I2S have to become : 
         // - slave mode
         // - clock must be ready
-    void hal_i2s_setup(void)
+    void hal_i2s_setup( unsigned int port, bool dma, unsigned int channels, unsigned int data_bits )
     {
-            //      STM32F746ZG SAI1 Block A :RX : Slave to the external BCLK/WS
-            //      STM32F746ZG SAI1 Block B :TX : Sync with Block A. 
+        const sai_port_type & p = sai_ports[port];
+        
+            // Frame format.
+            // 2 channels : I2S. FS shows the channel side. 
+            // 3 - 8 channels : TDM. FS is one bit clock active high pulse before the first slot. 
+            //                  Frame length is limited to 256 bit. Then, 8 slots of 32bit is maximum. 
+        unsigned int tdm = ( channels > 2 );
+        unsigned int frame_length = data_bits * channels;
+        unsigned int fs_active = tdm ? 0 : frame_length / 2 - 1;
+        
+            // Data size and slot size. Both 32bit, or both 16bit. 
+        unsigned int short_data = ( data_bits == 16 );
+        unsigned int data_size = short_data ? 4 : 7;
+        unsigned int slot_size = short_data ? 1 : 2;
+        
+            // FIFO threshold to request one frame. 1/4 FIFO is 2 words. 
+        unsigned int fifo_threshold = ( channels + 1 ) / 2;
+        
+        words_per_frame[port] = channels;
+        sample_bytes[port] = data_bits / 8;
+        
+            //      STM32F746ZG SAIx Block A :RX : Slave to the external BCLK/WS
+            //      STM32F746ZG SAIx Block B :TX : Sync with Block A. 
             //      See stm32f746xx.h source here : https://developer.mbed.org/teams/Rigado/code/mbed-src-bmd-200/docs/255afbe6270c/stm32f746xx_8h_source.html
-            //      This implementation kills SPI6 interrupt
+            //      This implementation kills SPI6 interrupt ( and SPI5 interrupt for port 1 )
             
                 // Setup PLL
                 // RCC_PLLCFGR : Has PLLM ( Division Factor M )
@@ -25,33 +128,43 @@ namespace unzen
                 // RCC_DKCFGR1 : RCC Dedicated clocks configuration register
                 // clear the relevant field
         RCC->DCKCFGR1 &= ~ (
-            3 << 20 |       // SAI1 SEL
-            31 << 8 );      // PLLSAIDIVQ
+            3 << p.rcc_select_shift );  // SAIx SEL
                 // set the value
         RCC->DCKCFGR1 |= 
-            0 << 20 |       // SAI1 SEL   : 0, PLLSAI
-            0 << 8 ;        // PLLSAIDIVQ : 0, div by 1
+            0 << p.rcc_select_shift;    // SAIx SEL   : 0, PLLSAI
                 
-                // RCC_PLLSAICFGR : PLLSAI configuration register. mbed set the pre-devider as 8. So, PLL input is 1MHz
-                // The VCO have to be more than 100Mhaz. So, set it 192MHz.
-        RCC->PLLSAICFGR = 
-            4 << 28 |   // PLLSAIR : 4 is dividing by 4 for LCD clock ( 48Mhz )
-            4 << 24 |   // PLLSAIQ : 4 is dividing by 4 for SAI clock ( 48Mhz )
-            1 << 16 |   // PLLSAIR : 1 is dividing by 4 for USB clock ( 48Mhz )
-            192 << 6 ;   // PLLSAIN : 192 is dividing by 192 for vco freq ( 192Mhz )
+                // The PLLSAI is shared by the ports. The configuration registers can't be written while it is running. 
+        if ( !( RCC->CR & ( 1<<29 ) ) )
+        {
+                    // clear the relevant field
+            RCC->DCKCFGR1 &= ~ (
+                31 << 8 );      // PLLSAIDIVQ
+                    // set the value
+            RCC->DCKCFGR1 |= 
+                0 << 8 ;        // PLLSAIDIVQ : 0, div by 1
+                
+                    // RCC_PLLSAICFGR : PLLSAI configuration register. mbed set the pre-devider as 8. So, PLL input is 1MHz
+                    // The VCO have to be more than 100Mhaz. So, set it 192MHz.
+            RCC->PLLSAICFGR = 
+                4 << 28 |   // PLLSAIR : 4 is dividing by 4 for LCD clock ( 48Mhz )
+                4 << 24 |   // PLLSAIQ : 4 is dividing by 4 for SAI clock ( 48Mhz )
+                1 << 16 |   // PLLSAIR : 1 is dividing by 4 for USB clock ( 48Mhz )
+                192 << 6 ;   // PLLSAIN : 192 is dividing by 192 for vco freq ( 192Mhz )
 
-                // RCC_CR : Starting/Status of PLLSAI
-        RCC->CR |= (1 << 28);     // PLL SAI On
-                // wait while PLL SAI is not ready
-        while ( !( RCC->CR & ( 1<<29 ) ) )
-            ;
+                    // RCC_CR : Starting/Status of PLLSAI
+            RCC->CR |= (1 << 28);     // PLL SAI On
+                    // wait while PLL SAI is not ready
+            while ( !( RCC->CR & ( 1<<29 ) ) )
+                ;
+        }
 
 
                 // RCC_APB2ENR : APB2 peripherals clock enable register
-        RCC->APB2ENR |= ( 1 << 22);     // SAI1 enable
+        RCC->APB2ENR |= ( 1 << p.rcc_enable_bit );  // SAIx enable
                     
                 // RCC_AHB1ENR : AHB1 peripherals clock enable register
-        RCC->AHB1ENR |= 1<<4;           // GPIOE enable
+        RCC->AHB1ENR |= p.gpio_enable_bits;         // GPIO enable
+        RCC->AHB1ENR |= 1<<22;          // DMA2 enable
                     
                 // Control the stability timing. The STM32F746 reference manual requires
                 // to wait 2 peripheral cylecs, after enabling its clock. 
@@ -61,8 +174,8 @@ namespace unzen
         dummy = RCC->CR;
                     
                 // RCC_APB2RSTR : APB2 peripherals reset register
-        RCC->APB2RSTR |= ( 1 << 22);     // SAI1 reset
-        RCC->APB2RSTR &= ~( 1 << 22);     // SAI1 reset release
+        RCC->APB2RSTR |= ( 1 << p.rcc_enable_bit );     // SAIx reset
+        RCC->APB2RSTR &= ~( 1 << p.rcc_enable_bit );    // SAIx reset release
         
             
 /*
@@ -76,28 +189,28 @@ RCC_PLLSAICFGR :24003000
 */
         
             // Setup Global Configuraion Register
-        SAI1->GCR = 
+        p.sai->GCR = 
                 0 << 0 |    // syncin : ingnored because none of the block is external synch from outside of SAI module 
                 0 << 4 ;    // syncout : 0 : No sync output for other SAI. 1,Block A(RX) is used for input of otehr block
             
             // Setup SAI Block configuration register.
             // Block A : RX
             // Block B : TX
-        SAI1_Block_A->CR1 = 
+        p.rx->CR1 = 
 #ifndef DEBUGSAI          
                 0 << 20 |   // MCKDIV   : Meaningless because the block is slave mode.
 #else
                 2 << 20 |   // MCKDIV   : Master Clock Divider.: Div by 4
 #endif                
                 1 << 19 |   // NODIV    : Master clock divider is enabled ( perhaps, meaningless in slave mode )
-                0 << 17 |   // DMAEN    : 0, DMA disanble, 1: DMA Enable
+      dma << 17 |   // DMAEN    : 0, DMA disanble, 1: DMA Enable
                 0 << 16 |   // SAIXEN   : 0, Disable, 1, Enable. Disable at this moment
                 0 << 13 |   // OUTDRIV  : 0, Audio is driven only when SAIXEN is 1. 1, Audio is driven
                 0 << 12 |   // MONO     : 0, Stereo. 1, Mono
                 0 << 10 |   // SYNCEN   : 0, Async mode. The Async mode referes the outside sync signal in slave mode. 
                 1 << 9  |   // CKSTR    : 0, sample by falling edge, 1, sample by rising edge. I2S is sample by rising edge
                 0 << 8  |   // LSBFIRST : 0, MSB first. 1, LSB first. I2S is MSB first
-                7 << 5 |    // DS       : 7, 32bit. 
+        data_size << 5 |    // DS       : 4, 16bit. 7, 32bit. 
                 0 << 2 |    // PRTCFG   : 0, Free protocol, 1, SPDIF, 2, AC97. I2S is Free protocol
 #ifndef DEBUGSAI  
                 3 << 0 ;    // MODE     : 0, master tx. 1, master rx. 2, slave tx. 3, slave rx
@@ -105,7 +218,7 @@ RCC_PLLSAICFGR :24003000
                 1 << 0 ;    // MODE     : 0, master tx. 1, master rx. 2, slave tx. 3, slave rx
 #endif                
             // configuration register 2
-        SAI1_Block_A->CR2 = 
+        p.rx->CR2 = 
                 0 << 14 |   // COMP     : 0, No companding
                 0 << 13 |   // CPL      : Ignoered when no companding
                 0 << 7 |    // MUTECNT  : 0, ignored when no muting
@@ -113,55 +226,55 @@ RCC_PLLSAICFGR :24003000
                 0 << 5 |    // MUTE     : 0, No mute. 1, mute
                 0 << 4 |    // TRIS     : 0, Drive all slot. 1, Drive only active slot. Meaningless for I2S and RX
                 1 << 3 |    // FFLUSH   : 0, No FIFO Flush. 1, FIFO Flush
-                1 << 0;     // FTH      : 0, FIFO empty. 1, 1/4 FIFO. 2, 1/2 FIFO. 3, 3/4 FIFO. 4, FIFO full
+   fifo_threshold << 0;     // FTH      : 0, FIFO empty. 1, 1/4 FIFO. 2, 1/2 FIFO. 3, 3/4 FIFO. 4, FIFO full
                 
             // Frame configuration register
-        SAI1_Block_A->FRCR =
+        p.rx->FRCR =
                 1 << 18 |   // FSOFF    : 0, FS is asserted on the first bit. 1, FS is asserted before the first bit.
-                0 << 17 |   // FSPOL    : 0, Active low. 1, active high. I2S in left first operation is actilve low FS.
-                1 << 16 |   // FSDEF    : 0, FS is start frame signal. 1, FS has also channel side info. I2S have to set 1
-                31 << 8 |   // FSALL    : Frame sync active level lenght. Seems to be meaningless in slave mode. Set as to be sure.
-                63 << 0 ;   // FRL      : Frame length. Seems to be meaning less in slave mode. Set as to be sure. 
+              tdm << 17 |   // FSPOL    : 0, Active low. 1, active high. I2S in left first operation is actilve low FS.
+             !tdm << 16 |   // FSDEF    : 0, FS is start frame signal. 1, FS has also channel side info. I2S have to set 1
+        fs_active << 8  |   // FSALL    : Frame sync active level lenght. Half frame in I2S, 1 bit in TDM.
+ ( frame_length - 1 ) << 0 ;// FRL      : Frame length - 1. 
                 
             // Slot register
-        SAI1_Block_A->SLOTR = 
-                0xFFFF << 16 |   // SLOTEN   : bit mask to specify the active slot. In I2S, 2 slts are active.
-                1 << 8 |    // NBSLOT   : Number of slots - 1 ( Ref manual seems to be wrong )
-                2 << 6 |    // SLOTSZ   : 0, same with data size. 1, 16bit. 2, 32bit
+        p.rx->SLOTR = 
+   ( ( 1 << channels ) - 1 ) << 16 |   // SLOTEN   : bit mask to specify the active slot. In I2S, 2 slts are active.
+   ( channels - 1 ) << 8 |  // NBSLOT   : Number of slots - 1 ( Ref manual seems to be wrong )
+        slot_size << 6 |    // SLOTSZ   : 0, same with data size. 1, 16bit. 2, 32bit
                 0 << 0 ;    // FBOFF    : The manual is not clear. Perhaps, 0 is OK.
                 
-            // interrupt mask. Only FIFO interrupt is allowed.
-        SAI1_Block_A->IMR = 
+            // interrupt mask. Only FIFO interrupt is allowed. In DMA mode, no interrupt.
+        p.rx->IMR = 
                 0 << 6 |    // LFSDETIE : Late frame synchronization detection interrupt enable
                 0 << 5 |    // AFSDETIE : Anticipated frame synchronization detection interrupt enable. AC97 only
                 0 << 4 |    // CNDYIE   : CODEC nott ready interrupt. AC97 only
-                1 << 3 |    // FREQIE   : FIFO Interrupt Request. Enable for RX
+             !dma << 3 |    // FREQIE   : FIFO Interrupt Request. Enable for RX
                 0 << 2 |    // WCKCFGIE : Wrong clock configuration interrupt enable. 
                 0 << 1 |    // MUTEDETIE: Mute detection interrupt enable. 
                 0 << 0;     // OVRUDRIE : Overrun/underrun interrupt enable          
             
             // Clear flag register
-        SAI1_Block_A->CLRFR = 0xFFFFFFFF;       // clear all flags
+        p.rx->CLRFR = 0xFFFFFFFF;       // clear all flags
         
             // Setup SAI Block configuration register.
             // Block A : RX
             // Block B : TX
-        SAI1_Block_B->CR1 = 
+        p.tx->CR1 = 
                 0 << 20 |   // MCKDIV   : Meaningless because the block is slave mode.
                 0 << 19 |   // NODIV    : Master clock divider is enabled ( perhaps, meaningless in slave mode )
-                0 << 17 |   // DMAEN    : 0, DMA disanble, 1: DMA Enable
+      dma << 17 |   // DMAEN    : 0, DMA disanble, 1: DMA Enable
                 0 << 16 |   // SAIXEN   : 0, Disable, 1, Enable. Disable at this moment
                 0 << 13 |   // OUTDRIV  : 0, Audio is driven only when SAIXEN is 1. 1, Audio is driven
                 0 << 12 |   // MONO     : 0, Stereo. 1, Mono
                 1 << 10 |   // SYNCEN   : 1, sync with internal audio block. 
                 1 << 9  |   // CKSTR    : 0, sample by falling edge, 1, sample by rising edge. I2S is sample by rising edge
                 0 << 8  |   // LSBFIRST : 0, MSB first. 1, LSB first. I2S is MSB first
-                7 << 5 |    // DS       : 7, 32bit. 
+        data_size << 5 |    // DS       : 4, 16bit. 7, 32bit. 
                 0 << 2 |    // PRTCFG   : 0, Free protocol, 1, SPDIF, 2, AC97. I2S is Free protocol
                 2 << 0 ;    // MODE     : 0, master tx. 1, master rx. 2, slave tx. 3, slave rx
                 
             // configuration register 2
-        SAI1_Block_B->CR2 = 
+        p.tx->CR2 = 
                 0 << 14 |   // COMP     : 0, No companding
                 0 << 13 |   // CPL      : Ignoered when no companding
                 0 << 7 |    // MUTECNT  : 0, ignored when no muting
@@ -169,25 +282,25 @@ RCC_PLLSAICFGR :24003000
                 0 << 5 |    // MUTE     : 0, No mute. 1, mute
                 0 << 4 |    // TRIS     : 0, Drive all slot. 1, Drive only active slot. Meaningless for I2S and RX
                 1 << 3 |    // FFLUSH   : 0, No FIFO Flush. 1, FIFO Flush
-                1 << 0;     // FTH      : 0, FIFO empty. 1, 1/4 FIFO. 2, 1/2 FIFO. 3, 3/4 FIFO. 4, FIFO full
+   fifo_threshold << 0;     // FTH      : 0, FIFO empty. 1, 1/4 FIFO. 2, 1/2 FIFO. 3, 3/4 FIFO. 4, FIFO full
                 
             // Frame configuration register
-        SAI1_Block_B->FRCR =
+        p.tx->FRCR =
                 1 << 18 |   // FSOFF    : 0, FS is asserted on the first bit. 1, FS is asserted before the first bit.
-                0 << 17 |   // FSPOL    : 0, Active low. 1, active high. I2S in left first operation is actilve low FS.
-                1 << 16 |   // FSDEF    : 0, FS is start frame signal. 1, FS has also channel side info. I2S have to set 1
-                31 << 8 |   // FSALL    : Frame sync active level lenght. Seems to be meaningless in slave mode. Set as to be sure.
-                63 << 0 ;   // FRL      : Frame length. Seems to be meaning less in slave mode. Set as to be sure. 
+              tdm << 17 |   // FSPOL    : 0, Active low. 1, active high. I2S in left first operation is actilve low FS.
+             !tdm << 16 |   // FSDEF    : 0, FS is start frame signal. 1, FS has also channel side info. I2S have to set 1
+        fs_active << 8  |   // FSALL    : Frame sync active level lenght. Half frame in I2S, 1 bit in TDM.
+ ( frame_length - 1 ) << 0 ;// FRL      : Frame length - 1. 
                 
             // Slot register
-        SAI1_Block_B->SLOTR = 
-                0xFFFF << 16 |   // SLOTEN   : bit mask to specify the active slot. In I2S, 2 slts are active.
-                1 << 8 |    // NBSLOT   : Number of slots - 1 ( Ref manual seems to be wrong )
-                2 << 6 |    // SLOTSZ   : 0, same with data size. 1, 16bit. 2, 32bit
+        p.tx->SLOTR = 
+   ( ( 1 << channels ) - 1 ) << 16 |   // SLOTEN   : bit mask to specify the active slot. In I2S, 2 slts are active.
+   ( channels - 1 ) << 8 |  // NBSLOT   : Number of slots - 1 ( Ref manual seems to be wrong )
+        slot_size << 6 |    // SLOTSZ   : 0, same with data size. 1, 16bit. 2, 32bit
                 0 << 0 ;    // FBOFF    : The manual is not clear. Perhaps, 0 is OK.
                 
             // interrupt mask : TX doesn't trigger interrupt
-        SAI1_Block_B->IMR = 
+        p.tx->IMR = 
                 0 << 6 |    // LFSDETIE : Late frame synchronization detection interrupt enable
                 0 << 5 |    // AFSDETIE : Anticipated frame synchronization detection interrupt enable. AC97 only
                 0 << 4 |    // CNDYIE   : CODEC nott ready interrupt. AC97 only
@@ -197,121 +310,85 @@ RCC_PLLSAICFGR :24003000
                 0 << 0;     // OVRUDRIE : Overrun/underrun interrupt enable          
             
             // Clear flag register
-        SAI1_Block_B->CLRFR = 0xFFFFFFFF;       // clear all flags
+        p.tx->CLRFR = 0xFFFFFFFF;       // clear all flags
 
 
-            //  Fill up tx FIO by 3 stereo samples.
-        hal_put_i2s_tx_data( 0 ); // left
-        hal_put_i2s_tx_data( 0 ); // right
-        hal_put_i2s_tx_data( 0 ); // left
-        hal_put_i2s_tx_data( 0 ); // right
-        hal_put_i2s_tx_data( 0 ); // left
-        hal_put_i2s_tx_data( 0 ); // right
+            //  Fill up tx FIO by 3 stereo samples. In TDM, by one frame. 
+            //  In DMA mode, TX DMA fills the FIFO as soon as the stream is enabled.
+        if ( ! dma )
+        {
+            unsigned int prefill = tdm ? channels : 6;
+            
+            for ( unsigned int i=0; i<prefill; i++ )
+                hal_put_i2s_tx_data( port, 0 );
+        }
 
     }
     
         // Pin configuration and sync with WS signal
-    void hal_i2s_pin_config_and_wait_ws(void)
+    void hal_i2s_pin_config_and_wait_ws( unsigned int port )
     {
             // See DM00166116.pdf ST32F746ZG Datasheet Rev 4 Table 12
             // See https://developer.mbed.org/platforms/ST-Nucleo-F746ZG/
             // See stm32f746xx.h source here : https://developer.mbed.org/teams/Rigado/code/mbed-src-bmd-200/docs/255afbe6270c/stm32f746xx_8h_source.html
+            // The pins of each port are in sai_ports.
             
-            // PE3  SAI1_SD_B   (AF6) : DAC
-            // PE4  SAI1_FS_A   (AF6) : WS
-            // PE5  SAI1_SCK_A  (AF6) : CLK
-            // PE6  SAI1_SD_A   (AF6) : ADC
+        for ( int i=0; i<4; i++ )
+        {
+            const sai_pin_type & pin = sai_ports[port].pins[i];
+            GPIO_TypeDef * gpio = pin.gpio;
+            unsigned int n = pin.pin;
             
-            // Clear the mode field of PE3-6
-        GPIOE->MODER &=
-            ~(  3 << 6 |    // PE3
-                3 << 8 |    // PE4
-                3 << 10 |   // PE5
-                3 << 12 );  // PE6 
-
-            // Set the pin mode
-        GPIOE->MODER |=
-                2 << 6 |    // PE3 is Alternate Function
-                2 << 8 |    // PE4 is Alternate Function
-                2 << 10 |   // PE5 is Alternate Function
-                2 << 12;    // PE6 is Alternate Function
-
-
-            // Clear the OTYPE field of PE3-6  ( Clear is push-pull )
-        GPIOE->OTYPER &=
-            ~(  1 << 3 |    // PE3
-                1 << 4 |    // PE4
-                1 << 5 |    // PE5
-                1 << 6 );   // PE6 
-
-
-            // Clear the OSPEEDR field of PE3-6
-        GPIOE->OSPEEDR &=
-            ~(  3 << 6 |    // PE3
-                3 << 8 |    // PE4
-                3 << 10 |   // PE5
-                3 << 12 );  // PE6 
-
-            // Set the OSPEEDR
-        GPIOE->OSPEEDR |=
-                1 << 6 |    // PE3 DAC is medium speed
-                0 << 8 |    // PE4 is input
-                0 << 10 |   // PE5 is input
-                0 << 12;    // PE6 is input
-
-
-            // Clear the PUPDR field of PE3-6 ( Clear is no pull-up/no pull-down )
-        GPIOE->PUPDR &=
-            ~(  3 << 6 |    // PE3
-                3 << 8 |    // PE4
-                3 << 10 |   // PE5
-                3 << 12 );  // PE6 
-
-
-            // Clear the Alternate funciton of PE3-6 
-        GPIOE->AFR[0] &=
-            ~(  0xF << 12 | // PE3
-                0xF << 16 | // PE4
-                0xF << 20 | // PE5
-                0xF << 24 );// PE6 
-
-            // Set the Alternate function of PE3-6 
-        GPIOE->AFR[0] |=
-                6 << 12 |   // PE3  Alternalte Funciton 6
-                6 << 16 |   // PE4  Alternalte Funciton 6
-                6 << 20 |   // PE5  Alternalte Funciton 6
-                6 << 24 ;   // PE6  Alternalte Funciton 6
+                // Set the pin mode as Alternate Function
+            gpio->MODER &= ~( 3 << ( n * 2 ) );
+            gpio->MODER |= 2 << ( n * 2 );
+            
+                // Clear the OTYPE field ( Clear is push-pull )
+            gpio->OTYPER &= ~( 1 << n );
+            
+                // Set the OSPEEDR. DAC is medium speed. Others are input.
+            gpio->OSPEEDR &= ~( 3 << ( n * 2 ) );
+            gpio->OSPEEDR |= ( pin.output ? 1 : 0 ) << ( n * 2 );
+            
+                // Clear the PUPDR field ( Clear is no pull-up/no pull-down )
+            gpio->PUPDR &= ~( 3 << ( n * 2 ) );
+            
+                // Set the Alternate function
+            gpio->AFR[n / 8] &= ~( 0xF << ( ( n % 8 ) * 4 ) );
+            gpio->AFR[n / 8] |= pin.af << ( ( n % 8 ) * 4 );
+        }
 
         // Now, we set all the pin. We don't need to wait the WS, 
         // Because SAI has TX/RX sync.
     }
-
     
         // Start I2S transfer. Interrupt starts  
-    void hal_i2s_start(void)
+    void hal_i2s_start( unsigned int port )
     {
+        const sai_port_type & p = sai_ports[port];
+        
             // Setup SAI Block configuration register.
             // Block A : RX
             // Block B : TX
             
             // Block B is sync to Block A. So, Block B first.
-        SAI1_Block_B->CR1 |= 
+        p.tx->CR1 |= 
             1 << 16 ;   // SAIXEN   : 0, Disable, 1, Enable. Disable at this moment
             // Now, Block A and B start together
-        SAI1_Block_A->CR1 |= 
+        p.rx->CR1 |= 
             1 << 16 ;   // SAIXEN   : 0, Disable, 1, Enable. Disable at this moment
 
     }
  
-    IRQn_Type hal_get_i2s_irq_id(void)
+    IRQn_Type hal_get_i2s_irq_id( unsigned int port )
     {
-        return SAI1_IRQn;
+        return sai_ports[port].i2s_irq;
     }
     
     
-    IRQn_Type hal_get_process_irq_id(void)
+    IRQn_Type hal_get_process_irq_id( unsigned int port )
     {
-        return SPI6_IRQn;   // STM32F746 SPI6 is killed. This interrupt is assigned for signal processing in Unzen
+        return sai_ports[port].process_irq;     // STM32F746 SPI6 ( and SPI5 ) is killed. This interrupt is assigned for signal processing in Unzen
     }
     
     
@@ -319,11 +396,10 @@ RCC_PLLSAICFGR :24003000
     unsigned int hal_get_i2s_irq_priority_level(void)
     {
            // STM32F746 has 4 bits priority field. So, heighest is 0, lowest is 15.
-           // But CMSIS NVIC_SetPriority() inverse the priority of the interupt ( F**k! )
-           // Then, 15 is heighest, 0 is lowerest in CMSIS.
-           // setting 12 as i2s irq priority allows, some other interrupts are higher 
+           // setting 4 as i2s irq priority allows, some other interrupts are higher 
            // and some others are lower than i2s irq priority.
-        return 12;
+           // The DMA irq shares this priority level. 
+        return 4;
     }
 
 
@@ -331,33 +407,313 @@ RCC_PLLSAICFGR :24003000
     unsigned int hal_get_process_irq_priority_level(void)
     {
            // STM32F746 has 4 bits priority field. So, heighest is 0, lowest is 15.
-           // But CMSIS NVIC_SetPriority() inverse the priority of the interupt ( S**t! )
-           // Then 15 is heighest, 0 is lowerest in CMSIS.
-           // setting 4 as process priority allows, some other interrupts are higher 
+           // setting 12 as process priority allows, some other interrupts are higher 
            // and some other interrupts are lower then process priority.
-        return 4;   
+        return 12;   
     }
  
-        // STM32F746 transferes 2 wordｓ ( left and right ) for each interrupt.
-    unsigned int hal_data_per_sample(void)
+    void hal_irq_setup( IRQn_Type irq, void (* handler )(void) )
     {
-        return 2;
+        NVIC_SetVector( irq, (uint32_t)handler );
+        NVIC_EnableIRQ( irq );
+    }
+    
+    void hal_set_irq_priority( IRQn_Type irq, unsigned int pri )
+    {
+        NVIC_SetPriority( irq, pri );
+    }
+    
+    void hal_trigger_irq( IRQn_Type irq )
+    {
+        NVIC->STIR = irq;
+    }
+    
+#if defined( MBED_CONF_RTOS_PRESENT )
+        // Process threads of thread_execution. Created at the first start. 
+        // The stack must hold the call back. 
+    static const unsigned int process_thread_stack_size = 4096;
+    static rtos::Thread * process_threads[max_ports];
+    static void (* volatile process_thread_handlers[max_ports] )(void);
+    
+    template < unsigned int Port >
+    static void process_thread_body(void)
+    {
+        while ( true )
+        {
+                // The flag is cleared when taken. The signal while processing wakes up again.
+            rtos::ThisThread::flags_wait_any( 1 );
+            process_thread_handlers[Port]();
+        }
+    }
+    
+    void hal_process_thread_start( unsigned int port, void (* handler )(void) )
+    {
+        static_assert( max_ports == 2, "Update the thread table" );
+        static void (* const bodies[max_ports] )(void) = { process_thread_body< 0 >, process_thread_body< 1 > };
+        
+        process_thread_handlers[port] = handler;
+        
+        if ( process_threads[port] == NULL )
+        {
+            process_threads[port] = new rtos::Thread( osPriorityRealtime, process_thread_stack_size );
+            process_threads[port]->start( mbed::callback( bodies[port] ) );
+        }
+    }
+    
+    void hal_process_thread_signal( unsigned int port )
+    {
+            // ISR safe. 
+        process_threads[port]->flags_set( 1 );
+    }
+#else
+        // No RTOS. thread_execution runs in the process irq, same with irq_execution.
+    void hal_process_thread_start( unsigned int port, void (* handler )(void) )
+    {
+        hal_irq_setup( hal_get_process_irq_id( port ), handler );
+    }
+    
+    void hal_process_thread_signal( unsigned int port )
+    {
+        hal_trigger_irq( hal_get_process_irq_id( port ) );
+    }
+#endif
+ 
+        // STM32F746 transferes one frame ( 2 wordｓ, left and right in I2S ) for each interrupt.
+    unsigned int hal_data_per_sample( unsigned int port )
+    {
+        return words_per_frame[port];
     }
 
         // return true when the sample parameter is ready to read.
         // return false when the sample is not ready to read.
-    void hal_get_i2s_rx_data( int & sample)
+    void hal_get_i2s_rx_data( unsigned int port, int & sample )
     {
-            // RX is SAI1_BlockA. See the comment on top of this file
-        sample = SAI1_Block_A->DR;
+            // RX is Block A. See sai_ports
+        sample = sai_ports[port].rx->DR;
     }
     
         // put a sample to I2S TX data regisger
-    void hal_put_i2s_tx_data( int sample )
+    void hal_put_i2s_tx_data( unsigned int port, int sample )
     {
-            // TX is SAI1_Block_B. See the comment on top of this file
-        SAI1_Block_B->DR = sample;
+            // TX is Block B. See sai_ports
+        sai_ports[port].tx->DR = sample;
     }
-}
 
+        // DMA transport.
+        // SAI1 Block A (RX) : DMA2 Stream 1 Channel 0
+        // SAI1 Block B (TX) : DMA2 Stream 5 Channel 0
+        // SAI2 Block A (RX) : DMA2 Stream 4 Channel 3
+        // SAI2 Block B (TX) : DMA2 Stream 7 Channel 0
+        // Both streams run in the double buffer mode. The M0AR/M1AR point the buffer 0/1 of the framework at first.
+        // Then, the framework loads the next buffer of its ring into the idle register at each transfer complete.
+        // Because Block B is sync with Block A, both streams switch the buffer at the same frame.
+        // Only RX stream raises the transfer complete interrupt. 
+        // With the 16bit data, the peripheral side is half word. The FIFO of the stream packs two samples into 
+        // a word of the memory. The SAI FIFO can't pack by itself. The memory side stays half word only when 
+        // the number of samples is odd, because NDTR must be the multiple of the word in the packing. 
+    void hal_i2s_dma_setup( unsigned int port, int32_t * rx_buffer[2], int32_t * tx_buffer[2], unsigned int length )
+    {
+        const sai_port_type & p = sai_ports[port];
+        
+        dma_rx_buffer[port][0] = rx_buffer[0];
+        dma_rx_buffer[port][1] = rx_buffer[1];
+        dma_buffer_length[port] = length;
+        
+        unsigned int bytes = length * sample_bytes[port];
+        unsigned int peripheral_size = ( sample_bytes[port] == 2 ) ? 1 : 2;
+        unsigned int memory_size = ( sample_bytes[port] == 2 && ( length & 1 ) ) ? 1 : 2;
+        unsigned int fifo_mode = ( peripheral_size != memory_size );
+        
+            // Make sure the streams are disabled before configuration
+        p.rx_stream->CR &= ~ ( 1 << 0 );
+        p.tx_stream->CR &= ~ ( 1 << 0 );
+        while ( ( p.rx_stream->CR & ( 1 << 0 ) ) || ( p.tx_stream->CR & ( 1 << 0 ) ) )
+            ;
+            
+            // Clear all the flags of the rx and tx stream
+        *p.rx_flag_clear = 0x3D << p.rx_flag_shift;
+        *p.tx_flag_clear = 0x3D << p.tx_flag_shift;
+
+            // Discard the stale cache lines, before DMA writes.
+            // And write back the tx data which framework may have written.
+#if (__DCACHE_PRESENT == 1)
+        SCB_CleanInvalidateDCache_by_Addr( (uint32_t *)rx_buffer[0], bytes );
+        SCB_CleanInvalidateDCache_by_Addr( (uint32_t *)rx_buffer[1], bytes );
+        SCB_CleanDCache_by_Addr( (uint32_t *)tx_buffer[0], bytes );
+        SCB_CleanDCache_by_Addr( (uint32_t *)tx_buffer[1], bytes );
+#endif
+
+            // RX stream
+        p.rx_stream->PAR  = (uint32_t)&p.rx->DR;
+        p.rx_stream->M0AR = (uint32_t)rx_buffer[0];
+        p.rx_stream->M1AR = (uint32_t)rx_buffer[1];
+        p.rx_stream->NDTR = length;
+        p.rx_stream->FCR  = 
+        fifo_mode << 2 |    // DMDIS    : 0, Direct mode. 1, FIFO mode to pack the half words
+        fifo_mode << 0 ;    // FTH      : Ignored in direct mode. 1, 1/2 FIFO
+        p.rx_stream->CR   = 
+    p.rx_channel << 25 |   // CHSEL    : SAIx_A
+                0 << 23 |   // MBURST   : Single transfer
+                0 << 21 |   // PBURST   : Single transfer
+                0 << 19 |   // CT       : Start from M0AR
+                1 << 18 |   // DBM      : Double buffer mode
+                2 << 16 |   // PL       : High priority
+      memory_size << 13 |   // MSIZE    : 1, 16bit. 2, 32bit
+  peripheral_size << 11 |   // PSIZE    : 1, 16bit. 2, 32bit
+                1 << 10 |   // MINC     : Memory increment
+                0 << 9  |   // PINC     : Fixed peripheral address
+                1 << 8  |   // CIRC     : Circular. Mandatory in double buffer mode
+                0 << 6  |   // DIR      : Peripheral to memory
+                0 << 5  |   // PFCTRL   : DMA is flow controller
+                1 << 4  |   // TCIE     : Transfer complete interrupt enable
+                0 << 3  |   // HTIE     : No half transfer interrupt
+                0 << 2  |   // TEIE     : No transfer error interrupt
+                0 << 1  |   // DMEIE    : No direct mode error interrupt
+                0 << 0  ;   // EN       : Enabled later
+                
+            // TX stream
+        p.tx_stream->PAR  = (uint32_t)&p.tx->DR;
+        p.tx_stream->M0AR = (uint32_t)tx_buffer[0];
+        p.tx_stream->M1AR = (uint32_t)tx_buffer[1];
+        p.tx_stream->NDTR = length;
+        p.tx_stream->FCR  = 
+        fifo_mode << 2 |    // DMDIS    : 0, Direct mode. 1, FIFO mode to unpack the words
+        fifo_mode << 0 ;    // FTH      : Ignored in direct mode. 1, 1/2 FIFO
+        p.tx_stream->CR   = 
+    p.tx_channel << 25 |   // CHSEL    : SAIx_B
+                0 << 23 |   // MBURST   : Single transfer
+                0 << 21 |   // PBURST   : Single transfer
+                0 << 19 |   // CT       : Start from M0AR
+                1 << 18 |   // DBM      : Double buffer mode
+                2 << 16 |   // PL       : High priority
+      memory_size << 13 |   // MSIZE    : 1, 16bit. 2, 32bit
+  peripheral_size << 11 |   // PSIZE    : 1, 16bit. 2, 32bit
+                1 << 10 |   // MINC     : Memory increment
+                0 << 9  |   // PINC     : Fixed peripheral address
+                1 << 8  |   // CIRC     : Circular. Mandatory in double buffer mode
+                1 << 6  |   // DIR      : Memory to peripheral
+                0 << 5  |   // PFCTRL   : DMA is flow controller
+                0 << 4  |   // TCIE     : No interrupt. RX stream triggers the processing.
+                0 << 3  |   // HTIE     : No half transfer interrupt
+                0 << 2  |   // TEIE     : No transfer error interrupt
+                0 << 1  |   // DMEIE    : No direct mode error interrupt
+                0 << 0  ;   // EN       : Enabled later
+                
+            // Enable both stream. The SAI is still disabled. So, no transfer happens until hal_i2s_start().
+        p.tx_stream->CR |= 1 << 0;
+        p.rx_stream->CR |= 1 << 0;
+    }
+    
+    IRQn_Type hal_get_dma_irq_id( unsigned int port )
+    {
+        return sai_ports[port].dma_irq;
+    }
+    
+    int hal_acknowledge_dma_irq( unsigned int port )
+    {
+        const sai_port_type & p = sai_ports[port];
+        int index;
+        
+            // Clear the transfer complete flag of the rx stream.
+        *p.rx_flag_clear = 1 << ( p.rx_flag_shift + 5 );   // CTCIFx
+        
+            // CT shows the buffer which DMA is filling now. Then, the other one is completed.
+        if ( p.rx_stream->CR & ( 1 << 19 ) )
+            index = 0;
+        else
+            index = 1;
+            
+            // Discard the stale cache lines of the received data.
+#if (__DCACHE_PRESENT == 1)
+        SCB_InvalidateDCache_by_Addr( (uint32_t *)dma_rx_buffer[port][index], dma_buffer_length[port] * sample_bytes[port] );
+#endif
+        return index;
+    }
+    
+    void hal_i2s_dma_set_buffer( unsigned int port, int index, int32_t rx_buffer[], int32_t tx_buffer[] )
+    {
+        const sai_port_type & p = sai_ports[port];
+        
+        dma_rx_buffer[port][index] = rx_buffer;
+        
+            // Write back the dirty lines now. Otherwise, the eviction may overwrite the data from DMA.
+#if (__DCACHE_PRESENT == 1)
+        SCB_CleanInvalidateDCache_by_Addr( (uint32_t *)rx_buffer, dma_buffer_length[port] * sample_bytes[port] );
+#endif
+
+            // DMA is working on the other slot. So, this register is free to write.
+        if ( index == 0 )
+        {
+            p.rx_stream->M0AR = (uint32_t)rx_buffer;
+            p.tx_stream->M0AR = (uint32_t)tx_buffer;
+        }
+        else
+        {
+            p.rx_stream->M1AR = (uint32_t)rx_buffer;
+            p.tx_stream->M1AR = (uint32_t)tx_buffer;
+        }
+    }
+    
+    void hal_i2s_dma_flush_tx( int32_t tx_buffer[], unsigned int length )
+    {
+#if (__DCACHE_PRESENT == 1)
+        SCB_CleanDCache_by_Addr( (uint32_t *)tx_buffer, length * sizeof(int32_t) );
+#endif
+    }
+    
+    void hal_i2s_dma_discard_rx( int32_t rx_buffer[], unsigned int length )
+    {
+            // The buffer is aligned and padded to the cache line. So, no other data is discarded.
+#if (__DCACHE_PRESENT == 1)
+        SCB_InvalidateDCache_by_Addr( (uint32_t *)rx_buffer, length * sizeof(int32_t) );
+#endif
+    }
+    
+        // The NDTR can't be changed while the stream is enabled. Stop everything, and start again.
+    void hal_i2s_dma_stop( unsigned int port )
+    {
+        const sai_port_type & p = sai_ports[port];
+        
+            // Stop the SAI. The SAIXEN bit stays 1 until the end of the current frame.
+        p.tx->CR1 &= ~ ( 1 << 16 );
+        p.rx->CR1 &= ~ ( 1 << 16 );
+    }
+    
+    bool hal_i2s_dma_restart( unsigned int port, int32_t * rx_buffer[2], int32_t * tx_buffer[2], unsigned int length )
+    {
+        const sai_port_type & p = sai_ports[port];
+        
+            // The current frame is not completed yet. The registers can't be changed until SAIXEN is cleared.
+        if ( ( p.rx->CR1 & ( 1 << 16 ) ) || ( p.tx->CR1 & ( 1 << 16 ) ) )
+            return false;
+            
+            // Discard the data left in the FIFO. Then, both blocks start from the first slot.
+        p.rx->CR2 |= 1 << 3;        // FFLUSH
+        p.tx->CR2 |= 1 << 3;        // FFLUSH
+        
+            // Program the streams from the buffer 0, and start at the next WS like the first start. 
+        hal_i2s_dma_setup( port, rx_buffer, tx_buffer, length );
+        hal_i2s_pin_config_and_wait_ws( port );
+        hal_i2s_start( port );
+        return true;
+    }
+    
+        // The DWT cycle counter of Cortex-M7. It counts the core clock. 
+    void hal_cycle_counter_setup(void)
+    {
+        CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;     // Enable the DWT
+        DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;                // Start CYCCNT
+    }
+    
+    unsigned int hal_get_cycle_count(void)
+    {
+        return DWT->CYCCNT;
+    }
+    
+    unsigned int hal_get_cycle_frequency(void)
+    {
+        return SystemCoreClock;
+    }
+}
 
+#endif  // UNZEN_HOST
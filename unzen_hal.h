@@ -1,53 +1,132 @@
 #ifndef _UNZEN_HAL_H_
 #define _UNZEN_HAL_H_
 
+#ifdef UNZEN_HOST
+#include "unzen_hal_host.h"
+#else
 #include "mbed.h"
+#endif
 
-namespace unzen 
+namespace unzen
 {
+        // Most of the APIs take port. The port is the index of the I2S peripheral, 0 .. max_ports - 1.
+        // Each port has its own I2S IRQ, DMA IRQ and process IRQ. The HAL keeps the state of each port separately.
+
         // Set up I2S peripheral to ready to start.
-        // By this HAL, the I2S have to become : 
+        // By this HAL, the I2S have to become :
         // - slave mode
         // - clock must be ready
-    void hal_i2s_setup(void);
-    
-        // configure the pins of I2S and then, wait for WS. 
+        // If dma is true, the peripheral have to issue the DMA request instead of the FIFO interrupt.
+        // channels is the number of slots in a frame. 2 is I2S. More than 2 is TDM. 
+        // data_bits is the size of a slot and a sample, 32 or 16. With 16, the FIFO data is right aligned, 
+        // and the DMA packs two samples into a word of the buffers. 
+    void hal_i2s_setup( unsigned int port, bool dma, unsigned int channels, unsigned int data_bits );
+
+        // configure the pins of I2S and then, wait for WS.
         // This waiting is important to avoid the delay between TX and RX.
         // The HAL API will wait for the WS changes from left to right then return.
-        // The procesure is : 
+        // The procesure is :
         // 1. configure WS pin as GPIO
         // 2. wait the WS rising edge
         // 3. configure all pins as I2S
-    void hal_i2s_pin_config_and_wait_ws(void);
+    void hal_i2s_pin_config_and_wait_ws( unsigned int port );
+
 
-    
-        // Start I2S transfer. Interrupt starts  
-    void hal_i2s_start(void);
+        // Start I2S transfer. Interrupt starts
+    void hal_i2s_start( unsigned int port );
+
+        // returns the IRQ ID for I2S RX interrupt
+    IRQn_Type hal_get_i2s_irq_id( unsigned int port );
 
-        // returns the IRQ ID for I2S RX interrupt 
-    IRQn_Type hal_get_i2s_irq_id(void);
-    
         // returns the IRQ ID for process IRQ. Typically, this is allocated to the reserved IRQ.
-    IRQn_Type hal_get_process_irq_id(void);
-    
+        // Each port must have the different one. The framework may use the one of port 0 for all ports.
+    IRQn_Type hal_get_process_irq_id( unsigned int port );
+
         // The returned value must be compatible with CMSIS NVIC_SetPriority() API. That mean, it is integer like 0, 1, 2...
     unsigned int hal_get_i2s_irq_priority_level(void);
 
         // The returned value must be compatible with CMSIS NVIC_SetPriority() API. That mean, it is integer like 0, 1, 2...
     unsigned int hal_get_process_irq_priority_level(void);
 
- 
+        // Register the handler to the interrupt vector of irq, then enable the irq.
+    void hal_irq_setup( IRQn_Type irq, void (* handler )(void) );
+
+        // The pri must be compatible with CMSIS NVIC_SetPriority() API.
+    void hal_set_irq_priority( IRQn_Type irq, unsigned int pri );
+
+        // Raise the irq by software. Used to trigger the process IRQ.
+    void hal_trigger_irq( IRQn_Type irq );
+
+        // Start the process thread of the port, instead of the process IRQ. The thread waits for 
+        // hal_process_thread_signal(), and calls the handler. It runs at the highest priority of the RTOS.
+        // If the thread is already running, only the handler is replaced.
+        // Without RTOS ( MBED_CONF_RTOS_PRESENT is not defined ), the process IRQ is used instead.
+    void hal_process_thread_start( unsigned int port, void (* handler )(void) );
+
+        // Wake up the process thread of the port. Called from the I2S irq. The signal while the handler 
+        // is running makes it run again, same with the pending irq.
+    void hal_process_thread_signal( unsigned int port );
+
         // reutun the intenger value which tells how much data have to be transfered for each
-        // interrupt. For example, if the stereo 32bit data ( total 64 bit ) have to be sent, 
-        // have to return 2. 
-    unsigned int hal_data_per_sample(void);
-
-        // get data from I2S RX peripheral. Where sample is one audio data. Stereo data is constructed by 2 samples.   
-    void hal_get_i2s_rx_data( int & sample);
-    
-        // put data into I2S TX peripheral. Where sample is one audio data. Stereo data is constructed by 2 samples.   
-    void hal_put_i2s_tx_data( int sample );
+        // interrupt. For example, if the stereo 32bit data ( total 64 bit ) have to be sent,
+        // have to return 2. In TDM, this is the number of channels given to hal_i2s_setup().
+    unsigned int hal_data_per_sample( unsigned int port );
+
+        // get data from I2S RX peripheral. Where sample is one audio data. Stereo data is constructed by 2 samples.
+    void hal_get_i2s_rx_data( unsigned int port, int & sample );
+
+        // put data into I2S TX peripheral. Where sample is one audio data. Stereo data is constructed by 2 samples.
+    void hal_put_i2s_tx_data( unsigned int port, int sample );
+
+        // Set up the DMA transport. Must be called after hal_i2s_setup( true ), and before hal_i2s_start().
+        // The RX DMA fills rx_buffer[0], rx_buffer[1], rx_buffer[0], ... circularly.
+        // The TX DMA sends tx_buffer[0], tx_buffer[1], tx_buffer[0], ... in the same order.
+        // The index 0 and 1 are the buffer slots of DMA. They can be changed by hal_i2s_dma_set_buffer().
+        // length is the number of samples in each buffer. The data format is LRLR... or frame major in TDM.
+        // Each sample is int32_t, or int16_t if data_bits of hal_i2s_setup() is 16.
+        // The buffers must be aligned to the cache line, and padded to the multiple of the cache line.
+        // The DMA irq is raised for each time one buffer is completed.
+    void hal_i2s_dma_setup( unsigned int port, int32_t * rx_buffer[2], int32_t * tx_buffer[2], unsigned int length );
+
+        // returns the IRQ ID for the DMA interrupt.
+    IRQn_Type hal_get_dma_irq_id( unsigned int port );
+
+        // Clear the DMA interrupt, and return the index ( 0 or 1 ) of the buffer which the DMA has just completed.
+        // After this call, the rx buffer of the returned index is visible to CPU.
+        // The tx buffer of the same index is free to write until the DMA comes back to this index.
+    int hal_acknowledge_dma_irq( unsigned int port );
+
+        // Replace the buffers of the given slot. The DMA uses them when it comes back to this slot.
+        // Must be called in the DMA irq, with the index returned by hal_acknowledge_dma_irq().
+        // The TX DMA runs ahead by the I2S FIFO. Then, length must be longer than the FIFO.
+    void hal_i2s_dma_set_buffer( unsigned int port, int index, int32_t rx_buffer[], int32_t tx_buffer[] );
+
+        // Make the tx buffer written by CPU visible to DMA. length is the size of the data [word].
+    void hal_i2s_dma_flush_tx( int32_t tx_buffer[], unsigned int length );
+
+        // Discard the cache lines of the rx buffer which CPU has written as the work area. Otherwise, 
+        // the eviction of the dirty lines may overwrite the data from DMA. length is the size of the data [word].
+    void hal_i2s_dma_discard_rx( int32_t rx_buffer[], unsigned int length );
+
+        // Stop the running DMA transport to restart it. Called in the DMA irq. Doesn't wait.
+        // The I2S stops at the end of the current frame. The DMA irq may come once more until then.
+    void hal_i2s_dma_stop( unsigned int port );
+
+        // Restart the DMA transport stopped by hal_i2s_dma_stop() with the new buffers and length. 
+        // Called in the process irq or thread. Same with hal_i2s_dma_setup(), and the I2S starts again 
+        // from the next WS. Some frames are lost. The framework calls this only while the output is silent.
+        // Returns false without touching DMA, if the I2S has not reported stopped yet. Then, call again later.
+    bool hal_i2s_dma_restart( unsigned int port, int32_t * rx_buffer[2], int32_t * tx_buffer[2], unsigned int length );
+
+        // Start the free running cycle counter for the profiler. Can be called many times.
+    void hal_cycle_counter_setup(void);
+
+        // Read the cycle counter. It wraps around at 32bit. Must be cheap. It is read several times in each block.
+    unsigned int hal_get_cycle_count(void);
+
+        // Frequency of the cycle counter [Hz].
+    unsigned int hal_get_cycle_frequency(void);
 }
 
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,669 @@
+#ifdef UNZEN_HOST
+
+#include <stdio.h>
+#include <math.h>
+#include <time.h>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+
+#include "unzen.h"
+#include "unzen_hal.h"
+
+// Simulation of the Unzen HAL on the host computer.
+// The transport thread works as I2S and DMA. In each step, it receives the rx data from the source,
+// raises the I2S irq ( FIFO transport, one frame per step ) or the DMA irq ( DMA transport, one buffer
+// per step ), then gives the tx data to the sink.
+// The process IRQ is a deferred call by default. Then the process IRQ is executed inside the I2S/DMA irq,
+// as if it has higher priority. Optionally, it runs in its own thread to simulate the preemption by I2S.
+// Each port has its own peripheral status and IRQs. The transport thread moves the started ports together.
+// In each step, the port which is the most behind moves. Then, the ports share one time base like the codecs
+// sharing one clock. 
+namespace unzen
+{
+        // Simulated IRQ IDs of a port. The IRQ ID is port * irq_per_port + these. 
+    enum {
+        i2s_irq_id,
+        process_irq_id,
+        dma_irq_id,
+        irq_per_port
+        };
+    const int number_of_irq = max_ports * irq_per_port;
+
+        // Simulated vector table.
+    static void (* vector_table[number_of_irq] )(void);
+
+        // Simulated peripheral status of a port
+    struct host_port_type
+    {
+        std::atomic<bool> started;
+        bool dma_enabled;
+        unsigned int words_per_frame;
+        bool short_data;
+        int32_t * dma_rx_buffer[2];
+        int32_t * dma_tx_buffer[2];
+        unsigned int dma_buffer_length;
+        int dma_index;
+        
+            // Set by hal_i2s_dma_stop(). The transport thread doesn't touch the DMA buffers until the restart.
+        std::atomic<bool> dma_stopped;
+        
+            // Q31 words on the wire, for the 16bit DMA buffers. 
+        std::vector<int32_t> dma_wire;
+
+            // Simulated FIFO. One frame.
+        int32_t fifo_rx_frame[max_channels];
+        int32_t fifo_tx_frame[max_channels];
+        unsigned int fifo_rx_position;
+        unsigned int fifo_tx_position;
+
+        void (* source )( int32_t rx[], unsigned int length );
+        void (* sink )( const int32_t tx[], unsigned int length );
+
+            // Built in source and sink
+        bool sine_enabled;
+        double sine_phase;
+        double sine_delta;
+        int32_t sine_amplitude;
+        FILE * source_file;
+        FILE * sink_file;
+
+            // Time of the port [frame], and the time of hal_i2s_start(). 
+        std::atomic<unsigned long> position;
+        unsigned long start_position;
+    };
+
+    static host_port_type ports[max_ports];
+    static unsigned int sample_rate = 48000;
+
+        // Transport thread
+    static host_clock_type clock_type = host_realtime_clock;
+    static std::thread transport_thread;
+    static std::atomic<bool> transport_running( false );
+
+        // Process thread. Same with NVIC, the process IRQs of the ports don't preempt each other.
+    static bool process_threaded = false;
+    static std::thread process_thread;
+    static std::mutex process_mutex;
+    static std::condition_variable process_condition;
+    static bool process_pending[max_ports];
+    static std::atomic<bool> process_running( false );
+
+        // Threads of thread_execution. One for each port. Not related to the simulated process IRQ.
+        // The host has no real time priority. The OS scheduler decides the latency.
+    struct host_process_thread_type
+    {
+        std::thread thread;
+        std::mutex mutex;
+        std::condition_variable condition;
+        bool signaled;
+        bool running;
+        void (* handler )(void);
+    };
+
+    static host_process_thread_type process_threads[max_ports];
+
+    static void sine_source( host_port_type & p, int32_t rx[], unsigned int length )
+    {
+        for ( unsigned int i=0; i<length; i+=p.words_per_frame )
+        {
+            int32_t value = (int32_t)( p.sine_amplitude * sin( p.sine_phase ) );
+
+            for ( unsigned int ch=0; ch<p.words_per_frame; ch++ )
+                rx[i+ch] = value;
+
+            p.sine_phase += p.sine_delta;
+            if ( p.sine_phase >= 2 * M_PI )
+                p.sine_phase -= 2 * M_PI;
+        }
+    }
+
+    static void file_source( host_port_type & p, int32_t rx[], unsigned int length )
+    {
+        size_t count = fread( rx, sizeof(int32_t), length, p.source_file );
+
+            // Silence after the end of file.
+        for ( unsigned int i=count; i<length; i++ )
+            rx[i] = 0;
+    }
+
+        // Fill the received data by the source of the port.
+    static void receive( host_port_type & p, int32_t rx[], unsigned int length )
+    {
+        if ( p.source )
+            p.source( rx, length );
+        else if ( p.source_file )
+            file_source( p, rx, length );
+        else if ( p.sine_enabled )
+            sine_source( p, rx, length );
+        else
+            for ( unsigned int i=0; i<length; i++ )
+                rx[i] = 0;
+    }
+
+        // Give the sent data to the sink of the port.
+    static void send( host_port_type & p, const int32_t tx[], unsigned int length )
+    {
+        if ( p.sink )
+            p.sink( tx, length );
+        else if ( p.sink_file )
+            fwrite( tx, sizeof(int32_t), length, p.sink_file );
+    }
+
+        // One DMA step of the 16bit data. The buffers are int16_t, but the source and the sink see the Q31 words. 
+    static void transfer_short_data( host_port_type & p )
+    {
+        int32_t * wire = &p.dma_wire[0];
+        const int16_t * tx = (const int16_t *)p.dma_tx_buffer[p.dma_index];
+        int16_t * rx = (int16_t *)p.dma_rx_buffer[p.dma_index];
+        
+        for ( unsigned int i=0; i<p.dma_buffer_length; i++ )
+            wire[i] = (int32_t)( (uint32_t)tx[i] << 16 );
+        send( p, wire, p.dma_buffer_length );
+        receive( p, wire, p.dma_buffer_length );
+        for ( unsigned int i=0; i<p.dma_buffer_length; i++ )
+            rx[i] = (int16_t)( wire[i] >> 16 );
+    }
+
+        // Move one step of the transport of a port. Returns the number of frames moved.
+    static unsigned int transport_step( unsigned int port )
+    {
+        host_port_type & p = ports[port];
+        
+            // Stopped for the restart. The codec keeps running, and these frames are lost. 
+        if ( p.dma_enabled && p.dma_stopped )
+        {
+            receive( p, p.fifo_rx_frame, p.words_per_frame );
+            for ( unsigned int i=0; i<p.words_per_frame; i++ )
+                p.fifo_tx_frame[i] = 0;
+            send( p, p.fifo_tx_frame, p.words_per_frame );
+            return 1;
+        }
+        
+        if ( p.dma_enabled )
+        {
+                // The DMA receives one rx buffer, and sends one tx buffer in a period.
+            if ( p.short_data )
+            {
+                transfer_short_data( p );
+            }
+            else
+            {
+                send( p, p.dma_tx_buffer[p.dma_index], p.dma_buffer_length );
+                receive( p, p.dma_rx_buffer[p.dma_index], p.dma_buffer_length );
+            }
+
+                // Go to the other buffer, and raise transfer complete interrupt. Like CT bit of the target.
+            unsigned int frames = p.dma_buffer_length / p.words_per_frame;
+            
+            p.dma_index = 1 - p.dma_index;
+            if ( vector_table[port * irq_per_port + dma_irq_id] )
+                vector_table[port * irq_per_port + dma_irq_id]();
+
+            return frames;
+        }
+        else
+        {
+                // One frame in the rx FIFO raises the I2S irq. The irq reads it and writes one tx frame.
+            receive( p, p.fifo_rx_frame, p.words_per_frame );
+
+            p.fifo_rx_position = 0;
+            p.fifo_tx_position = 0;
+            if ( vector_table[port * irq_per_port + i2s_irq_id] )
+                vector_table[port * irq_per_port + i2s_irq_id]();
+
+            send( p, p.fifo_tx_frame, p.words_per_frame );
+
+            return 1;
+        }
+    }
+
+        // The started port which is the most behind. -1 if no port is started.
+    static int next_port(void)
+    {
+        int next = -1;
+
+        for ( int port=0; port<max_ports; port++ )
+            if ( ports[port].started && ( next < 0 || ports[port].position < ports[next].position ) )
+                next = port;
+
+        return next;
+    }
+
+        // Current time of the transport [frame].
+    static unsigned long current_position(void)
+    {
+        int port = next_port();
+
+        return port < 0 ? 0 : ports[port].position.load();
+    }
+
+        // Move the port which is the most behind. 
+    static void transport_step_next(void)
+    {
+        int port = next_port();
+
+        if ( port >= 0 )
+            ports[port].position += transport_step( port );
+    }
+
+    static void transport_thread_body(void)
+    {
+            // Sleep at least each 1mS in the real time clock. Sleep for each frame is too heavy.
+        const unsigned long sleep_interval = sample_rate / 1000 + 1;
+        const unsigned long origin = current_position();
+        unsigned long next_sleep = 0;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        while ( transport_running )
+        {
+            transport_step_next();
+
+            unsigned long frames = current_position() - origin;
+            if ( clock_type == host_realtime_clock && frames >= next_sleep )
+            {
+                std::this_thread::sleep_until( start + std::chrono::nanoseconds( 1000000000LL * frames / sample_rate ) );
+                next_sleep = frames + sleep_interval;
+            }
+        }
+    }
+
+    static void process_thread_body(void)
+    {
+        std::unique_lock<std::mutex> lock( process_mutex );
+
+        while ( true )
+        {
+            process_condition.wait( lock, []{ 
+                for ( int port=0; port<max_ports; port++ )
+                    if ( process_pending[port] )
+                        return true;
+                return ! process_running; 
+                } );
+            if ( ! process_running )
+                break;
+
+                // Same with NVIC. The trigger while running makes the irq pending again.
+                // The lower port first, like the lower IRQ number in the same priority.
+            for ( int port=0; port<max_ports; port++ )
+            {
+                if ( ! process_pending[port] )
+                    continue;
+                    
+                process_pending[port] = false;
+                lock.unlock();
+                if ( vector_table[port * irq_per_port + process_irq_id] )
+                    vector_table[port * irq_per_port + process_irq_id]();
+                lock.lock();
+            }
+        }
+    }
+
+    static void execution_thread_body( host_process_thread_type * t )
+    {
+        std::unique_lock<std::mutex> lock( t->mutex );
+
+        while ( true )
+        {
+            t->condition.wait( lock, [t]{ return t->signaled || ! t->running; } );
+            if ( ! t->running )
+                break;
+
+                // Same with the thread flag. The signal while running wakes up again.
+            t->signaled = false;
+            lock.unlock();
+            t->handler();
+            lock.lock();
+        }
+    }
+
+    void hal_process_thread_start( unsigned int port, void (* handler )(void) )
+    {
+        host_process_thread_type & t = process_threads[port];
+        std::lock_guard<std::mutex> lock( t.mutex );
+
+        t.handler = handler;
+        if ( ! t.running )
+        {
+            t.running = true;
+            t.signaled = false;
+            t.thread = std::thread( execution_thread_body, &t );
+        }
+    }
+
+    void hal_process_thread_signal( unsigned int port )
+    {
+        host_process_thread_type & t = process_threads[port];
+        std::lock_guard<std::mutex> lock( t.mutex );
+
+        t.signaled = true;
+        t.condition.notify_one();
+    }
+
+    void hal_i2s_setup( unsigned int port, bool dma, unsigned int channels, unsigned int data_bits )
+    {
+        ports[port].dma_enabled = dma;
+        ports[port].words_per_frame = channels;
+        ports[port].short_data = ( data_bits == 16 );
+    }
+
+    void hal_i2s_pin_config_and_wait_ws( unsigned int )
+    {
+            // Nothing to do on host.
+    }
+
+    void hal_i2s_start( unsigned int port )
+    {
+        host_port_type & p = ports[port];
+
+            // Join the time of the running ports.
+        p.position = current_position();
+        p.start_position = p.position;
+        p.dma_index = 0;
+        p.started = true;
+
+        if ( process_threaded && ! process_running )
+        {
+            process_running = true;
+            process_thread = std::thread( process_thread_body );
+        }
+
+            // With the manual clock, hal_host_run() moves the transport.
+        if ( clock_type != host_manual_clock && ! transport_running )
+        {
+            transport_running = true;
+            transport_thread = std::thread( transport_thread_body );
+        }
+    }
+
+    IRQn_Type hal_get_i2s_irq_id( unsigned int port )
+    {
+        return port * irq_per_port + i2s_irq_id;
+    }
+
+    IRQn_Type hal_get_process_irq_id( unsigned int port )
+    {
+        return port * irq_per_port + process_irq_id;
+    }
+
+    unsigned int hal_get_i2s_irq_priority_level(void)
+    {
+        return 0;   // meaningless on host
+    }
+
+    unsigned int hal_get_process_irq_priority_level(void)
+    {
+        return 0;   // meaningless on host
+    }
+
+    void hal_irq_setup( IRQn_Type irq, void (* handler )(void) )
+    {
+        vector_table[irq] = handler;
+    }
+
+    void hal_set_irq_priority( IRQn_Type, unsigned int )
+    {
+            // Simulated interrupts have no priority
+    }
+
+    void hal_trigger_irq( IRQn_Type irq )
+    {
+            // Wake up the process thread, if it is running.
+        if ( irq % irq_per_port == process_irq_id && process_running )
+        {
+            std::lock_guard<std::mutex> lock( process_mutex );
+            process_pending[irq / irq_per_port] = true;
+            process_condition.notify_one();
+            return;
+        }
+
+            // Deferred call.
+        if ( vector_table[irq] )
+            vector_table[irq]();
+    }
+
+    unsigned int hal_data_per_sample( unsigned int port )
+    {
+        return ports[port].words_per_frame;
+    }
+
+    void hal_get_i2s_rx_data( unsigned int port, int & sample )
+    {
+        host_port_type & p = ports[port];
+
+            // Empty FIFO gives zero. The 16bit data is right aligned, like the SAI. 
+        if ( p.fifo_rx_position < p.words_per_frame )
+            sample = p.fifo_rx_frame[p.fifo_rx_position++];
+        else
+            sample = 0;
+        if ( p.short_data )
+            sample = (int16_t)( sample >> 16 );
+    }
+
+    void hal_put_i2s_tx_data( unsigned int port, int sample )
+    {
+        host_port_type & p = ports[port];
+
+            // Full FIFO drops the data. The 16bit data is taken from the lower half. 
+        if ( p.short_data )
+            sample = (int32_t)( (uint32_t)sample << 16 );
+        if ( p.fifo_tx_position < p.words_per_frame )
+            p.fifo_tx_frame[p.fifo_tx_position++] = sample;
+    }
+
+    void hal_i2s_dma_setup( unsigned int port, int32_t * rx_buffer[2], int32_t * tx_buffer[2], unsigned int length )
+    {
+        host_port_type & p = ports[port];
+
+        p.dma_rx_buffer[0] = rx_buffer[0];
+        p.dma_rx_buffer[1] = rx_buffer[1];
+        p.dma_tx_buffer[0] = tx_buffer[0];
+        p.dma_tx_buffer[1] = tx_buffer[1];
+        p.dma_buffer_length = length;
+        p.dma_wire.resize( length );
+        p.dma_stopped = false;
+    }
+
+    IRQn_Type hal_get_dma_irq_id( unsigned int port )
+    {
+        return port * irq_per_port + dma_irq_id;
+    }
+
+    int hal_acknowledge_dma_irq( unsigned int port )
+    {
+            // Called inside the transport step. The other buffer is completed.
+        return 1 - ports[port].dma_index;
+    }
+
+    void hal_i2s_dma_set_buffer( unsigned int port, int index, int32_t rx_buffer[], int32_t tx_buffer[] )
+    {
+            // Called in the DMA irq. So, same thread with the transport.
+        ports[port].dma_rx_buffer[index] = rx_buffer;
+        ports[port].dma_tx_buffer[index] = tx_buffer;
+    }
+
+    void hal_i2s_dma_flush_tx( int32_t [], unsigned int )
+    {
+            // Host has coherent cache.
+    }
+
+    void hal_i2s_dma_discard_rx( int32_t [], unsigned int )
+    {
+            // Host has coherent cache.
+    }
+
+    void hal_i2s_dma_stop( unsigned int port )
+    {
+            // The simulated I2S stops at the end of the current step.
+        ports[port].dma_stopped = true;
+    }
+
+    bool hal_i2s_dma_restart( unsigned int port, int32_t * rx_buffer[2], int32_t * tx_buffer[2], unsigned int length )
+    {
+            // The next step starts from the buffer 0. hal_i2s_dma_setup() gives the port back to the transport thread.
+        ports[port].dma_index = 0;
+        hal_i2s_dma_setup( port, rx_buffer, tx_buffer, length );
+        return true;
+    }
+
+        // The monotonic clock in nS. A cycle is 1nS on host. 
+    void hal_cycle_counter_setup(void)
+    {
+    }
+
+    unsigned int hal_get_cycle_count(void)
+    {
+        struct timespec now;
+
+        clock_gettime( CLOCK_MONOTONIC, &now );
+        return (unsigned int)( now.tv_sec * 1000000000ULL + now.tv_nsec );
+    }
+
+    unsigned int hal_get_cycle_frequency(void)
+    {
+        return 1000000000;
+    }
+
+    void hal_host_set_sample_rate( unsigned int fs )
+    {
+        sample_rate = fs;
+    }
+
+    void hal_host_set_clock( host_clock_type clock )
+    {
+        clock_type = clock;
+    }
+
+    void hal_host_set_process_thread( bool threaded )
+    {
+        process_threaded = threaded;
+    }
+
+    void hal_host_set_source( void (* rx_source )( int32_t rx[], unsigned int length ), unsigned int port )
+    {
+        ports[port].source = rx_source;
+    }
+
+    void hal_host_set_sink( void (* tx_sink )( const int32_t tx[], unsigned int length ), unsigned int port )
+    {
+        ports[port].sink = tx_sink;
+    }
+
+    void hal_host_set_sine_source( double frequency, double amplitude, unsigned int port )
+    {
+        host_port_type & p = ports[port];
+
+        p.sine_phase = 0;
+        p.sine_delta = 2 * M_PI * frequency / sample_rate;
+        p.sine_amplitude = (int32_t)( amplitude * INT32_MAX );
+        p.sine_enabled = true;
+        p.source = NULL;
+        if ( p.source_file )
+        {
+            fclose( p.source_file );
+            p.source_file = NULL;
+        }
+    }
+
+    bool hal_host_set_file_source( const char * filename, unsigned int port )
+    {
+        host_port_type & p = ports[port];
+
+        if ( p.source_file )
+            fclose( p.source_file );
+
+        p.source_file = fopen( filename, "rb" );
+        if ( ! p.source_file )
+            return false;
+
+        p.source = NULL;
+        p.sine_enabled = false;
+        return true;
+    }
+
+    bool hal_host_set_file_sink( const char * filename, unsigned int port )
+    {
+        host_port_type & p = ports[port];
+
+        if ( p.sink_file )
+            fclose( p.sink_file );
+
+        p.sink_file = fopen( filename, "wb" );
+        if ( ! p.sink_file )
+            return false;
+
+        p.sink = NULL;
+        return true;
+    }
+
+    void hal_host_run( unsigned long frames )
+    {
+        unsigned long target = current_position() + frames;
+
+        while ( next_port() >= 0 && current_position() < target )
+            transport_step_next();
+    }
+
+    unsigned long hal_host_get_frame_count( unsigned int port )
+    {
+        return ports[port].position - ports[port].start_position;
+    }
+
+    void hal_host_stop(void)
+    {
+        if ( transport_running )
+        {
+            transport_running = false;
+            transport_thread.join();
+        }
+
+        if ( process_running )
+        {
+            {
+                std::lock_guard<std::mutex> lock( process_mutex );
+                process_running = false;
+                process_condition.notify_one();
+            }
+            process_thread.join();
+        }
+
+        for ( int port=0; port<max_ports; port++ )
+        {
+            host_process_thread_type & t = process_threads[port];
+
+            if ( t.running )
+            {
+                {
+                    std::lock_guard<std::mutex> lock( t.mutex );
+                    t.running = false;
+                    t.condition.notify_one();
+                }
+                t.thread.join();
+            }
+        }
+
+        for ( int port=0; port<max_ports; port++ )
+        {
+            host_port_type & p = ports[port];
+
+            p.started = false;
+            
+            if ( p.source_file )
+            {
+                fclose( p.source_file );
+                p.source_file = NULL;
+            }
+
+            if ( p.sink_file )
+            {
+                fclose( p.sink_file );
+                p.sink_file = NULL;
+            }
+        }
+    }
+}
+
+#endif  // UNZEN_HOST
@@ -0,0 +1,71 @@
+#ifndef _UNZEN_HAL_HOST_H_
+#define _UNZEN_HAL_HOST_H_
+
+// Host ( Linux ) implementation of the Unzen HAL. 
+// Compile all the Unzen source with UNZEN_HOST defined, to run the framework on the host computer.
+// The I2S peripheral and the interrupts are simulated by the threads, or run by hal_host_run(). 
+// All ports run by the same clock. The port parameter selects the simulated I2S port. 
+
+    // Host doesn't have CMSIS. The IRQ ID is just an index of the simulated vector table.
+typedef int IRQn_Type;
+
+#include <stdint.h>
+
+namespace unzen 
+{
+        // Time base of the simulated I2S.
+    enum host_clock_type {
+        host_realtime_clock,        // The transport thread runs at the sampling frequency. Default.
+        host_free_running_clock,    // The transport thread runs as fast as possible. For the throughput measurement.
+        host_manual_clock           // No thread. hal_host_run() moves the transport in the caller. Deterministic.
+        };
+    
+        // Set the simulated sampling frequency [Hz]. Default is 48000. 
+        // Must be called before Framework::start().
+    void hal_host_set_sample_rate( unsigned int fs );
+    
+        // Select the time base. Must be called before Framework::start().
+    void hal_host_set_clock( host_clock_type clock );
+    
+        // By default, the process IRQ is a deferred call inside the I2S/DMA irq. So, it never overruns. 
+        // If threaded is true, the process IRQ runs in its own thread, and the I2S/DMA irq can preempt it. 
+        // Must be called before Framework::start().
+        // Framework::set_execution( thread_execution ) doesn't use the process IRQ. It has its own thread anyway.
+    void hal_host_set_process_thread( bool threaded );
+    
+        // Set the function to generate the received data of the port. 
+        // The source is called from the simulated I2S, each time one rx buffer ( DMA ) or one frame ( FIFO ) is received. 
+        // rx is the buffer to fill in LRLR... format ( frame major in TDM ), and length is the number of words.
+        // If no source is given, zero is received. 
+        // With the 16bit data size, the words are still Q31. The lower 16bit is cut on the simulated wire. 
+    void hal_host_set_source( void (* source )( int32_t rx[], unsigned int length ), unsigned int port = 0 );
+    
+        // Set the function to consume the transmitted data of the port. 
+        // The sink is called from the simulated I2S, each time one tx buffer ( DMA ) or one frame ( FIFO ) is sent. 
+        // tx is the sent data in LRLR... format ( frame major in TDM ), and length is the number of words.
+        // With the 16bit data size, the words are Q31 with the lower 16bit zero. 
+    void hal_host_set_sink( void (* sink )( const int32_t tx[], unsigned int length ), unsigned int port = 0 );
+    
+        // Built in source. Same sine wave on all channels. amplitude is relative to the full scale.
+        // Must be called after hal_host_set_sample_rate().
+    void hal_host_set_sine_source( double frequency, double amplitude, unsigned int port = 0 );
+    
+        // Built in source and sink. The file is raw 32bit PCM in the native endian, with the frame major order.
+        // The source gives zero after the end of file. The files are closed by hal_host_stop().
+        // Returns false when the file can't be opened. 
+    bool hal_host_set_file_source( const char * filename, unsigned int port = 0 );
+    bool hal_host_set_file_sink( const char * filename, unsigned int port = 0 );
+    
+        // Move the transport by given frames, in the caller context. Only for host_manual_clock, after Framework::start().
+        // In DMA transport, the transport moves by the buffer. So, it may move a bit more.
+        // All started ports move together. 
+    void hal_host_run( unsigned long frames );
+    
+        // Number of frames moved since Framework::start() of the port.
+    unsigned long hal_host_get_frame_count( unsigned int port = 0 );
+    
+        // Stop the simulated I2S and join the threads. 
+    void hal_host_stop(void);
+}
+
+#endif
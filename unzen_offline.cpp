@@ -0,0 +1,331 @@
+#ifdef UNZEN_HOST
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <thread>
+#include <atomic>
+
+#include "unzen_offline.h"
+#include "unzen_convert.h"
+
+namespace unzen
+{
+        // WAV format tags
+    static const unsigned int wave_format_pcm = 1;
+    static const unsigned int wave_format_ieee_float = 3;
+    static const unsigned int wave_format_extensible = 0xFFFE;
+
+        // Format of the WAV file.
+    struct wav_format
+    {
+        unsigned int channels;
+        unsigned int sample_rate;
+        unsigned int bytes_per_sample;
+        bool is_float;
+        unsigned long long data_size;   // [byte]. 0 means until the end of file.
+    };
+
+    static unsigned int get_u16( const unsigned char * p )
+    {
+        return p[0] | p[1] << 8;
+    }
+
+    static unsigned int get_u32( const unsigned char * p )
+    {
+        return p[0] | p[1] << 8 | p[2] << 16 | (unsigned int)p[3] << 24;
+    }
+
+    static void put_u16( unsigned char * p, unsigned int value )
+    {
+        p[0] = value;
+        p[1] = value >> 8;
+    }
+
+    static void put_u32( unsigned char * p, unsigned int value )
+    {
+        p[0] = value;
+        p[1] = value >> 8;
+        p[2] = value >> 16;
+        p[3] = value >> 24;
+    }
+
+        // Read the chunks until the data chunk. The file position is left at the top of the samples.
+    static error_type read_wav_header( FILE * file, wav_format & format )
+    {
+        unsigned char header[40];
+        bool has_format = false;
+
+        if ( fread( header, 1, 12, file ) != 12 )
+            return file_format_error;
+        if ( memcmp( header, "RIFF", 4 ) != 0 || memcmp( header + 8, "WAVE", 4 ) != 0 )
+            return file_format_error;
+
+        while ( fread( header, 1, 8, file ) == 8 )
+        {
+            unsigned int size = get_u32( header + 4 );
+
+            if ( memcmp( header, "fmt ", 4 ) == 0 )
+            {
+                if ( size < 16 || size > sizeof(header) )
+                    return file_format_error;
+                if ( fread( header, 1, size, file ) != size )
+                    return file_format_error;
+                if ( size & 1 )
+                    fseek( file, 1, SEEK_CUR );
+
+                unsigned int tag = get_u16( header );
+                unsigned int bits = get_u16( header + 14 );
+
+                    // Extensible format has the real tag in the first 2 bytes of the sub format GUID.
+                if ( tag == wave_format_extensible )
+                {
+                    if ( size < 40 )
+                        return file_format_error;
+                    tag = get_u16( header + 24 );
+                }
+
+                format.channels = get_u16( header + 2 );
+                format.sample_rate = get_u32( header + 4 );
+                format.bytes_per_sample = bits / 8;
+                format.is_float = ( tag == wave_format_ieee_float );
+
+                if ( tag == wave_format_pcm && ( bits == 16 || bits == 24 || bits == 32 ) )
+                    has_format = true;
+                else if ( tag == wave_format_ieee_float && bits == 32 )
+                    has_format = true;
+                else
+                    return file_format_error;
+            }
+            else if ( memcmp( header, "data", 4 ) == 0 )
+            {
+                if ( ! has_format )
+                    return file_format_error;
+
+                    // The streaming writer may leave the size as 0 or 0xFFFFFFFF.
+                format.data_size = ( size == 0xFFFFFFFF ) ? 0 : size;
+                return no_error;
+            }
+            else
+            {
+                    // Skip unknown chunk. Chunks are word aligned.
+                if ( fseek( file, size + ( size & 1 ), SEEK_CUR ) != 0 )
+                    return file_format_error;
+            }
+        }
+
+        return file_format_error;
+    }
+
+        // Write the canonical 44 bytes header.
+    static bool write_wav_header( FILE * file, const wav_format & format, unsigned long long data_size )
+    {
+        unsigned char header[44];
+        unsigned int block_align = format.channels * format.bytes_per_sample;
+
+            // Saturate the size for too long file. Then, the reader will read until the end of file.
+        unsigned int size = ( data_size > 0xFFFFFFFFULL - 36 ) ? 0xFFFFFFFF - 36 : data_size;
+
+        memcpy( header, "RIFF", 4 );
+        put_u32( header + 4, size + 36 );
+        memcpy( header + 8, "WAVE", 4 );
+        memcpy( header + 12, "fmt ", 4 );
+        put_u32( header + 16, 16 );
+        put_u16( header + 20, format.is_float ? wave_format_ieee_float : wave_format_pcm );
+        put_u16( header + 22, format.channels );
+        put_u32( header + 24, format.sample_rate );
+        put_u32( header + 28, format.sample_rate * block_align );
+        put_u16( header + 32, block_align );
+        put_u16( header + 34, format.bytes_per_sample * 8 );
+        memcpy( header + 36, "data", 4 );
+        put_u32( header + 40, size );
+
+        return fwrite( header, 1, sizeof(header), file ) == sizeof(header);
+    }
+
+        // Little endian bytes to Q31. The integer formats are left aligned.
+    static void unpack_samples( const unsigned char src[], int32_t dst[], unsigned int count, const wav_format & format )
+    {
+        switch ( format.bytes_per_sample )
+        {
+        case 2 :
+            for ( unsigned int i=0; i<count; i++, src+=2 )
+                dst[i] = (int32_t)( (uint32_t)get_u16( src ) << 16 );
+            break;
+        case 3 :
+            for ( unsigned int i=0; i<count; i++, src+=3 )
+                dst[i] = (int32_t)( src[0] << 8 | src[1] << 16 | (uint32_t)src[2] << 24 );
+            break;
+        default :
+            for ( unsigned int i=0; i<count; i++, src+=4 )
+            {
+                uint32_t value = get_u32( src );
+
+                if ( format.is_float )
+                {
+                    float sample;
+                    memcpy( &sample, &value, sizeof(sample) );
+                    dst[i] = float_to_q31( sample );
+                }
+                else
+                    dst[i] = (int32_t)value;
+            }
+            break;
+        }
+    }
+
+        // Q31 to little endian bytes. The lower bits are truncated.
+    static void pack_samples( const int32_t src[], unsigned char dst[], unsigned int count, const wav_format & format )
+    {
+        switch ( format.bytes_per_sample )
+        {
+        case 2 :
+            for ( unsigned int i=0; i<count; i++, dst+=2 )
+                put_u16( dst, (uint32_t)src[i] >> 16 );
+            break;
+        case 3 :
+            for ( unsigned int i=0; i<count; i++, dst+=3 )
+            {
+                dst[0] = (uint32_t)src[i] >> 8;
+                dst[1] = (uint32_t)src[i] >> 16;
+                dst[2] = (uint32_t)src[i] >> 24;
+            }
+            break;
+        default :
+            for ( unsigned int i=0; i<count; i++, dst+=4 )
+            {
+                uint32_t value = src[i];
+
+                if ( format.is_float )
+                {
+                    float sample = q31_to_float( src[i] );
+                    memcpy( &value, &sample, sizeof(value) );
+                }
+                put_u32( dst, value );
+            }
+            break;
+        }
+    }
+
+    OfflineFramework::OfflineFramework(void) : Framework( offline_transport )
+    {
+    }
+
+    error_type OfflineFramework::render( const char * input_file, const char * output_file )
+    {
+        if ( _tx_int_buffer[0] == NULL )
+            return memory_allocation_error;
+
+        FILE * input = fopen( input_file, "rb" );
+        if ( ! input )
+            return file_error;
+
+        wav_format format;
+        error_type error = read_wav_header( input, format );
+        if ( error != no_error )
+        {
+            fclose( input );
+            return error;
+        }
+
+        if ( format.channels != (unsigned int)_channels )
+        {
+            fclose( input );
+            return channel_error;
+        }
+
+        FILE * output = fopen( output_file, "wb" );
+        if ( ! output )
+        {
+            fclose( input );
+            return file_error;
+        }
+
+            // The size is fixed at the end.
+        if ( ! write_wav_header( output, format, 0 ) )
+            error = file_error;
+
+            // One block of the file data. This is the only memory which this method allocates.
+        unsigned int frame_bytes = format.channels * format.bytes_per_sample;
+        std::vector<unsigned char> block( _block_size * frame_bytes );
+        unsigned long long remaining_frames = format.data_size / frame_bytes;
+        unsigned long long written_bytes = 0;
+
+        while ( error == no_error )
+        {
+            unsigned int frames = _block_size;
+            if ( format.data_size && remaining_frames < frames )
+                frames = remaining_frames;
+
+            frames = fread( &block[0], frame_bytes, frames, input );
+            if ( frames == 0 )
+                break;
+            remaining_frames -= frames;
+
+                // Same as the I2S. The rx buffer is filled, and the tx buffer is processed.
+            unpack_samples( &block[0], _rx_int_buffer[0], frames * _channels, format );
+            for ( int i=frames*_channels; i<_block_size*_channels; i++ )
+                _rx_int_buffer[0][i] = 0;
+
+            _process_block( 0 );
+
+            pack_samples( _tx_int_buffer[0], &block[0], frames * _channels, format );
+            if ( fwrite( &block[0], frame_bytes, frames, output ) != frames )
+                error = file_error;
+            written_bytes += frames * frame_bytes;
+        }
+
+        if ( ferror( input ) )
+            error = file_error;
+
+            // Fix the size in the header.
+        if ( error == no_error )
+        {
+            if ( fseek( output, 0, SEEK_SET ) != 0 || ! write_wav_header( output, format, written_bytes ) )
+                error = file_error;
+        }
+
+        fclose( input );
+        if ( fclose( output ) != 0 && error == no_error )
+            error = file_error;
+
+        return error;
+    }
+
+    unsigned int OfflineFramework::render_files(
+                const char * const input_files[],
+                const char * const output_files[],
+                unsigned int count,
+                unsigned int threads,
+                void (* setup )( OfflineFramework & framework )
+                )
+    {
+        std::atomic<unsigned int> next_file( 0 );
+        std::atomic<unsigned int> failures( 0 );
+        std::vector<std::thread> workers;
+
+        if ( threads == 0 )
+            threads = 1;
+
+            // Each worker takes the next file until all files are done.
+        for ( unsigned int t=0; t<threads; t++ )
+        {
+            workers.push_back( std::thread( [&]()
+            {
+                OfflineFramework framework;
+                setup( framework );
+
+                for ( unsigned int i=next_file++; i<count; i=next_file++ )
+                    if ( framework.render( input_files[i], output_files[i] ) != no_error )
+                        failures ++;
+            } ) );
+        }
+
+        for ( unsigned int t=0; t<threads; t++ )
+            workers[t].join();
+
+        return failures;
+    }
+}
+
+#endif  // UNZEN_HOST
@@ -0,0 +1,89 @@
+/**
+* \brief header file for the offline rendering of the unzen audio frame work
+* \details
+* Host only. Compile with UNZEN_HOST defined.
+*/
+
+#ifndef _unzen_offline_h_
+#define _unzen_offline_h_
+
+#include "unzen.h"
+
+namespace unzen
+{
+    /**
+      \brief audio framework which processes WAV files instead of I2S.
+      \details
+      Same with \ref Framework, except the data comes from a file. The samples are converted and passed to
+      the call back by the same code with the process interrupt. Then, the call back for the device can be
+      tested with the recorded data, as fast as CPU allows.
+
+      The file is read and written by the block. The memory usage doesn't depend on the length of the file.
+
+      Supported format is the linear PCM of 16, 24, 32bit integer and 32bit float, including
+      WAVE_FORMAT_EXTENSIBLE. The output file has the same format with the input file.
+
+      example :
+      \code
+unzen::OfflineFramework audio;
+
+int main()
+{
+    audio.set_block_size( 64 );
+    audio.start( init_callback, process_callback );
+    audio.render( "capture.wav", "processed.wav" );
+}
+      \endcode
+    */
+    class OfflineFramework : public Framework
+    {
+    public:
+            /**
+                \constructor
+                \details
+                Same with \ref Framework::Framework(). But the I2S and the interrupts are not touched.
+                Several objects can work in parallel.
+            */
+        OfflineFramework(void);
+
+            /**
+                \brief process a file.
+                \param input_file name of the WAV file to read.
+                \param output_file name of the WAV file to write.
+                \returns show the error status
+                \details
+                Must be called after \ref start(). The number of channels of the input file must be same with
+                \ref set_channel_count(). Otherwise, \ref channel_error is returned.
+
+                The last block is padded by zero. Only the samples in the input file are written.
+            */
+        error_type render( const char * input_file, const char * output_file );
+
+            /**
+                \brief process several files in parallel.
+                \param input_files array of the names of the WAV files to read.
+                \param output_files array of the names of the WAV files to write.
+                \param count number of files.
+                \param threads number of threads.
+                \param setup call back to configure a framework and call \ref start().
+                \returns number of the files failed.
+                \details
+                Each thread has its own framework. The setup call back is called once for each framework,
+                from its thread. The process call back is called from several threads in parallel. So, it
+                must not share the state between the files.
+            */
+        static unsigned int render_files(
+                const char * const input_files[],
+                const char * const output_files[],
+                unsigned int count,
+                unsigned int threads,
+                void (* setup )( OfflineFramework & framework )
+                );
+
+    private:
+            // No I2S. The transport is always offline.
+        using Framework::set_transport;
+    };
+}
+
+#endif
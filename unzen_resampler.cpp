@@ -0,0 +1,235 @@
+#include <math.h>
+#include <new>
+
+#include "unzen_resampler.h"
+#include "unzen_convert.h"
+
+#if defined(UNZEN_CONVERT_AVX2)
+#include <immintrin.h>
+#elif defined(UNZEN_CONVERT_SSE2)
+#include <emmintrin.h>
+#elif defined(UNZEN_CONVERT_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace unzen
+{
+        // M_PI is not in the strict C++ mode of some tool chains.
+    static const double pi = 3.14159265358979323846;
+
+        // Stop band attenuation of the Kaiser window [dB], and its beta. 
+    static const double kaiser_attenuation = 80.0;
+    static const double kaiser_beta = 7.857;
+
+        // Length of the prototype filter per ( max( up, down ) / up ). The transition band is 20% of the lower Nyquist.
+    static const unsigned int taps_per_ratio = 50;
+
+        // Modified Bessel function of the first kind, order 0.
+    static double bessel_i0( double x )
+    {
+        double sum = 1.0;
+        double term = 1.0;
+
+        for ( int k=1; k<32; k++ )
+        {
+            term *= ( x / ( 2.0 * k ) ) * ( x / ( 2.0 * k ) );
+            sum += term;
+        }
+        return sum;
+    }
+
+    static unsigned int greatest_common_divisor( unsigned int a, unsigned int b )
+    {
+        while ( b )
+        {
+            unsigned int r = a % b;
+            a = b;
+            b = r;
+        }
+        return a;
+    }
+
+        // Dot product of two arrays. The length is the multiple of 8.
+    static inline float dot_product( const float a[], const float b[], unsigned int length )
+    {
+#if defined(UNZEN_CONVERT_AVX2)
+        __m256 sum = _mm256_setzero_ps();
+
+        for ( unsigned int i=0; i<length; i+=8 )
+            sum = _mm256_add_ps( sum, _mm256_mul_ps( _mm256_loadu_ps( &a[i] ), _mm256_loadu_ps( &b[i] ) ) );
+
+        __m128 half = _mm_add_ps( _mm256_castps256_ps128( sum ), _mm256_extractf128_ps( sum, 1 ) );
+        half = _mm_add_ps( half, _mm_movehl_ps( half, half ) );
+        half = _mm_add_ss( half, _mm_shuffle_ps( half, half, 1 ) );
+        return _mm_cvtss_f32( half );
+#elif defined(UNZEN_CONVERT_SSE2)
+            // Two accumulators to hide the latency of the addition.
+        __m128 sum0 = _mm_setzero_ps();
+        __m128 sum1 = _mm_setzero_ps();
+
+        for ( unsigned int i=0; i<length; i+=8 )
+        {
+            sum0 = _mm_add_ps( sum0, _mm_mul_ps( _mm_loadu_ps( &a[i] ),   _mm_loadu_ps( &b[i] ) ) );
+            sum1 = _mm_add_ps( sum1, _mm_mul_ps( _mm_loadu_ps( &a[i+4] ), _mm_loadu_ps( &b[i+4] ) ) );
+        }
+
+        __m128 sum = _mm_add_ps( sum0, sum1 );
+        sum = _mm_add_ps( sum, _mm_movehl_ps( sum, sum ) );
+        sum = _mm_add_ss( sum, _mm_shuffle_ps( sum, sum, 1 ) );
+        return _mm_cvtss_f32( sum );
+#elif defined(UNZEN_CONVERT_NEON)
+        float32x4_t sum0 = vdupq_n_f32( 0 );
+        float32x4_t sum1 = vdupq_n_f32( 0 );
+
+        for ( unsigned int i=0; i<length; i+=8 )
+        {
+            sum0 = vmlaq_f32( sum0, vld1q_f32( &a[i] ),   vld1q_f32( &b[i] ) );
+            sum1 = vmlaq_f32( sum1, vld1q_f32( &a[i+4] ), vld1q_f32( &b[i+4] ) );
+        }
+
+        float32x4_t sum = vaddq_f32( sum0, sum1 );
+        float32x2_t pair = vadd_f32( vget_low_f32( sum ), vget_high_f32( sum ) );
+        return vget_lane_f32( vpadd_f32( pair, pair ), 0 );
+#else
+            // Four accumulators. The FPU of Cortex-M7 can issue the next MAC while the previous one is running.
+        float sum0 = 0, sum1 = 0, sum2 = 0, sum3 = 0;
+
+        for ( unsigned int i=0; i<length; i+=4 )
+        {
+            sum0 += a[i]   * b[i];
+            sum1 += a[i+1] * b[i+1];
+            sum2 += a[i+2] * b[i+2];
+            sum3 += a[i+3] * b[i+3];
+        }
+        return ( sum0 + sum1 ) + ( sum2 + sum3 );
+#endif
+    }
+
+    Resampler::Resampler(void)
+    {
+        _up = 1;
+        _down = 1;
+        _channels = 0;
+        _taps = 0;
+        _coefficients = NULL;
+        _history = NULL;
+    }
+
+    Resampler::~Resampler(void)
+    {
+        _release();
+    }
+
+    void Resampler::_release(void)
+    {
+        delete [] _coefficients;
+        _coefficients = NULL;
+        _history = NULL;
+        _channels = 0;
+    }
+
+    error_type Resampler::setup( unsigned int up, unsigned int down, unsigned int channels, unsigned int taps_per_phase )
+    {
+        if ( channels < 1 || channels > (unsigned int)max_channels )
+            return channel_error;
+        if ( up == 0 || down == 0 )
+            return block_size_error;
+
+        _release();
+
+        unsigned int divisor = greatest_common_divisor( up, down );
+        _up = up / divisor;
+        _down = down / divisor;
+
+        unsigned int larger = ( _up > _down ) ? _up : _down;
+
+            // The phase length for the 80dB stop band, rounded up for the vector kernels.
+        if ( taps_per_phase == 0 )
+            taps_per_phase = ( taps_per_ratio * larger + _up - 1 ) / _up;
+        _taps = ( taps_per_phase + 7 ) / 8 * 8;
+
+            // The table of all phases, then the history of all channels.
+        _coefficients = new ( std::nothrow ) float[ _up * _taps + channels * 2 * _taps ];
+        if ( _coefficients == NULL )
+            return memory_allocation_error;
+        _history = _coefficients + _up * _taps;
+        _channels = channels;
+
+            // Prototype low pass filter at the rate of input * up. The transition band of the Kaiser window is 
+            // centered at the cut off. So, the cut off is half of the band below the lower Nyquist frequency. 
+            // Then, the stop band starts at the Nyquist, and nothing aliases under it. 
+            // A too short phase for the ratio keeps the cut off at half of the Nyquist, and aliases.
+        unsigned int length = _up * _taps;
+        double nyquist = 0.5 / larger;
+        double transition = ( kaiser_attenuation - 7.95 ) / ( 14.36 * ( length - 1 ) );
+        double cutoff = nyquist - transition / 2;
+        if ( cutoff < nyquist / 2 )
+            cutoff = nyquist / 2;
+        double center = ( length - 1 ) / 2.0;
+        double sum = 0;
+
+        for ( unsigned int k=0; k<length; k++ )
+        {
+            double t = k - center;
+            double sinc = ( t == 0 ) ? 1.0 : sin( 2.0 * pi * cutoff * t ) / ( 2.0 * pi * cutoff * t );
+            double ratio = t / ( center + 0.5 );
+            double window = bessel_i0( kaiser_beta * sqrt( 1.0 - ratio * ratio ) ) / bessel_i0( kaiser_beta );
+            double h = sinc * window;
+
+                // Phase k % up, tap k / up. Reversed in the phase.
+            _coefficients[ ( k % _up ) * _taps + ( _taps - 1 - k / _up ) ] = (float)h;
+            sum += h;
+        }
+
+            // Unity gain at DC for each output. The zero stuffing loses the gain of up.
+        for ( unsigned int k=0; k<length; k++ )
+            _coefficients[k] = (float)( _coefficients[k] * _up / sum );
+
+        reset();
+        return no_error;
+    }
+
+    void Resampler::reset(void)
+    {
+        for ( unsigned int i=0; i<_channels * 2 * _taps; i++ )
+            _history[i] = 0;
+
+        for ( unsigned int ch=0; ch<(unsigned int)max_channels; ch++ )
+        {
+            _position[ch] = 0;
+            _phase[ch] = 0;
+        }
+    }
+
+    float Resampler::get_delay(void) const
+    {
+        return ( _up * _taps - 1 ) / ( 2.0f * _up );
+    }
+
+    unsigned int Resampler::process( unsigned int channel, const float in[], unsigned int length, float out[] )
+    {
+        float * history = _history + channel * 2 * _taps;
+        unsigned int position = _position[channel];
+        unsigned int phase = _phase[channel];
+        unsigned int count = 0;
+
+        for ( unsigned int i=0; i<length; i++ )
+        {
+                // Write twice. Then, the latest samples are contiguous from position.
+            history[position] = in[i];
+            history[position + _taps] = in[i];
+            position ++;
+            if ( position >= _taps )
+                position = 0;
+
+                // Output all samples between this input and the next one.
+            for ( ; phase < _up; phase += _down )
+                out[count++] = dot_product( &_coefficients[ phase * _taps ], &history[position], _taps );
+            phase -= _up;
+        }
+
+        _position[channel] = position;
+        _phase[channel] = phase;
+        return count;
+    }
+}
@@ -0,0 +1,117 @@
+/**
+* \brief header file for the polyphase sample rate converter of the unzen audio frame work
+*/
+
+#ifndef _unzen_resampler_h_
+#define _unzen_resampler_h_
+
+#include "unzen.h"
+
+namespace unzen
+{
+    /**
+      \brief polyphase FIR sample rate converter by the rational ratio.
+      \details
+      The output rate is input rate * up / down. For example, 1/2 for 96kHz to 48kHz, 1/3 for 48kHz
+      to 16kHz, and 160/147 for 44.1kHz to 48kHz.
+
+      The low pass filter is a Kaiser windowed sinc. It is designed once in \ref setup(), and split into
+      up phases. Each output sample is one dot product of a phase and the input history. Only the needed
+      output samples are computed. The dot product is vectorized by the same kernel selection with
+      unzen_convert.h.
+
+      The filter is shared by all channels. Each channel has its own history.
+
+      With the default phase length, the pass band is flat up to 80% of the lower Nyquist frequency. 
+      The stop band starts at the lower Nyquist frequency, and its attenuation is about 80dB. Then, 
+      the aliasing is under 80dB in all of the output band. 
+    */
+    class Resampler
+    {
+    public:
+            /**
+                \constructor
+                \details
+                The converter is not ready until \ref setup() is called.
+            */
+        Resampler(void);
+
+            /**
+                \destructor
+            */
+        ~Resampler(void);
+
+            /**
+                \brief design the filter and allocate the history.
+                \param up interpolation factor.
+                \param down decimation factor.
+                \param channels number of channels.
+                \param taps_per_phase length of each phase. 0 chooses from the ratio.
+                \returns show the error status
+                \details
+                The ratio is reduced. 2/6 is same with 1/3. The longer phase makes the transition band
+                narrower, at the cost of CPU. The transition band ends at the lower Nyquist frequency. 
+                So, the shorter phase lowers the pass band.
+            */
+        error_type setup( unsigned int up, unsigned int down, unsigned int channels, unsigned int taps_per_phase = 0 );
+
+            /**
+                \brief convert a block of a channel.
+                \param channel channel index.
+                \param in input samples.
+                \param length number of input samples.
+                \param out place to write the output samples.
+                \returns number of output samples.
+                \details
+                If length * up is the multiple of down, exactly length * up / down samples are written.
+                Then, all channels stay in the same phase.
+            */
+        unsigned int process( unsigned int channel, const float in[], unsigned int length, float out[] );
+
+            /**
+                \brief clear the history of all channels.
+            */
+        void reset(void);
+
+            /**
+                \brief group delay of the filter.
+                \returns delay [input sample].
+            */
+        float get_delay(void) const;
+
+            /**
+                \brief reduced interpolation factor.
+            */
+        unsigned int get_up(void) const { return _up; }
+
+            /**
+                \brief reduced decimation factor.
+            */
+        unsigned int get_down(void) const { return _down; }
+
+    private:
+        unsigned int _up;
+        unsigned int _down;
+        unsigned int _channels;
+
+            // Length of each phase. Rounded up to the multiple of 8 for the vector kernels. The filter is 
+            // designed with this length. No zero padding.
+        unsigned int _taps;
+
+            // _coefficients[ phase * _taps + k ]. Reversed in time. Then, the dot product runs with the history
+            // from the oldest to the newest. The history follows in the same allocation.
+        float * _coefficients;
+
+            // History of each channel. 2 * _taps samples. Each sample is written twice, at position and
+            // position + _taps. Then, the latest _taps samples are always contiguous.
+        float * _history;
+
+            // Write position of the history, and the next phase to output, of each channel.
+        unsigned int _position[max_channels];
+        unsigned int _phase[max_channels];
+
+        void _release(void);
+    };
+}
+
+#endif
@@ -0,0 +1,231 @@
+/**
+* \brief header file for the single producer single consumer queue of the unzen audio frame work
+*/
+
+#ifndef _unzen_spsc_h_
+#define _unzen_spsc_h_
+
+#include <atomic>
+#include <new>
+#include <string.h>
+
+namespace unzen
+{
+    /**
+      \brief wait-free queue between one producer and one consumer.
+      \tparam T type of the item. Copied by value.
+      \tparam Size capacity of the queue. Must be the power of 2.
+      \details
+      The producer and the consumer can be in the different contexts, like main() and an interrupt,
+      or two threads. No lock and no interrupt disabling are needed. Each index is written only by one
+      side. The item is written before the index is published, with the release order.
+
+      Only one context can call \ref push(), and only one context can call \ref pop().
+    */
+    template < typename T, unsigned int Size >
+    class SpscQueue
+    {
+    public:
+        static_assert( Size > 0 && ( Size & ( Size - 1 ) ) == 0, "Size must be the power of 2" );
+
+            /**
+                \constructor
+            */
+        SpscQueue(void) : _write_count( 0 ), _read_count( 0 )
+        {
+        }
+
+            /**
+                \brief put an item. Producer side.
+                \param item the item to copy into the queue.
+                \returns false if the queue is full. The item is not queued.
+            */
+        bool push( const T & item )
+        {
+            unsigned int write_count = _write_count.load( std::memory_order_relaxed );
+
+            if ( write_count - _read_count.load( std::memory_order_acquire ) >= Size )
+                return false;
+
+            _items[ write_count & ( Size - 1 ) ] = item;
+            _write_count.store( write_count + 1, std::memory_order_release );
+            return true;
+        }
+
+            /**
+                \brief take an item. Consumer side.
+                \param item place to copy the item.
+                \returns false if the queue is empty.
+            */
+        bool pop( T & item )
+        {
+            unsigned int read_count = _read_count.load( std::memory_order_relaxed );
+
+            if ( read_count == _write_count.load( std::memory_order_acquire ) )
+                return false;
+
+            item = _items[ read_count & ( Size - 1 ) ];
+            _read_count.store( read_count + 1, std::memory_order_release );
+            return true;
+        }
+
+            /**
+                \brief number of items in the queue.
+                \details
+                Can be called from both sides. The value may change soon by the other side.
+            */
+        unsigned int count(void) const
+        {
+            return _write_count.load( std::memory_order_acquire ) - _read_count.load( std::memory_order_acquire );
+        }
+
+    private:
+        T _items[Size];
+
+            // Number of items pushed and popped. Wrap around. Size divides 2^32.
+        std::atomic<unsigned int> _write_count;
+        std::atomic<unsigned int> _read_count;
+    };
+    
+    /**
+      \brief wait-free ring of samples between one producer and one consumer.
+      \tparam T type of the sample.
+      \details
+      Same with \ref SpscQueue, except the size is given at run time and the samples are moved in bulk.
+      A contiguous write is done by one or two memcpy().
+    */
+    template < typename T >
+    class SpscRing
+    {
+    public:
+            /**
+                \constructor
+            */
+        SpscRing(void) : _items( NULL ), _size( 0 ), _write_count( 0 ), _read_count( 0 )
+        {
+        }
+
+            /**
+                \destructor
+            */
+        ~SpscRing(void)
+        {
+            delete [] _items;
+        }
+
+            /**
+                \brief allocate the ring, and make it empty.
+                \param size capacity [sample]. Must be the power of 2. 0 releases the memory.
+                \returns false if the size is wrong, or the memory is exhausted.
+                \details
+                Must not be called while the producer or the consumer is working.
+            */
+        bool allocate( unsigned int size )
+        {
+            if ( size & ( size - 1 ) )
+                return false;
+
+            delete [] _items;
+            _items = NULL;
+            _size = 0;
+            _write_count.store( 0 );
+            _read_count.store( 0 );
+
+            if ( size )
+            {
+                _items = new ( std::nothrow ) T[size];
+                if ( _items == NULL )
+                    return false;
+                _size = size;
+            }
+            return true;
+        }
+
+            /**
+                \brief put samples. Producer side.
+                \param items samples to copy.
+                \param length number of samples to put.
+                \param stride distance between the samples in items. 1 is contiguous.
+                \returns false if there is no room for all samples. Nothing is written.
+            */
+        bool write( const T items[], unsigned int length, unsigned int stride = 1 )
+        {
+            unsigned int write_count = _write_count.load( std::memory_order_relaxed );
+
+            if ( _size - ( write_count - _read_count.load( std::memory_order_acquire ) ) < length )
+                return false;
+
+            unsigned int position = write_count & ( _size - 1 );
+
+            if ( stride == 1 )
+            {
+                    // Split at the end of the ring.
+                unsigned int first = ( length < _size - position ) ? length : _size - position;
+
+                memcpy( &_items[position], items, first * sizeof(T) );
+                memcpy( &_items[0], items + first, ( length - first ) * sizeof(T) );
+            }
+            else
+            {
+                for ( unsigned int i=0; i<length; i++ )
+                    _items[ ( position + i ) & ( _size - 1 ) ] = items[ i * stride ];
+            }
+
+            _write_count.store( write_count + length, std::memory_order_release );
+            return true;
+        }
+
+            /**
+                \brief take samples. Consumer side.
+                \param items place to copy the samples.
+                \param length maximum number of samples to take.
+                \returns number of samples taken.
+            */
+        unsigned int read( T items[], unsigned int length )
+        {
+            unsigned int read_count = _read_count.load( std::memory_order_relaxed );
+            unsigned int available = _write_count.load( std::memory_order_acquire ) - read_count;
+
+            if ( length > available )
+                length = available;
+
+            unsigned int position = read_count & ( _size - 1 );
+            unsigned int first = ( length < _size - position ) ? length : _size - position;
+
+            if ( length )
+            {
+                memcpy( items, &_items[position], first * sizeof(T) );
+                memcpy( items + first, &_items[0], ( length - first ) * sizeof(T) );
+            }
+
+            _read_count.store( read_count + length, std::memory_order_release );
+            return length;
+        }
+
+            /**
+                \brief number of samples in the ring.
+            */
+        unsigned int count(void) const
+        {
+            return _write_count.load( std::memory_order_acquire ) - _read_count.load( std::memory_order_acquire );
+        }
+
+            /**
+                \brief capacity of the ring [sample].
+            */
+        unsigned int size(void) const
+        {
+            return _size;
+        }
+
+    private:
+        T * _items;
+        unsigned int _size;
+
+            // Number of samples written and read. Wrap around. The size divides 2^32.
+        std::atomic<unsigned int> _write_count;
+        std::atomic<unsigned int> _read_count;
+    };
+}
+
+#endif
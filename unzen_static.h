@@ -0,0 +1,164 @@
+/**
+* \brief header file for the compile time specialized unzen audio frame work
+*/
+
+#ifndef _unzen_static_h_
+#define _unzen_static_h_
+
+#include "unzen.h"
+#include "unzen_convert.h"
+
+namespace unzen
+{
+    /**
+      \brief audio framework with the compile time block size.
+      \tparam BlockSize block size [sample]. Same meaning with the parameter of \ref Framework::set_block_size().
+      \tparam Channels number of channels. Same meaning with the parameter of \ref Framework::set_channel_count().
+      \tparam Depth depth of the buffer ring. Same meaning with the parameter of \ref Framework::set_buffer_depth().
+      \details
+      Same with \ref Framework, except :
+      \li The block size is given as template parameter. \ref Framework::set_block_size() returns \ref block_size_error.
+      \li The number of channels is given as template parameter. \ref Framework::set_channel_count() accepts only same value.
+      \li The depth of the buffer ring is given as template parameter. \ref Framework::set_buffer_depth() accepts only same value.
+      \li All buffers are the member of the object. No heap is used. Create the object as global variable to
+          place the buffers in the static memory.
+      \li The format conversion loops have the constant length. Then, the compiler can unroll and vectorize them.
+
+      The call back API is same with \ref Framework. With a callable object given to \ref start(), 
+      the conversion loops and the inlined call back are generated together, for the constant block size. 
+      This is the fastest way for the small block size.
+
+      example :
+      \code
+unzen::StaticFramework<16, 2> audio;
+
+int main()
+{
+    audio.start( init_callback, process_callback );
+    ...
+}
+      \endcode
+    */
+    template < unsigned int BlockSize, unsigned int Channels, unsigned int Depth = 2 >
+    class StaticFramework : public Framework
+    {
+    public:
+        static_assert( BlockSize > 0, "BlockSize must be greater than 0" );
+        static_assert( Channels >= 2 && Channels <= max_channels, "Channels must be 2 to max_channels" );
+        static_assert( Depth >= 2 && Depth <= max_buffer_depth, "Depth must be 2 to max_buffer_depth" );
+
+            /// block size [sample]
+        static constexpr unsigned int block_size = BlockSize;
+
+            /// number of channels
+        static constexpr unsigned int channels = Channels;
+
+            /// depth of the buffer ring
+        static constexpr unsigned int depth = Depth;
+
+            /**
+                \constructor
+                \param port I2S port to use. 
+                \details
+                Same with \ref Framework::Framework(). The buffers are attached here.
+            */
+        explicit StaticFramework( unsigned int port = 0 ) : Framework( BlockSize, Channels, Depth, port )
+        {
+            _attach_buffers( &_int_buffer_storage[0][0], int_buffer_stride, &_float_buffer_storage[0][0] );
+        }
+
+        using Framework::start;
+
+            /**
+                \brief start with a callable object. 
+                \details
+                Same with \ref Framework::start() of the callable object, but the block is processed with the 
+                constant length.
+            */
+        template < typename Processor >
+        error_type start( void (* init_cb ) (unsigned int), Processor & processor )
+        {
+            return _start_processor( init_cb, _run_static_processor< Processor >, &processor );
+        }
+
+    protected:
+            // Same with Framework::_process_float_block(), but the loop length is a constant.
+        virtual void _process_float_block( int32_t rx[], int32_t tx[] )
+        {
+            _convert_and_process( rx, tx, _process_callback );
+        }
+
+            // Format conversion around the call back. The call back is a function pointer or a callable object.
+        template < typename Callback >
+        void _convert_and_process( int32_t rx[], int32_t tx[], Callback & callback )
+        {
+            float * rx_left  = _float_buffer_storage[Channels];
+            float * rx_right = _float_buffer_storage[Channels + 1];
+            float * tx_left  = _float_buffer_storage[0];
+            float * tx_right = _float_buffer_storage[1];
+
+                // Format conversion. LRLR... to LLL..., RRR...
+            for ( unsigned int i=0; i<BlockSize; i++ )
+            {
+                rx_left[i]  = q31_to_float( rx[2*i] );
+                rx_right[i] = q31_to_float( rx[2*i+1] );
+            }
+            _feed_taps( tap_rx );
+            _profile_mark( profile_rx_conversion );
+
+            callback( rx_left, rx_right, tx_left, tx_right, BlockSize );
+            _profile_mark( profile_callback );
+            _feed_taps( tap_tx );
+
+                // Format conversion. LLL..., RRR... to LRLR...
+            for ( unsigned int i=0; i<BlockSize; i++ )
+            {
+                tx[2*i]   = float_to_q31( tx_left[i] );
+                tx[2*i+1] = float_to_q31( tx_right[i] );
+            }
+            _profile_mark( profile_tx_conversion );
+        }
+
+        template < typename Processor >
+        static void _run_static_processor( Framework * framework, int32_t rx[], int32_t tx[] )
+        {
+            StaticFramework * self = static_cast< StaticFramework * >( framework );
+
+            self->_convert_and_process( rx, tx, *static_cast< Processor * >( self->_processor_context ) );
+        }
+
+            // Same with Framework::_process_multichannel_block(), but the loop length is a constant.
+        virtual void _process_multichannel_block( int32_t rx[], int32_t tx[] )
+        {
+                // Format conversion. Frame major to channel major.
+            for ( unsigned int ch=0; ch<Channels; ch++ )
+                for ( unsigned int i=0; i<BlockSize; i++ )
+                    _float_buffer_storage[Channels + ch][i] = q31_to_float( rx[i*Channels + ch] );
+            _feed_taps( tap_rx );
+            _profile_mark( profile_rx_conversion );
+
+            _multichannel_process_callback( _rx_float_buffer, _tx_float_buffer, Channels, BlockSize );
+            _profile_mark( profile_callback );
+            _feed_taps( tap_tx );
+
+                // Format conversion. Channel major to frame major.
+            for ( unsigned int ch=0; ch<Channels; ch++ )
+                for ( unsigned int i=0; i<BlockSize; i++ )
+                    tx[i*Channels + ch] = float_to_q31( _float_buffer_storage[ch][i] );
+            _profile_mark( profile_tx_conversion );
+        }
+
+    private:
+            // Length of each int buffer [word]. Rounded up to the cache line.
+        static constexpr int int_buffer_stride =
+                ( Channels * BlockSize + cache_line_words - 1 ) / cache_line_words * cache_line_words;
+
+            // tx[0], tx[1], ... then rx[0], rx[1], ... Aligned to the cache line for DMA.
+        alignas( cache_line_words * sizeof(int32_t) ) int32_t _int_buffer_storage[Depth * 2][int_buffer_stride];
+
+            // tx ch0, ch1, ... then rx ch0, ch1, ...
+        alignas( cache_line_words * sizeof(int32_t) ) float _float_buffer_storage[Channels * 2][BlockSize];
+    };
+}
+
+#endif